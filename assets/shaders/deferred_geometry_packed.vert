@@ -0,0 +1,35 @@
+#version 450
+
+// Positions are snorm16 relative to the bounds of the mesh (dequantized by the model matrix),
+// normals are octahedral encoded snorm16 and uvs are half floats.
+layout (location = 0) in vec4 position;
+layout (location = 1) in vec2 normal;
+layout (location = 2) in vec2 uv;
+// Model matrix of the instance, from the per instance stream
+layout (location = 3) in mat4 model;
+
+layout (location = 0) out vec3 outPosition;
+layout (location = 1) out vec3 outNormal;
+layout (location = 2) out vec2 outUv;
+
+layout (push_constant) uniform PushConstants {
+  mat4 viewProjection;
+} pushConstants;
+
+vec3 decodeOctahedral (vec2 encoded) {
+  vec3 decoded = vec3 (encoded, 1.f - abs (encoded.x) - abs (encoded.y));
+  float fold = max (-decoded.z, 0.f);
+  decoded.x += decoded.x >= 0.f ? -fold : fold;
+  decoded.y += decoded.y >= 0.f ? -fold : fold;
+  return normalize (decoded);
+}
+
+void main () {
+  const vec4 _position = vec4 (position.xyz, 1.f);
+  const vec4 worldPosition = model * _position;
+  gl_Position = pushConstants.viewProjection * worldPosition;
+
+  outUv = uv;
+  outNormal = (model * vec4 (decodeOctahedral (normal), 0.f)).xyz;
+  outPosition = worldPosition.xyz;
+}
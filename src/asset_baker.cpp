@@ -1,118 +1,910 @@
+#include <math.h>
+#include <time.h>
 #include <stdio.h>
 #include <string.h>
 #include <dirent.h>
+#include <sys/stat.h>
+#include <immintrin.h>
 
+#include "mesh.hpp"
 #include "vkutils.hpp"
+#include "job_pool.hpp"
+#include "asset_pack.hpp"
 #include "asset_baker.hpp"
+#include "mesh_optimizer.hpp"
+#include "block_compression.hpp"
 
 #include <lz4/lib/lz4.h>
 #include <stb/stb_image.h>
 #include <stb/stb_sprintf.h>
-#include <rapidjson/document.h>
 
 namespace rei::assets {
 
-void bakeImage (const char* relativePath) {
+static_assert (REI_TEXTURE_MAX_MIPS == VKC_MAX_MIP_LEVELS, "Baked mip chain has to fit into a single texture");
+static_assert (
+  REI_TEXTURE_MAX_SIZE >> (REI_TEXTURE_MAX_MIPS - 1) == 1,
+  "Largest texture has to have a full mip chain"
+);
+
+// Size of the table used to convert linear values back to sRGB.
+// 12 bits of precision are enough to round-trip every 8-bit sRGB value.
+#ifndef REI_LINEAR_TO_SRGB_SIZE
+#  define REI_LINEAR_TO_SRGB_SIZE 4096u
+#endif
+
+struct ColorTables {
+  f32 srgbToLinear[256];
+  // Stored as u32 so that it can be used with gathers
+  u32 linearToSrgb[REI_LINEAR_TO_SRGB_SIZE];
+};
+
+static ColorTables createColorTables () {
+  ColorTables tables;
+
+  for (u32 index = 0; index < 256; ++index) {
+    f32 value = (f32) index / 255.f;
+    tables.srgbToLinear[index] = value <= 0.04045f ? value / 12.92f : powf ((value + 0.055f) / 1.055f, 2.4f);
+  }
+
+  for (u32 index = 0; index < REI_LINEAR_TO_SRGB_SIZE; ++index) {
+    f32 value = (f32) index / (f32) (REI_LINEAR_TO_SRGB_SIZE - 1);
+    value = value <= 0.0031308f ? value * 12.92f : 1.055f * powf (value, 1.f / 2.4f) - 0.055f;
+    tables.linearToSrgb[index] = (u32) (REI_CLAMP (value, 0.f, 1.f) * 255.f + 0.5f);
+  }
+
+  return tables;
+}
+
+static const ColorTables* getColorTables () {
+  // Function local statics are initialized only once, even if bake jobs race for it
+  static const ColorTables tables = createColorTables ();
+  return &tables;
+}
+
+// Averages 4 texels in linear space (alpha isn't gamma encoded, so it's averaged as is).
+// Texels are top left, top right, bottom left and bottom right. Sums and rounding (to nearest even,
+// there's no add that could be fused into the multiply) match the vectorized path exactly,
+// so that mips don't depend on the machine they were baked on.
+static void downsampleTexel (const ColorTables* tables, const u8* texels[4], u8* out) {
+  for (u32 channel = 0; channel < 3; ++channel) {
+    const f32* linear = tables->srgbToLinear;
+    f32 left = linear[texels[0][channel]] + linear[texels[2][channel]];
+    f32 right = linear[texels[1][channel]] + linear[texels[3][channel]];
+
+    u32 tableIndex = (u32) lrintf ((left + right) * (0.25f * (f32) (REI_LINEAR_TO_SRGB_SIZE - 1)));
+    out[channel] = (u8) tables->linearToSrgb[tableIndex];
+  }
+
+  u32 alpha = (u32) texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3];
+  out[3] = (u8) lrintf ((f32) alpha * 0.25f);
+}
+
+#ifdef __AVX2__
+
+// Converts 2 texels to linear space, alpha is kept as is
+static __m256 decodeTexels (const ColorTables* tables, const u8* texels, __m256i alphaMask) {
+  __m256i indices = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i*) texels));
+  __m256 linear = _mm256_i32gather_ps (tables->srgbToLinear, indices, 4);
+  return _mm256_blendv_ps (linear, _mm256_cvtepi32_ps (indices), _mm256_castsi256_ps (alphaMask));
+}
+
+// Downsamples 4x2 source texels into 2 destination texels
+static void downsampleTexels (const ColorTables* tables, const u8* top, const u8* bottom, u8* out) {
+  const __m256i alphaMask = _mm256_setr_epi32 (0, 0, 0, -1, 0, 0, 0, -1);
+
+  // Each register holds two neighbouring texels, sum them vertically first
+  __m256 left = _mm256_add_ps (decodeTexels (tables, top, alphaMask), decodeTexels (tables, bottom, alphaMask));
+  __m256 right = _mm256_add_ps (decodeTexels (tables, top + 8, alphaMask), decodeTexels (tables, bottom + 8, alphaMask));
+
+  // Then horizontally, so that the lower half is the left result and the upper one is the right
+  __m256 sum = _mm256_add_ps (
+    _mm256_permute2f128_ps (left, right, 0x20),
+    _mm256_permute2f128_ps (left, right, 0x31)
+  );
+
+  const __m256 encodeScale = _mm256_setr_ps (
+    0.25f * (f32) (REI_LINEAR_TO_SRGB_SIZE - 1),
+    0.25f * (f32) (REI_LINEAR_TO_SRGB_SIZE - 1),
+    0.25f * (f32) (REI_LINEAR_TO_SRGB_SIZE - 1),
+    0.25f,
+    0.25f * (f32) (REI_LINEAR_TO_SRGB_SIZE - 1),
+    0.25f * (f32) (REI_LINEAR_TO_SRGB_SIZE - 1),
+    0.25f * (f32) (REI_LINEAR_TO_SRGB_SIZE - 1),
+    0.25f
+  );
+
+  __m256i indices = _mm256_cvtps_epi32 (_mm256_mul_ps (sum, encodeScale));
+  __m256i encoded = _mm256_i32gather_epi32 ((const int*) tables->linearToSrgb, indices, 4);
+  encoded = _mm256_blendv_epi8 (encoded, indices, alphaMask);
+
+  // Pack the lowest byte of every 32-bit lane
+  const __m256i packMask = _mm256_setr_epi8 (
+    0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+  );
+
+  encoded = _mm256_shuffle_epi8 (encoded, packMask);
+  i32 texels[2] = {
+    _mm_cvtsi128_si32 (_mm256_castsi256_si128 (encoded)),
+    _mm_cvtsi128_si32 (_mm256_extracti128_si256 (encoded, 1))
+  };
+
+  memcpy (out, texels, sizeof (texels));
+}
+
+#endif
+
+// Averages up to 3x3 texels in linear space, used for the last row and column of odd sized sources.
+// Rows point to the first texel of each source row and columns are texel indices within them.
+static void downsampleEdgeTexel (
+  const ColorTables* tables,
+  const u8* const* rows,
+  u32 rowsCount,
+  const u32* columns,
+  u32 columnsCount,
+  u8* out
+) {
+  const f32 scale = 1.f / (f32) (rowsCount * columnsCount);
+
+  for (u32 channel = 0; channel < 3; ++channel) {
+    f32 sum = 0.f;
+    for (u32 row = 0; row < rowsCount; ++row) {
+      for (u32 column = 0; column < columnsCount; ++column)
+        sum += tables->srgbToLinear[rows[row][columns[column] * 4 + channel]];
+    }
+
+    u32 tableIndex = (u32) lrintf (sum * (scale * (f32) (REI_LINEAR_TO_SRGB_SIZE - 1)));
+    out[channel] = (u8) tables->linearToSrgb[REI_MIN (tableIndex, REI_LINEAR_TO_SRGB_SIZE - 1)];
+  }
+
+  u32 alpha = 0;
+  for (u32 row = 0; row < rowsCount; ++row) {
+    for (u32 column = 0; column < columnsCount; ++column) alpha += rows[row][columns[column] * 4 + 3];
+  }
+
+  out[3] = (u8) lrintf ((f32) alpha * scale);
+}
+
+// Gamma correct 2x2 box filter. The extra row and column of odd sizes are folded into the last
+// destination texels with 3 taps, so every source texel contributes. Single texel sizes are clamped.
+static void generateMip (const u8* source, u32 sourceWidth, u32 sourceHeight, u8* out) {
+  const auto tables = getColorTables ();
+  const u32 width = REI_MAX (sourceWidth >> 1, 1u);
+  const u32 height = REI_MAX (sourceHeight >> 1, 1u);
+
+  const b8 isWidthOdd = sourceWidth > 1 && (sourceWidth & 1);
+  const b8 isHeightOdd = sourceHeight > 1 && (sourceHeight & 1);
+  // Destination texels that are filtered with 2 taps horizontally
+  const u32 innerWidth = width - isWidthOdd;
+
+  for (u32 y = 0; y < height; ++y) {
+    const u32 rowsCount = isHeightOdd && y == height - 1 ? 3 : 2;
+    const u8* rows[3];
+    for (u32 row = 0; row < rowsCount; ++row)
+      rows[row] = source + (size_t) REI_MIN (2 * y + row, sourceHeight - 1) * sourceWidth * 4;
+
+    u8* destination = out + (size_t) y * width * 4;
+    u32 x = 0;
+
+    if (rowsCount == 2) {
+      const u8* top = rows[0];
+      const u8* bottom = rows[1];
+
+#ifdef __AVX2__
+      // Vectorized path reads 4 full source texels per row
+      if (sourceWidth > 1) {
+        for (; x + 1 < innerWidth; x += 2)
+          downsampleTexels (tables, top + x * 8, bottom + x * 8, destination + x * 4);
+      }
+#endif
+
+      for (; x < innerWidth; ++x) {
+        const u32 left = 2 * x, right = REI_MIN (2 * x + 1, sourceWidth - 1);
+        const u8* texels[4] = {top + left * 4, top + right * 4, bottom + left * 4, bottom + right * 4};
+        downsampleTexel (tables, texels, destination + x * 4);
+      }
+    }
+
+    for (; x < width; ++x) {
+      const u32 columnsCount = isWidthOdd && x == width - 1 ? 3 : 2;
+      u32 columns[3];
+      for (u32 column = 0; column < columnsCount; ++column)
+        columns[column] = REI_MIN (2 * x + column, sourceWidth - 1);
+
+      downsampleEdgeTexel (tables, rows, rowsCount, columns, columnsCount, destination + x * 4);
+    }
+  }
+}
+
+static TextureFormat chooseTextureFormat (gltf::AlphaMode alphaMode, const u8* pixels, u32 width, u32 height) {
+  switch (alphaMode) {
+    case gltf::AlphaMode::Opaque: return TextureFormat::BC1_SRGB;
+    // Cutouts need sharp alpha, while blended surfaces need alpha to be correlated with color
+    case gltf::AlphaMode::Mask: return TextureFormat::BC3_SRGB;
+    case gltf::AlphaMode::Blend: return TextureFormat::BC7_SRGB;
+
+    default: {
+      // Image isn't used as a base color by any material, so look for transparent texels
+      for (size_t index = 0; index < (size_t) width * height; ++index)
+        if (pixels[index * 4 + 3] != 255) return TextureFormat::BC3_SRGB;
+
+      return TextureFormat::BC1_SRGB;
+    }
+  }
+}
+
+// Replaces the extension of the file name, directories can have dots too. Fails when the source has no extension
+// or the output doesn't fit into 256 characters.
+static b8 getOutputPath (const char* sourcePath, char* out) {
+  const char* fileName = strrchr (sourcePath, '/');
+  const char* extension = strrchr (fileName ? fileName : sourcePath, '.');
+  if (!extension) return REI_FALSE;
+
+  const size_t stemLength = (size_t) (extension - sourcePath);
+  if (stemLength + sizeof (".rtex") > 256) return REI_FALSE;
+
+  memcpy (out, sourcePath, stemLength);
+  memcpy (out + stemLength, ".rtex", sizeof (".rtex"));
+  return REI_TRUE;
+}
+
+Result bakeImage (const char* relativePath, gltf::AlphaMode alphaMode) {
+  char outputPath[256];
+  if (!getOutputPath (relativePath, outputPath)) return Result::InvalidAssetFormat;
+
   i32 width, height, channels;
   auto pixels = stbi_load (relativePath, &width, &height, &channels, STBI_rgb_alpha);
-  REI_ASSERT (pixels);
+  if (!pixels) return Result::InvalidAssetFormat;
 
-  char outputPath[256] {};
-  strcpy (outputPath, relativePath);
-  char* extension = strrchr (outputPath, '.');
-  memcpy (extension + 1, "rtex", 5);
+  if ((u32) width > REI_TEXTURE_MAX_SIZE || (u32) height > REI_TEXTURE_MAX_SIZE) {
+    stbi_image_free (pixels);
+    return Result::InvalidAssetFormat;
+  }
 
   FILE* outputFile = fopen (outputPath, "wb");
+  if (!outputFile) {
+    stbi_image_free (pixels);
+    return Result::FileIsNotWritable;
+  }
 
-  i32 imageSize = width * height * 4;
-  i32 compressedBound = LZ4_compressBound (imageSize);
-  char* compressed = REI_MALLOC (char, compressedBound);
+  TextureHeader header {};
+  header.magic = REI_TEXTURE_MAGIC;
+  header.version = REI_TEXTURE_VERSION;
+  header.flags = TEXTURE_FLAG_LZ4;
 
-  i32 compressedActual = LZ4_compress_default (
-    (const char*) pixels,
-    compressed,
-    imageSize,
-    compressedBound
-  );
+  header.width = (u32) width;
+  header.height = (u32) height;
+  header.mipCount = REI_MIN ((u32) floorf (log2f ((f32) REI_MAX (width, height))) + 1, REI_TEXTURE_MAX_MIPS);
+  header.format = chooseTextureFormat (alphaMode, pixels, header.width, header.height);
+
+  size_t mipOffsets[REI_TEXTURE_MAX_MIPS], mipChainSize = 0;
 
+  for (u32 level = 0; level < header.mipCount; ++level) {
+    auto mip = &header.mips[level];
+    mip->width = REI_MAX (header.width >> level, 1u);
+    mip->height = REI_MAX (header.height >> level, 1u);
+
+    mipOffsets[level] = mipChainSize;
+    mipChainSize += (size_t) mip->width * mip->height * 4;
+  }
+
+  // Every level is stored right after the previous one
+  auto mipChain = REI_MALLOC (u8, mipChainSize);
+  memcpy (mipChain, pixels, (size_t) width * (size_t) height * 4);
   stbi_image_free (pixels);
 
-  if (compressedActual < compressedBound) {
-    char* temp = compressed;
-    compressed = REI_MALLOC (char, compressedActual);
-    memcpy (compressed, temp, compressedActual);
-    free (temp);
-  }
-
-  const char metadataFormat[] =
-R"({
-  "width":%d,
-  "height":%d,
-  "compressedSize":%d
-})";
-
-  char metadata[128] {};
-  stbsp_sprintf (
-    metadata,
-    metadataFormat,
-    width,
-    height,
-    compressedActual
-  );
+  for (u32 level = 1; level < header.mipCount; ++level) {
+    const auto previous = &header.mips[level - 1];
+    generateMip (mipChain + mipOffsets[level - 1], previous->width, previous->height, mipChain + mipOffsets[level]);
+  }
+
+  const u8* payload = mipChain;
+
+  if (header.format == TextureFormat::RGBA8_SRGB) {
+    for (u32 level = 0; level < header.mipCount; ++level) {
+      header.mips[level].offset = mipOffsets[level];
+      header.mips[level].size = (u64) header.mips[level].width * header.mips[level].height * 4;
+    }
+
+    header.size = mipChainSize;
+  } else {
+    bc::BlockFormat blockFormat = bc::BlockFormat::BC1;
+    if (header.format == TextureFormat::BC3_SRGB) blockFormat = bc::BlockFormat::BC3;
+    if (header.format == TextureFormat::BC7_SRGB) blockFormat = bc::BlockFormat::BC7;
+
+    for (u32 level = 0; level < header.mipCount; ++level) {
+      auto mip = &header.mips[level];
+      mip->offset = header.size;
+      mip->size = bc::getCompressedSize (blockFormat, mip->width, mip->height);
+
+      header.size += mip->size;
+    }
+
+    auto blocks = REI_MALLOC (u8, header.size);
+    for (u32 level = 0; level < header.mipCount; ++level) {
+      const auto mip = &header.mips[level];
+      bc::compressImage (blockFormat, mipChain + mipOffsets[level], mip->width, mip->height, blocks + mip->offset);
+    }
+
+    free (mipChain);
+    payload = mipChain = blocks;
+  }
+
+  header.chunksCount = (u32) ((header.size + REI_TEXTURE_CHUNK_SIZE - 1) / REI_TEXTURE_CHUNK_SIZE);
+  auto chunks = REI_MALLOC (vku::TextureChunk, header.chunksCount);
+
+  const i32 compressedBound = LZ4_compressBound ((i32) REI_TEXTURE_CHUNK_SIZE);
+  char* compressed = REI_MALLOC (char, (size_t) compressedBound * header.chunksCount);
+
+  // Compressed data is addressed relative to the start of the chunk table
+  u64 compressedOffset = sizeof (vku::TextureChunk) * header.chunksCount;
 
-  size_t metadataSize = strlen (metadata);
-  fwrite (&metadataSize, sizeof (size_t), 1, outputFile);
-  fwrite (metadata, 1, metadataSize, outputFile);
-  fwrite (compressed, 1, compressedActual, outputFile);
+  for (u32 index = 0; index < header.chunksCount; ++index) {
+    auto chunk = &chunks[index];
+    chunk->offset = (u64) index * REI_TEXTURE_CHUNK_SIZE;
+    chunk->size = (u32) REI_MIN ((u64) REI_TEXTURE_CHUNK_SIZE, header.size - chunk->offset);
+    chunk->compressedOffset = compressedOffset;
 
+    i32 compressedActual = LZ4_compress_default (
+      (const char*) payload + chunk->offset,
+      compressed + (compressedOffset - sizeof (vku::TextureChunk) * header.chunksCount),
+      (i32) chunk->size,
+      compressedBound
+    );
+
+    if (!compressedActual) {
+      free (mipChain);
+      free (chunks);
+      free (compressed);
+      fclose (outputFile);
+      remove (outputPath);
+      return Result::InvalidAssetFormat;
+    }
+
+    chunk->compressedSize = (u32) compressedActual;
+    compressedOffset += chunk->compressedSize;
+  }
+
+  free (mipChain);
+  header.compressedSize = compressedOffset;
+
+  const size_t compressedSize = compressedOffset - sizeof (vku::TextureChunk) * header.chunksCount;
+  b8 written = fwrite (&header, sizeof (TextureHeader), 1, outputFile) == 1;
+  written = written && fwrite (chunks, sizeof (vku::TextureChunk), header.chunksCount, outputFile) == header.chunksCount;
+  written = written && fwrite (compressed, 1, compressedSize, outputFile) == compressedSize;
+  written = !fclose (outputFile) && written;
+
+  free (chunks);
   free (compressed);
-  fclose (outputFile);
+
+  if (!written) {
+    remove (outputPath);
+    return Result::FileIsNotWritable;
+  }
+
+  return Result::Success;
+}
+
+enum class BakeStatus : u32 {
+  Baked,
+  Rebaked,
+  UpToDate,
+  Failed
+};
+
+struct ImageBakeJob {
+  char path[256];
+  const ManifestEntry* previous;
+  ManifestEntry entry;
+
+  u64 nanoseconds;
+  BakeStatus status;
+  b32 staleOutput;
+};
+
+static u64 getNanoseconds () noexcept {
+  timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (u64) now.tv_sec * 1000000000ull + (u64) now.tv_nsec;
+}
+
+static u64 hashFile (const char* relativePath) {
+  File file;
+  REI_CHECK (readFile (relativePath, REI_TRUE, &file));
+  u64 result = hash64 (file.contents, file.size);
+  free (file.contents);
+  return result;
+}
+
+static void bakeImageJob (void* data) {
+  auto job = (ImageBakeJob*) data;
+  u64 start = getNanoseconds ();
+
+  struct stat sourceInfo;
+  int statResult = stat (job->path, &sourceInfo);
+  REI_ASSERT (!statResult);
+
+  job->entry.size = (u64) sourceInfo.st_size;
+  job->entry.bakerVersion = REI_BAKER_VERSION;
+  job->entry.modificationTime = (i64) sourceInfo.st_mtim.tv_sec * 1000000000ll + (i64) sourceInfo.st_mtim.tv_nsec;
+
+  char outputPath[256];
+  if (!getOutputPath (job->path, outputPath)) {
+    job->status = BakeStatus::Failed;
+    job->nanoseconds = getNanoseconds () - start;
+    return;
+  }
+
+  struct stat outputInfo;
+  b8 outputExists = !stat (outputPath, &outputInfo);
+
+  const auto previous = job->previous;
+  b8 outputValid = previous && outputExists &&
+    previous->bakerVersion == REI_BAKER_VERSION &&
+    previous->alphaMode == job->entry.alphaMode &&
+    previous->outputSize == (u64) outputInfo.st_size;
+
+  job->staleOutput = outputExists && !outputValid;
+
+  if (outputValid && previous->size == job->entry.size && previous->modificationTime == job->entry.modificationTime) {
+    // Fast path, source file hasn't been touched since the last bake
+    job->entry.hash = previous->hash;
+    job->entry.outputSize = previous->outputSize;
+    job->status = BakeStatus::UpToDate;
+  } else {
+    job->entry.hash = hashFile (job->path);
+
+    if (outputValid && previous->hash == job->entry.hash) {
+      // Touched, but contents are the same
+      job->entry.outputSize = previous->outputSize;
+      job->status = BakeStatus::UpToDate;
+    } else {
+      if (bakeImage (job->path, job->entry.alphaMode) == Result::Success) {
+        statResult = stat (outputPath, &outputInfo);
+        REI_ASSERT (!statResult);
+
+        job->entry.outputSize = (u64) outputInfo.st_size;
+        job->status = previous ? BakeStatus::Rebaked : BakeStatus::Baked;
+      } else {
+        // Output of an earlier bake is stale now, so the image is baked again on the next run
+        if (outputExists) remove (outputPath);
+        job->entry.outputSize = 0;
+        job->status = BakeStatus::Failed;
+      }
+    }
+  }
+
+  job->nanoseconds = getNanoseconds () - start;
+}
+
+static int compareBakeJobs (const void* a, const void* b) {
+  return strcmp (((const ImageBakeJob*) a)->path, ((const ImageBakeJob*) b)->path);
+}
+
+static int compareManifestEntries (const void* a, const void* b) {
+  return strcmp (((const ManifestEntry*) a)->name, ((const ManifestEntry*) b)->name);
+}
+
+static void readManifest (const char* relativePath, ManifestEntry** entries, u64* entriesCount) {
+  *entries = nullptr;
+  *entriesCount = 0;
+
+  File manifest;
+  if (readFile (relativePath, REI_TRUE, &manifest) != Result::Success) return;
+
+  auto header = (const ManifestHeader*) manifest.contents;
+  b8 valid = manifest.size >= sizeof (ManifestHeader) && header->magic == REI_MANIFEST_MAGIC;
+  valid = valid && header->bakerVersion == REI_BAKER_VERSION;
+  valid = valid && manifest.size == sizeof (ManifestHeader) + sizeof (ManifestEntry) * header->entriesCount;
+
+  if (!valid) {
+    REI_LOG_WARN ("Ignoring corrupted manifest " ANSI_YELLOW "%s", relativePath);
+    free (manifest.contents);
+    return;
+  }
+
+  *entriesCount = header->entriesCount;
+  *entries = REI_MALLOC (ManifestEntry, *entriesCount);
+  memcpy (*entries, header + 1, sizeof (ManifestEntry) * *entriesCount);
+  free (manifest.contents);
+
+  qsort (*entries, *entriesCount, sizeof (ManifestEntry), compareManifestEntries);
+}
+
+// Images can be shared by multiple materials, the format has to satisfy the most demanding one
+static gltf::AlphaMode mergeAlphaModes (gltf::AlphaMode current, gltf::AlphaMode other) {
+  if (current == gltf::AlphaMode::Blend || other == gltf::AlphaMode::Blend) return gltf::AlphaMode::Blend;
+  if (current == gltf::AlphaMode::Mask || other == gltf::AlphaMode::Mask) return gltf::AlphaMode::Mask;
+  if (current == gltf::AlphaMode::Opaque || other == gltf::AlphaMode::Opaque) return gltf::AlphaMode::Opaque;
+
+  return gltf::AlphaMode::Unknown;
+}
+
+// Looks up how every image is used by the materials of the models in the directory
+static void assignAlphaModes (const char* relativePath, const char* modelName, ImageBakeJob* bakeJobs, u32 jobsCount) {
+  char modelPath[256];
+  stbsp_sprintf (modelPath, "%s%s", relativePath, modelName);
+
+  gltf::Data model;
+  gltf::load (modelPath, nullptr, &model);
+
+  for (size_t index = 0; index < model.materialsCount; ++index) {
+    const auto material = &model.materials[index];
+    if (material->baseColorTexture >= model.texturesCount) continue;
+
+    const u32 imageIndex = model.textures[material->baseColorTexture].source;
+    if (imageIndex >= model.imagesCount) continue;
+
+    ImageBakeJob key;
+    stbsp_sprintf (key.path, "%s%s", relativePath, model.images[imageIndex].uri);
+
+    auto job = (ImageBakeJob*) bsearch (&key, bakeJobs, jobsCount, sizeof (ImageBakeJob), compareBakeJobs);
+    if (job) job->entry.alphaMode = mergeAlphaModes (job->entry.alphaMode, material->alphaMode);
+  }
+
+  gltf::destroy (&model);
+}
+
+static void writeManifest (const char* relativePath, const ImageBakeJob* bakeJobs, u32 jobsCount) {
+  // Write to a temporary file first, so that an interrupted bake never leaves a half written manifest
+  char temporaryPath[256];
+  stbsp_sprintf (temporaryPath, "%s.tmp", relativePath);
+
+  FILE* output = fopen (temporaryPath, "wb");
+  REI_ASSERT (output);
+
+  ManifestHeader header;
+  header.entriesCount = jobsCount;
+  header.magic = REI_MANIFEST_MAGIC;
+  header.bakerVersion = REI_BAKER_VERSION;
+  fwrite (&header, sizeof (ManifestHeader), 1, output);
+
+  for (u32 index = 0; index < jobsCount; ++index)
+    fwrite (&bakeJobs[index].entry, sizeof (ManifestEntry), 1, output);
+
+  fclose (output);
+  rename (temporaryPath, relativePath);
 }
 
 void bakeImages (const char* relativePath) {
   DIR* directory = opendir (relativePath);
   REI_ASSERT (directory);
 
+  char manifestPath[256];
+  stbsp_sprintf (manifestPath, "%s%s", relativePath, REI_MANIFEST_NAME);
+
+  u64 previousCount = 0;
+  ManifestEntry* previousEntries = nullptr;
+  readManifest (manifestPath, &previousEntries, &previousCount);
+
+  u32 jobsCount = 0, jobsCapacity = 64;
+  auto bakeJobs = REI_MALLOC (ImageBakeJob, jobsCapacity);
+
+  u32 modelsCount = 0;
+  char modelNames[REI_BAKER_MAX_MODELS][256];
+
   dirent* current = nullptr;
   while ((current = readdir (directory))) {
     if (current->d_type != DT_DIR) {
-      char completePath[256] {};
-      strcpy (completePath, relativePath);
       const char* extension = strrchr (current->d_name, '.');
+      if (!extension) continue;
+
+      b8 isModel = !strcmp (extension + 1, "gltf") || !strcmp (extension + 1, "glb");
+      if (isModel && modelsCount < REI_BAKER_MAX_MODELS)
+        strcpy (modelNames[modelsCount++], current->d_name);
 
-      if (strcmp (extension + 1, "rtex") && strcmp (extension + 1, "bin") && strcmp (extension + 1, "gltf")) {
-        strcpy (completePath + strlen (relativePath), current->d_name);
-        bakeImage (completePath);
+      b8 isImage = !isModel && strcmp (extension + 1, "rtex") && strcmp (extension + 1, "bin");
+      isImage = isImage && strcmp (extension + 1, "manifest");
+      isImage = isImage && strcmp (extension + 1, "rpak") && strcmp (extension + 1, "tmp");
+      isImage = isImage && strcmp (extension + 1, "rmesh");
+
+      if (isImage) {
+        if (jobsCount == jobsCapacity) {
+          jobsCapacity *= 2;
+          bakeJobs = (ImageBakeJob*) realloc (bakeJobs, sizeof (ImageBakeJob) * jobsCapacity);
+        }
+
+        auto newJob = &bakeJobs[jobsCount++];
+        memset (newJob, 0, sizeof (ImageBakeJob));
+        strcpy (newJob->path, relativePath);
+        strcpy (newJob->path + strlen (relativePath), current->d_name);
+        strncpy (newJob->entry.name, current->d_name, sizeof (newJob->entry.name) - 1);
+        newJob->entry.alphaMode = gltf::AlphaMode::Unknown;
+
+        newJob->previous = (const ManifestEntry*) bsearch (
+          &newJob->entry,
+          previousEntries,
+          previousCount,
+          sizeof (ManifestEntry),
+          compareManifestEntries
+        );
       }
     }
   }
 
   closedir (directory);
+
+  // readdir order depends on the file system, sort the jobs
+  // so that the manifest and the report are reproducible.
+  qsort (bakeJobs, jobsCount, sizeof (ImageBakeJob), compareBakeJobs);
+
+  for (u32 index = 0; index < modelsCount; ++index)
+    assignAlphaModes (relativePath, modelNames[index], bakeJobs, jobsCount);
+
+  // Sources that disappeared since the last bake leave stale outputs behind
+  for (u64 index = 0; index < previousCount; ++index) {
+    const auto entry = &previousEntries[index];
+
+    b8 found = REI_FALSE;
+    for (u32 job = 0; job < jobsCount && !found; ++job)
+      found = bakeJobs[job].previous == entry;
+
+    if (!found) {
+      char sourcePath[256], outputPath[256];
+      stbsp_sprintf (sourcePath, "%s%s", relativePath, entry->name);
+      getOutputPath (sourcePath, outputPath);
+
+      if (!remove (outputPath))
+        REI_LOG_WARN ("Removed stale " ANSI_RED "%s" ANSI_YELLOW " (source is gone)", outputPath);
+    }
+  }
+
+  jobs::Pool pool;
+  jobs::createPool (0, &pool);
+
+  u64 start = getNanoseconds ();
+
+  // Every job lands on the queue of this thread, so submit them in waves that fit into it
+  for (u32 first = 0; first < jobsCount; first += REI_JOBS_QUEUE_CAPACITY) {
+    const u32 last = REI_MIN (first + REI_JOBS_QUEUE_CAPACITY, jobsCount);
+    for (u32 index = first; index < last; ++index)
+      jobs::submit (&pool, bakeImageJob, &bakeJobs[index]);
+
+    jobs::wait (&pool);
+  }
+
+  u64 wallTime = getNanoseconds () - start;
+
+  u64 totalTime = 0;
+  u32 bakedCount = 0;
+
+  for (u32 index = 0; index < jobsCount; ++index) {
+    const auto job = &bakeJobs[index];
+    totalTime += job->nanoseconds;
+
+    if (job->staleOutput)
+      REI_LOG_WARN ("Stale output of " ANSI_RED "%s" ANSI_YELLOW " was rebaked", job->path);
+
+    switch (job->status) {
+      case BakeStatus::UpToDate:
+        break;
+
+      case BakeStatus::Baked:
+      case BakeStatus::Rebaked:
+        ++bakedCount;
+        REI_LOG_INFO (
+          "%s " ANSI_YELLOW "%s" ANSI_GREEN " in %.2f ms",
+          job->status == BakeStatus::Baked ? "Baked" : "Rebaked",
+          job->path,
+          (f64) job->nanoseconds / 1e6
+        );
+        break;
+
+      case BakeStatus::Failed:
+        REI_LOG_ERROR ("Failed to bake " ANSI_YELLOW "%s", job->path);
+        break;
+    }
+  }
+
+  REI_LOG_INFO (
+    "Baked %u of %u images on %u threads in %.2f ms (%.2f ms of work, %.2fx speedup)",
+    bakedCount,
+    jobsCount,
+    pool.queuesCount,
+    (f64) wallTime / 1e6,
+    (f64) totalTime / 1e6,
+    wallTime ? (f64) totalTime / (f64) wallTime : 1.0
+  );
+
+  jobs::destroyPool (&pool);
+
+  writeManifest (manifestPath, bakeJobs, jobsCount);
+  free (previousEntries);
+  free (bakeJobs);
 }
 
-Result readImage (const char* relativePath, vku::TextureAllocationInfo* output) {
-  FILE* assetFile = fopen (relativePath, "rb");
-  if (!assetFile) return Result::FileDoesNotExist;
+// Fills allocation info from an image that is already in memory, pixels point into the data
+static Result parseImage (const void* data, size_t size, vku::TextureAllocationInfo* output) {
+  const auto header = (const TextureHeader*) data;
+
+  b8 valid = size >= sizeof (TextureHeader) && header->magic == REI_TEXTURE_MAGIC;
+  valid = valid && header->version == REI_TEXTURE_VERSION;
+  valid = valid && (header->flags & TEXTURE_FLAG_LZ4) && header->chunksCount;
+  valid = valid && header->mipCount && header->mipCount <= REI_TEXTURE_MAX_MIPS;
+  valid = valid && header->width && header->width <= REI_TEXTURE_MAX_SIZE;
+  valid = valid && header->height && header->height <= REI_TEXTURE_MAX_SIZE;
+  valid = valid && size - sizeof (TextureHeader) >= header->compressedSize;
+  valid = valid && header->compressedSize >= sizeof (vku::TextureChunk) * header->chunksCount;
+
+  if (!valid) return Result::InvalidAssetFormat;
 
-  size_t metadataSize = 0;
-  fread (&metadataSize, sizeof (size_t), 1, assetFile);
+  // Smallest level has to be at least a texel wide
+  if (!(REI_MAX (header->width, header->height) >> (header->mipCount - 1))) return Result::InvalidAssetFormat;
 
-  char* metadata = REI_ALLOCA (char, metadataSize);
-  fread (metadata, 1, metadataSize, assetFile);
-  metadata[metadataSize] = '\0';
+  switch (header->format) {
+    case TextureFormat::RGBA8_SRGB: output->format = VKC_TEXTURE_FORMAT; break;
+    case TextureFormat::BC1_SRGB: output->format = VK_FORMAT_BC1_RGB_SRGB_BLOCK; break;
+    case TextureFormat::BC3_SRGB: output->format = VK_FORMAT_BC3_SRGB_BLOCK; break;
+    case TextureFormat::BC7_SRGB: output->format = VK_FORMAT_BC7_SRGB_BLOCK; break;
+    default: return Result::InvalidAssetFormat;
+  }
+
+  const b8 compressed = header->format != TextureFormat::RGBA8_SRGB;
+  bc::BlockFormat blockFormat = bc::BlockFormat::BC1;
+  if (header->format == TextureFormat::BC3_SRGB) blockFormat = bc::BlockFormat::BC3;
+  if (header->format == TextureFormat::BC7_SRGB) blockFormat = bc::BlockFormat::BC7;
+
+  // Levels are tightly packed and their sizes follow from the format
+  u64 mipChainSize = 0;
+  for (u32 level = 0; level < header->mipCount; ++level) {
+    const auto mip = &header->mips[level];
+    const u32 width = REI_MAX (header->width >> level, 1u);
+    const u32 height = REI_MAX (header->height >> level, 1u);
+    const u64 mipSize = compressed ? bc::getCompressedSize (blockFormat, width, height) : (u64) width * height * 4;
+
+    if (mip->width != width || mip->height != height || mip->offset != mipChainSize || mip->size != mipSize)
+      return Result::InvalidAssetFormat;
 
-  rapidjson::Document parsedMetadata;
-  parsedMetadata.Parse (metadata);
+    mipChainSize += mipSize;
+  }
+
+  if (mipChainSize != header->size) return Result::InvalidAssetFormat;
 
-  output->width = parsedMetadata["width"].GetUint ();
-  output->height = parsedMetadata["height"].GetUint ();
-  output->compressedSize = (size_t) parsedMetadata["compressedSize"].GetUint64 ();
+  // Chunks have to cover the whole mip chain, and their compressed data has to stay inside of the image
+  const auto chunks = (const vku::TextureChunk*) (header + 1);
+  u64 decompressedSize = 0;
 
-  output->pixels = REI_MALLOC (char, output->compressedSize);
-  fread (output->pixels, 1, output->compressedSize, assetFile);
+  for (u32 index = 0; index < header->chunksCount; ++index) {
+    const auto chunk = &chunks[index];
+
+    if (
+      chunk->offset != decompressedSize ||
+      chunk->size > header->size - decompressedSize ||
+      chunk->compressedOffset < sizeof (vku::TextureChunk) * header->chunksCount ||
+      chunk->compressedOffset > header->compressedSize ||
+      chunk->compressedSize > header->compressedSize - chunk->compressedOffset
+    ) {
+      return Result::InvalidAssetFormat;
+    }
+
+    decompressedSize += chunk->size;
+  }
+
+  if (decompressedSize != header->size) return Result::InvalidAssetFormat;
+
+  output->width = header->width;
+  output->height = header->height;
+  output->mipCount = header->mipCount;
+  output->size = (size_t) header->size;
+  output->compressedSize = (size_t) header->compressedSize;
+
+  for (u32 level = 0; level < header->mipCount; ++level)
+    output->mipOffsets[level] = (size_t) header->mips[level].offset;
+
+  output->pixels = (const char*) (header + 1);
+  output->chunksCount = header->chunksCount;
+  output->chunks = chunks;
 
-  fclose (assetFile);
   return Result::Success;
 }
 
+Result readImage (const char* relativePath, const Pack* pack, vku::TextureAllocationInfo* output) {
+  if (pack) {
+    size_t size;
+    const void* blob = findBlob (pack, relativePath, &size);
+
+    if (blob) {
+      // Pack owns the mapping
+      output->file.size = 0;
+      output->file.contents = nullptr;
+      return parseImage (blob, size, output);
+    }
+  }
+
+  // Compressed chunks are decompressed straight from the mapping into the staging buffer
+  Result result = mapFile (relativePath, &output->file);
+  if (result != Result::Success) return result;
+
+  result = parseImage (output->file.contents, output->file.size, output);
+  if (result != Result::Success) unmapFile (&output->file);
+
+  return result;
+}
+
+void releaseImage (vku::TextureAllocationInfo* image) {
+  if (image->file.contents) unmapFile (&image->file);
+}
+
+void bakeMesh (const char* relativePath) {
+  char outputPath[256];
+  strcpy (outputPath, relativePath);
+  char* extension = strrchr (outputPath, '.');
+  memcpy (extension + 1, "rmesh", 6);
+
+  gltf::Data gltf;
+  gltf::load (relativePath, nullptr, &gltf);
+
+  jobs::Pool pool;
+  jobs::createPool (0, &pool);
+
+  Mesh mesh;
+  buildMesh (&gltf, &pool, &mesh);
+  gltf::destroy (&gltf);
+  jobs::destroyPool (&pool);
+
+  optimizeMesh (&mesh);
+  buildMeshlets (&mesh);
+  buildLods (&mesh);
+  writeMesh (outputPath, &mesh);
+  REI_LOG_INFO (
+    "Baked " ANSI_YELLOW "%s" ANSI_GREEN " (%u vertices, %u indices, %u batches, %u instances, %u meshlets, %u lods)",
+    outputPath,
+    mesh.vertexCount,
+    mesh.indexCount,
+    mesh.batchesCount,
+    mesh.instancesCount,
+    mesh.meshletsCount,
+    mesh.lodsCount
+  );
+
+  destroyMesh (&mesh);
+}
+
+void packDirectory (const char* relativePath, const char* outputPath) {
+  DIR* directory = opendir (relativePath);
+  REI_ASSERT (directory);
+
+  u32 count = 0, capacity = 64;
+  auto names = REI_MALLOC (char*, capacity);
+  auto paths = REI_MALLOC (char*, capacity);
+
+  dirent* current = nullptr;
+  while ((current = readdir (directory))) {
+    if (current->d_type == DT_DIR) continue;
+
+    // Only the files that are needed at runtime
+    const char* extension = strrchr (current->d_name, '.');
+    if (!extension) continue;
+    b8 isNeeded = !strcmp (extension + 1, "gltf") || !strcmp (extension + 1, "bin") || !strcmp (extension + 1, "glb");
+    isNeeded = isNeeded || !strcmp (extension + 1, "rtex") || !strcmp (extension + 1, "rmesh");
+    if (!isNeeded) continue;
+
+    if (count == capacity) {
+      capacity *= 2;
+      names = (char**) realloc (names, sizeof (char*) * capacity);
+      paths = (char**) realloc (paths, sizeof (char*) * capacity);
+    }
+
+    names[count] = REI_MALLOC (char, 256);
+    paths[count] = REI_MALLOC (char, 512);
+    strncpy (names[count], current->d_name, 255);
+    names[count][255] = '\0';
+    stbsp_snprintf (paths[count], 512, "%s%s", relativePath, current->d_name);
+    ++count;
+  }
+
+  closedir (directory);
+
+  writePack (outputPath, names, paths, count);
+  REI_LOG_INFO ("Packed %u files from " ANSI_YELLOW "%s" ANSI_GREEN " into " ANSI_YELLOW "%s", count, relativePath, outputPath);
+
+  for (u32 index = 0; index < count; ++index) {
+    free (names[index]);
+    free (paths[index]);
+  }
+
+  free (names);
+  free (paths);
+}
+
 }
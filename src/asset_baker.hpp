@@ -2,6 +2,49 @@
 #define ASSET_BAKER_HPP
 
 #include "common.hpp"
+#include "gltf.hpp"
+
+// Bump this every time the output of the baker changes,
+// so that previously baked assets get rebaked.
+#ifndef REI_BAKER_VERSION
+#  define REI_BAKER_VERSION 7u
+#endif
+
+// Manifest that is written next to the baked assets of every directory
+#ifndef REI_MANIFEST_NAME
+#  define REI_MANIFEST_NAME "baked.manifest"
+#endif
+
+// Models that are scanned for material alpha modes in a single directory
+#ifndef REI_BAKER_MAX_MODELS
+#  define REI_BAKER_MAX_MODELS 16u
+#endif
+
+#ifndef REI_MANIFEST_MAGIC
+#  define REI_MANIFEST_MAGIC 0x464E414Du // MANF
+#endif
+
+#ifndef REI_TEXTURE_MAGIC
+#  define REI_TEXTURE_MAGIC 0x58455452u // RTEX
+#endif
+
+#ifndef REI_TEXTURE_VERSION
+#  define REI_TEXTURE_VERSION 4u
+#endif
+
+// Texture data is compressed in independent chunks of this size, so that they can be decompressed in parallel
+#ifndef REI_TEXTURE_CHUNK_SIZE
+#  define REI_TEXTURE_CHUNK_SIZE (256u * 1024u)
+#endif
+
+#ifndef REI_TEXTURE_MAX_MIPS
+#  define REI_TEXTURE_MAX_MIPS 16u
+#endif
+
+// Largest width or height of a texture, its full mip chain has to fit into REI_TEXTURE_MAX_MIPS levels
+#ifndef REI_TEXTURE_MAX_SIZE
+#  define REI_TEXTURE_MAX_SIZE (1u << 15)
+#endif
 
 namespace rei::vku {
 struct TextureAllocationInfo;
@@ -9,9 +52,85 @@ struct TextureAllocationInfo;
 
 namespace rei::assets {
 
-void bakeImage (const char* relativePath);
+struct Pack;
+
+enum class TextureFormat : u32 {
+  RGBA8_SRGB,
+  BC1_SRGB,
+  BC3_SRGB,
+  BC7_SRGB
+};
+
+enum TextureFlags : u32 {
+  // Pixel data that follows the header is split into chunks compressed with LZ4
+  TEXTURE_FLAG_LZ4 = 1u << 0
+};
+
+struct TextureMip {
+  u32 width;
+  u32 height;
+  // Offset and size of the level inside of the decompressed pixel data
+  u64 offset;
+  u64 size;
+};
+
+// Every .rtex starts with this header, it's followed by the table of chunks and compressed chunks themselves.
+// The layout has no implicit padding, so it can be read with a single fread
+// or used directly from a mapping of the file.
+struct TextureHeader {
+  u32 magic;
+  u32 version;
+  TextureFormat format;
+  u32 flags;
+
+  u32 width;
+  u32 height;
+  u32 mipCount;
+  u32 chunksCount;
+
+  // Size of the pixel data before compression
+  u64 size;
+  // Size of everything that follows the header (chunk table included)
+  u64 compressedSize;
+
+  TextureMip mips[REI_TEXTURE_MAX_MIPS];
+};
+
+struct ManifestHeader {
+  u32 magic;
+  u32 bakerVersion;
+  u64 entriesCount;
+};
+
+// Describes a source file at the time it was baked
+struct ManifestEntry {
+  // File name relative to the baked directory
+  char name[248];
+  u32 bakerVersion;
+  // Alpha mode of the materials that use this image, it decides the output format
+  gltf::AlphaMode alphaMode;
+
+  u64 hash;
+  u64 size;
+  i64 modificationTime;
+  // Size of the baked file, used to detect truncated or overwritten outputs
+  u64 outputSize;
+};
+
+// Pass AlphaMode::Unknown to pick the format based on the contents of the image.
+// No output is left behind if the image can't be baked.
+Result bakeImage (const char* relativePath, gltf::AlphaMode alphaMode);
 void bakeImages (const char* relativePath);
-Result readImage (const char* relativePath, vku::TextureAllocationInfo* output);
+// Image is looked up in the pack first if it isn't null. It has to be
+// released with releaseImage once its pixels have been uploaded.
+Result readImage (const char* relativePath, const Pack* pack, vku::TextureAllocationInfo* output);
+void releaseImage (vku::TextureAllocationInfo* image);
+
+// Writes the vertex and index data of the glTF model into an .rmesh next to it (see mesh.hpp)
+void bakeMesh (const char* relativePath);
+
+// Packs baked assets and models of the directory into a single archive (see asset_pack.hpp)
+void packDirectory (const char* relativePath, const char* outputPath);
 
 }
 
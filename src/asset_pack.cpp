@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "asset_pack.hpp"
+
+namespace rei::assets {
+
+static int compareEntries (const void* a, const void* b) {
+  return strcmp (((const PackEntry*) a)->name, ((const PackEntry*) b)->name);
+}
+
+static u64 alignOffset (u64 offset) {
+  return (offset + REI_PACK_ALIGNMENT - 1) & ~((u64) REI_PACK_ALIGNMENT - 1);
+}
+
+Result openPack (const char* relativePath, Pack* out) {
+  Result result = mapFile (relativePath, &out->file);
+  if (result != Result::Success) return result;
+
+  const auto header = (const PackHeader*) out->file.contents;
+  b8 valid = out->file.size >= sizeof (PackHeader) && header->magic == REI_PACK_MAGIC;
+  valid = valid && header->version == REI_PACK_VERSION;
+  valid = valid && out->file.size - sizeof (PackHeader) >= header->entriesCount * sizeof (PackEntry);
+
+  if (!valid) {
+    unmapFile (&out->file);
+    return Result::InvalidAssetFormat;
+  }
+
+  out->entriesCount = header->entriesCount;
+  out->entries = (const PackEntry*) (header + 1);
+
+  // Blobs are looked up by name in load order, not in the order they are stored in,
+  // so ask for the whole pack to be read ahead instead of relying on sequential access.
+  madvise (out->file.contents, out->file.size, MADV_WILLNEED);
+
+  return Result::Success;
+}
+
+void closePack (Pack* pack) {
+  unmapFile (&pack->file);
+}
+
+const void* findBlob (const Pack* pack, const char* path, size_t* size) noexcept {
+  const char* fileName = strrchr (path, '/');
+  fileName = fileName ? fileName + 1 : path;
+
+  PackEntry key;
+  strncpy (key.name, fileName, sizeof (key.name) - 1);
+  key.name[sizeof (key.name) - 1] = '\0';
+
+  auto entry = (const PackEntry*) bsearch (
+    &key,
+    pack->entries,
+    pack->entriesCount,
+    sizeof (PackEntry),
+    compareEntries
+  );
+
+  if (!entry || entry->offset + entry->size > pack->file.size) return nullptr;
+
+  *size = (size_t) entry->size;
+  return (const u8*) pack->file.contents + entry->offset;
+}
+
+void writePack (const char* relativePath, const char* const* names, const char* const* paths, u32 count) {
+  auto entries = REI_MALLOC (PackEntry, count);
+  auto files = REI_MALLOC (File, count);
+
+  for (u32 index = 0; index < count; ++index) {
+    REI_CHECK (mapFile (paths[index], &files[index]));
+
+    memset (entries[index].name, 0, sizeof (entries[index].name));
+    strncpy (entries[index].name, names[index], sizeof (entries[index].name) - 1);
+    // Offset is used to remember the file that belongs to the entry until the entries are sorted
+    entries[index].offset = index;
+    entries[index].size = files[index].size;
+  }
+
+  qsort (entries, count, sizeof (PackEntry), compareEntries);
+
+  // Blobs are stored in the same order as entries
+  u32* order = REI_MALLOC (u32, count);
+  u64 offset = alignOffset (sizeof (PackHeader) + sizeof (PackEntry) * count);
+
+  for (u32 index = 0; index < count; ++index) {
+    order[index] = (u32) entries[index].offset;
+    entries[index].offset = offset;
+    offset = alignOffset (offset + entries[index].size);
+  }
+
+  char temporaryPath[256];
+  snprintf (temporaryPath, sizeof (temporaryPath), "%s.tmp", relativePath);
+
+  FILE* output = fopen (temporaryPath, "wb");
+  REI_ASSERT (output);
+
+  PackHeader header;
+  header.magic = REI_PACK_MAGIC;
+  header.version = REI_PACK_VERSION;
+  header.entriesCount = count;
+
+  fwrite (&header, sizeof (PackHeader), 1, output);
+  fwrite (entries, sizeof (PackEntry), count, output);
+
+  for (u32 index = 0; index < count; ++index) {
+    const auto file = &files[order[index]];
+
+    fseek (output, (long) entries[index].offset, SEEK_SET);
+    fwrite (file->contents, 1, file->size, output);
+    unmapFile (file);
+  }
+
+  // Pad the last blob, so that the pack can be mapped up to the aligned end
+  u8 zero = 0;
+  fseek (output, (long) offset - 1, SEEK_SET);
+  fwrite (&zero, 1, 1, output);
+
+  fclose (output);
+  rename (temporaryPath, relativePath);
+
+  free (order);
+  free (files);
+  free (entries);
+}
+
+}
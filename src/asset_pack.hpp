@@ -0,0 +1,56 @@
+#ifndef ASSET_PACK_HPP
+#define ASSET_PACK_HPP
+
+#include "common.hpp"
+
+#ifndef REI_PACK_MAGIC
+#  define REI_PACK_MAGIC 0x4B415052u // RPAK
+#endif
+
+#ifndef REI_PACK_VERSION
+#  define REI_PACK_VERSION 1u
+#endif
+
+// Blobs start on page boundaries, so that they can be mapped or copied
+// into staging buffers without violating any copy offset alignment.
+#ifndef REI_PACK_ALIGNMENT
+#  define REI_PACK_ALIGNMENT 4096u
+#endif
+
+namespace rei::assets {
+
+// Pack starts with this header followed by the table of contents
+struct PackHeader {
+  u32 magic;
+  u32 version;
+  u64 entriesCount;
+};
+
+// Entries are sorted by name, so that they can be binary searched
+struct PackEntry {
+  // File name of the blob (e.g. "Sponza.gltf")
+  char name[240];
+  // Offset from the start of the pack
+  u64 offset;
+  u64 size;
+};
+
+// Read only view of a mapped pack
+struct Pack {
+  File file;
+  const PackEntry* entries;
+  u64 entriesCount;
+};
+
+Result openPack (const char* relativePath, Pack* out);
+void closePack (Pack* pack);
+
+// Looks up a blob by the file name part of the path, returns nullptr if it isn't in the pack
+[[nodiscard]] const void* findBlob (const Pack* pack, const char* path, size_t* size) noexcept;
+
+// Names are stored as they are given, paths are the files that are copied into the pack
+void writePack (const char* relativePath, const char* const* names, const char* const* paths, u32 count);
+
+}
+
+#endif /* ASSET_PACK_HPP */
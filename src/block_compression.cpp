@@ -0,0 +1,438 @@
+#include <string.h>
+
+#include "block_compression.hpp"
+
+namespace rei::bc {
+
+// Principal axis of the texel colors, found with power iteration on the covariance matrix
+static void findPrincipalAxis (const u8 texels[16][4], u32 channels, f32* mean, f32* axis) {
+  for (u32 channel = 0; channel < channels; ++channel) {
+    mean[channel] = 0.f;
+    for (u32 index = 0; index < 16; ++index) mean[channel] += texels[index][channel];
+    mean[channel] /= 16.f;
+  }
+
+  f32 covariance[4][4] {};
+  for (u32 index = 0; index < 16; ++index) {
+    for (u32 row = 0; row < channels; ++row) {
+      for (u32 column = 0; column < channels; ++column) {
+        f32 a = texels[index][row] - mean[row];
+        f32 b = texels[index][column] - mean[column];
+        covariance[row][column] += a * b;
+      }
+    }
+  }
+
+  for (u32 channel = 0; channel < channels; ++channel) axis[channel] = 1.f;
+
+  for (u32 iteration = 0; iteration < 8; ++iteration) {
+    f32 next[4] {}, length = 0.f;
+
+    for (u32 row = 0; row < channels; ++row) {
+      for (u32 column = 0; column < channels; ++column) next[row] += covariance[row][column] * axis[column];
+      length = REI_MAX (length, REI_ABS (next[row]));
+    }
+
+    // All of the texels are the same
+    if (length < 1e-6f) break;
+    for (u32 channel = 0; channel < channels; ++channel) axis[channel] = next[channel] / length;
+  }
+}
+
+// Endpoints are the extreme texels projected onto the principal axis
+static void findEndpoints (const u8 texels[16][4], u32 channels, f32* first, f32* second) {
+  f32 mean[4], axis[4];
+  findPrincipalAxis (texels, channels, mean, axis);
+
+  f32 minimum = 0.f, maximum = 0.f;
+  for (u32 index = 0; index < 16; ++index) {
+    f32 projection = 0.f;
+    for (u32 channel = 0; channel < channels; ++channel)
+      projection += (texels[index][channel] - mean[channel]) * axis[channel];
+
+    minimum = REI_MIN (minimum, projection);
+    maximum = REI_MAX (maximum, projection);
+  }
+
+  for (u32 channel = 0; channel < channels; ++channel) {
+    first[channel] = REI_CLAMP (mean[channel] + axis[channel] * minimum, 0.f, 255.f);
+    second[channel] = REI_CLAMP (mean[channel] + axis[channel] * maximum, 0.f, 255.f);
+  }
+}
+
+static u16 packColor (const f32* color) {
+  u32 r = (u32) (color[0] * 31.f / 255.f + 0.5f);
+  u32 g = (u32) (color[1] * 63.f / 255.f + 0.5f);
+  u32 b = (u32) (color[2] * 31.f / 255.f + 0.5f);
+  return (u16) (r << 11 | g << 5 | b);
+}
+
+static void unpackColor (u16 color, u8* out) {
+  u32 r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+  out[0] = (u8) (r << 3 | r >> 2);
+  out[1] = (u8) (g << 2 | g >> 4);
+  out[2] = (u8) (b << 3 | b >> 2);
+  out[3] = 255;
+}
+
+static void getColorPalette (u16 first, u16 second, u8 palette[4][4]) {
+  unpackColor (first, palette[0]);
+  unpackColor (second, palette[1]);
+
+  for (u32 channel = 0; channel < 4; ++channel) {
+    palette[2][channel] = (u8) ((2 * palette[0][channel] + palette[1][channel] + 1) / 3);
+    palette[3][channel] = (u8) ((palette[0][channel] + 2 * palette[1][channel] + 1) / 3);
+  }
+}
+
+// Always uses the 4 color mode, so the same block can be used by both BC1 and BC3
+static void encodeColorBlock (const u8 texels[16][4], u8* out) {
+  f32 first[4], second[4];
+  findEndpoints (texels, 3, first, second);
+
+  u16 colors[2] = {packColor (second), packColor (first)};
+  if (colors[0] < colors[1]) {
+    u16 temp = colors[0];
+    colors[0] = colors[1];
+    colors[1] = temp;
+  }
+
+  u32 indices = 0;
+
+  if (colors[0] != colors[1]) {
+    u8 palette[4][4];
+    getColorPalette (colors[0], colors[1], palette);
+
+    for (u32 index = 0; index < 16; ++index) {
+      u32 bestIndex = 0, bestError = ~0u;
+
+      for (u32 entry = 0; entry < 4; ++entry) {
+        u32 error = 0;
+        for (u32 channel = 0; channel < 3; ++channel) {
+          i32 difference = (i32) texels[index][channel] - (i32) palette[entry][channel];
+          error += (u32) (difference * difference);
+        }
+
+        if (error < bestError) {
+          bestError = error;
+          bestIndex = entry;
+        }
+      }
+
+      indices |= bestIndex << (2 * index);
+    }
+  }
+
+  memcpy (out, colors, sizeof (colors));
+  memcpy (out + 4, &indices, sizeof (u32));
+}
+
+static void decodeColorBlock (const u8* block, u8 texels[16][4]) {
+  u16 colors[2];
+  u32 indices;
+  memcpy (colors, block, sizeof (colors));
+  memcpy (&indices, block + 4, sizeof (u32));
+
+  u8 palette[4][4];
+  getColorPalette (colors[0], colors[1], palette);
+
+  if (colors[0] <= colors[1]) {
+    // 3 color mode, only possible in blocks that weren't produced by this encoder
+    for (u32 channel = 0; channel < 3; ++channel) {
+      palette[2][channel] = (u8) ((palette[0][channel] + palette[1][channel]) / 2);
+      palette[3][channel] = 0;
+    }
+  }
+
+  for (u32 index = 0; index < 16; ++index)
+    memcpy (texels[index], palette[(indices >> (2 * index)) & 3], 4);
+}
+
+static void getAlphaPalette (u8 first, u8 second, u8 palette[8]) {
+  palette[0] = first;
+  palette[1] = second;
+
+  if (first > second) {
+    for (u32 index = 1; index < 7; ++index)
+      palette[index + 1] = (u8) (((7 - index) * first + index * second + 3) / 7);
+  } else {
+    for (u32 index = 1; index < 5; ++index)
+      palette[index + 1] = (u8) (((5 - index) * first + index * second + 2) / 5);
+
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+static void encodeAlphaBlock (const u8 texels[16][4], u8* out) {
+  u8 minimum = 255, maximum = 0;
+  for (u32 index = 0; index < 16; ++index) {
+    minimum = REI_MIN (minimum, texels[index][3]);
+    maximum = REI_MAX (maximum, texels[index][3]);
+  }
+
+  u64 indices = 0;
+
+  if (minimum != maximum) {
+    u8 palette[8];
+    getAlphaPalette (maximum, minimum, palette);
+
+    for (u32 index = 0; index < 16; ++index) {
+      u32 bestIndex = 0, bestError = ~0u;
+
+      for (u32 entry = 0; entry < 8; ++entry) {
+        u32 error = (u32) REI_ABS ((i32) texels[index][3] - (i32) palette[entry]);
+        if (error < bestError) {
+          bestError = error;
+          bestIndex = entry;
+        }
+      }
+
+      indices |= (u64) bestIndex << (3 * index);
+    }
+  }
+
+  out[0] = maximum;
+  out[1] = minimum;
+  memcpy (out + 2, &indices, 6);
+}
+
+static void decodeAlphaBlock (const u8* block, u8 texels[16][4]) {
+  u8 palette[8];
+  getAlphaPalette (block[0], block[1], palette);
+
+  u64 indices = 0;
+  memcpy (&indices, block + 2, 6);
+
+  for (u32 index = 0; index < 16; ++index)
+    texels[index][3] = palette[(indices >> (3 * index)) & 7];
+}
+
+static const u32 bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// 128-bit little endian bit stream used by BC7 blocks
+struct BitStream {
+  u64 words[2];
+  u32 position;
+  u32 padding;
+};
+
+static void writeBits (BitStream* stream, u32 value, u32 count) {
+  for (u32 bit = 0; bit < count; ++bit, ++stream->position)
+    stream->words[stream->position >> 6] |= (u64) ((value >> bit) & 1) << (stream->position & 63);
+}
+
+static u32 readBits (BitStream* stream, u32 count) {
+  u32 value = 0;
+  for (u32 bit = 0; bit < count; ++bit, ++stream->position)
+    value |= (u32) ((stream->words[stream->position >> 6] >> (stream->position & 63)) & 1) << bit;
+
+  return value;
+}
+
+static void getBC7Palette (const u8 endpoints[2][4], u8 palette[16][4]) {
+  for (u32 entry = 0; entry < 16; ++entry) {
+    for (u32 channel = 0; channel < 4; ++channel) {
+      u32 value = (64 - bc7Weights[entry]) * endpoints[0][channel] + bc7Weights[entry] * endpoints[1][channel];
+      palette[entry][channel] = (u8) ((value + 32) >> 6);
+    }
+  }
+}
+
+// Mode 6: 7-bit RGBA endpoints with a unique p-bit each, and 4-bit indices
+static void encodeBC7Block (const u8 texels[16][4], u8* out) {
+  f32 endpoints[2][4];
+  findEndpoints (texels, 4, endpoints[0], endpoints[1]);
+
+  u8 quantized[2][4], pBits[2], expanded[2][4];
+
+  for (u32 endpoint = 0; endpoint < 2; ++endpoint) {
+    f32 bestError = 1e30f;
+
+    // Pick the p-bit that reconstructs the endpoint most accurately
+    for (u32 pBit = 0; pBit < 2; ++pBit) {
+      f32 error = 0.f;
+      u8 candidate[4];
+
+      for (u32 channel = 0; channel < 4; ++channel) {
+        f32 value = (endpoints[endpoint][channel] - (f32) pBit) / 2.f + 0.5f;
+        candidate[channel] = (u8) REI_CLAMP (value, 0.f, 127.f);
+
+        f32 difference = (f32) (candidate[channel] << 1 | pBit) - endpoints[endpoint][channel];
+        error += difference * difference;
+      }
+
+      if (error < bestError) {
+        bestError = error;
+        pBits[endpoint] = (u8) pBit;
+        memcpy (quantized[endpoint], candidate, 4);
+      }
+    }
+
+    for (u32 channel = 0; channel < 4; ++channel)
+      expanded[endpoint][channel] = (u8) (quantized[endpoint][channel] << 1 | pBits[endpoint]);
+  }
+
+  u8 palette[16][4];
+  getBC7Palette (expanded, palette);
+
+  u8 indices[16];
+  for (u32 index = 0; index < 16; ++index) {
+    u32 bestIndex = 0, bestError = ~0u;
+
+    for (u32 entry = 0; entry < 16; ++entry) {
+      u32 error = 0;
+      for (u32 channel = 0; channel < 4; ++channel) {
+        i32 difference = (i32) texels[index][channel] - (i32) palette[entry][channel];
+        error += (u32) (difference * difference);
+      }
+
+      if (error < bestError) {
+        bestError = error;
+        bestIndex = entry;
+      }
+    }
+
+    indices[index] = (u8) bestIndex;
+  }
+
+  // Most significant bit of the first index is implicitly zero, swap endpoints to make it so
+  if (indices[0] & 8) {
+    for (u32 channel = 0; channel < 4; ++channel) {
+      u8 temp = quantized[0][channel];
+      quantized[0][channel] = quantized[1][channel];
+      quantized[1][channel] = temp;
+    }
+
+    u8 temp = pBits[0];
+    pBits[0] = pBits[1];
+    pBits[1] = temp;
+
+    for (u32 index = 0; index < 16; ++index) indices[index] = (u8) (15 - indices[index]);
+  }
+
+  BitStream stream {};
+  writeBits (&stream, 1u << 6, 7);
+
+  for (u32 channel = 0; channel < 4; ++channel) {
+    writeBits (&stream, quantized[0][channel], 7);
+    writeBits (&stream, quantized[1][channel], 7);
+  }
+
+  writeBits (&stream, pBits[0], 1);
+  writeBits (&stream, pBits[1], 1);
+
+  writeBits (&stream, indices[0], 3);
+  for (u32 index = 1; index < 16; ++index) writeBits (&stream, indices[index], 4);
+
+  memcpy (out, stream.words, 16);
+}
+
+static void decodeBC7Block (const u8* block, u8 texels[16][4]) {
+  BitStream stream {};
+  memcpy (stream.words, block, 16);
+
+  if (readBits (&stream, 7) != 1u << 6) {
+    // Other modes are never produced by the baker
+    memset (texels, 0, 64);
+    return;
+  }
+
+  u8 endpoints[2][4];
+  for (u32 channel = 0; channel < 4; ++channel) {
+    endpoints[0][channel] = (u8) (readBits (&stream, 7) << 1);
+    endpoints[1][channel] = (u8) (readBits (&stream, 7) << 1);
+  }
+
+  u32 pBits[2];
+  pBits[0] = readBits (&stream, 1);
+  pBits[1] = readBits (&stream, 1);
+
+  for (u32 channel = 0; channel < 4; ++channel) {
+    endpoints[0][channel] = (u8) (endpoints[0][channel] | pBits[0]);
+    endpoints[1][channel] = (u8) (endpoints[1][channel] | pBits[1]);
+  }
+
+  u8 palette[16][4];
+  getBC7Palette (endpoints, palette);
+
+  for (u32 index = 0; index < 16; ++index)
+    memcpy (texels[index], palette[readBits (&stream, index ? 4 : 3)], 4);
+}
+
+u32 getBlockSize (BlockFormat format) noexcept {
+  return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+size_t getCompressedSize (BlockFormat format, u32 width, u32 height) noexcept {
+  return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * getBlockSize (format);
+}
+
+void compressImage (BlockFormat format, const u8* pixels, u32 width, u32 height, u8* out) {
+  const u32 blockSize = getBlockSize (format);
+
+  for (u32 blockY = 0; blockY < height; blockY += 4) {
+    for (u32 blockX = 0; blockX < width; blockX += 4) {
+      u8 texels[16][4];
+
+      for (u32 y = 0; y < 4; ++y) {
+        for (u32 x = 0; x < 4; ++x) {
+          u32 sourceX = REI_MIN (blockX + x, width - 1);
+          u32 sourceY = REI_MIN (blockY + y, height - 1);
+          memcpy (texels[y * 4 + x], pixels + ((size_t) sourceY * width + sourceX) * 4, 4);
+        }
+      }
+
+      switch (format) {
+        case BlockFormat::BC1:
+          encodeColorBlock (texels, out);
+          break;
+
+        case BlockFormat::BC3:
+          encodeAlphaBlock (texels, out);
+          encodeColorBlock (texels, out + 8);
+          break;
+
+        case BlockFormat::BC7:
+          encodeBC7Block (texels, out);
+          break;
+      }
+
+      out += blockSize;
+    }
+  }
+}
+
+void decompressImage (BlockFormat format, const u8* blocks, u32 width, u32 height, u8* out) {
+  const u32 blockSize = getBlockSize (format);
+
+  for (u32 blockY = 0; blockY < height; blockY += 4) {
+    for (u32 blockX = 0; blockX < width; blockX += 4) {
+      u8 texels[16][4];
+
+      switch (format) {
+        case BlockFormat::BC1:
+          decodeColorBlock (blocks, texels);
+          break;
+
+        case BlockFormat::BC3:
+          decodeColorBlock (blocks + 8, texels);
+          decodeAlphaBlock (blocks, texels);
+          break;
+
+        case BlockFormat::BC7:
+          decodeBC7Block (blocks, texels);
+          break;
+      }
+
+      for (u32 y = 0; y < 4 && blockY + y < height; ++y) {
+        for (u32 x = 0; x < 4 && blockX + x < width; ++x)
+          memcpy (out + ((size_t) (blockY + y) * width + blockX + x) * 4, texels[y * 4 + x], 4);
+      }
+
+      blocks += blockSize;
+    }
+  }
+}
+
+}
@@ -0,0 +1,28 @@
+#ifndef BLOCK_COMPRESSION_HPP
+#define BLOCK_COMPRESSION_HPP
+
+#include "common.hpp"
+
+// Encoders and decoders for BCn formats, every block stores 4x4 texels.
+// Reference: https://docs.microsoft.com/en-us/windows/win32/direct3d11/texture-block-compression-in-direct3d-11
+namespace rei::bc {
+
+enum class BlockFormat : u32 {
+  // Opaque RGB, 8 bytes per block
+  BC1,
+  // BC1 colors with an interpolated alpha block, 16 bytes per block
+  BC3,
+  // Only mode 6 (RGBA with 4-bit indices) is produced and decoded, 16 bytes per block
+  BC7
+};
+
+[[nodiscard]] u32 getBlockSize (BlockFormat format) noexcept;
+[[nodiscard]] size_t getCompressedSize (BlockFormat format, u32 width, u32 height) noexcept;
+
+// Pixels are tightly packed RGBA8, partial blocks on the edges are padded by clamping
+void compressImage (BlockFormat format, const u8* pixels, u32 width, u32 height, u8* out);
+void decompressImage (BlockFormat format, const u8* blocks, u32 width, u32 height, u8* out);
+
+}
+
+#endif /* BLOCK_COMPRESSION_HPP */
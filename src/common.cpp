@@ -1,5 +1,10 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include "common.hpp"
@@ -37,10 +42,84 @@ const char* getError (Result result) noexcept {
   switch (result) {
     case Result::FileIsEmpty: return "File is empty";
     case Result::FileDoesNotExist: return "File does not exist";
+    case Result::InvalidAssetFormat: return "Asset has invalid format or was baked by an older version";
+    case Result::FileIsNotWritable: return "File can't be written";
     default: return "Hmmmm";
   }
 }
 
+u64 hash64 (const void* data, size_t size, u64 seed) noexcept {
+  const u64 prime1 = 0x9E3779B185EBCA87ull;
+  const u64 prime2 = 0xC2B2AE3D27D4EB4Full;
+  const u64 prime3 = 0x165667B19E3779F9ull;
+  const u64 prime4 = 0x85EBCA77C2B2AE63ull;
+  const u64 prime5 = 0x27D4EB2F165667C5ull;
+
+  #define ROTATE_LEFT(value, count) (((value) << (count)) | ((value) >> (64 - (count))))
+  #define ROUND(accumulator, input) ROTATE_LEFT ((accumulator) + (input) * prime2, 31) * prime1
+  #define MERGE_ROUND(accumulator, value) (((accumulator) ^ ROUND (0, value)) * prime1 + prime4)
+
+  auto current = (const u8*) data;
+  const u8* end = current + size;
+  u64 result;
+
+  if (size >= 32) {
+    // Process input in four independent lanes so that multiplications can overlap
+    u64 lanes[4] {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+
+    do {
+      u64 words[4];
+      memcpy (words, current, sizeof (words));
+      lanes[0] = ROUND (lanes[0], words[0]);
+      lanes[1] = ROUND (lanes[1], words[1]);
+      lanes[2] = ROUND (lanes[2], words[2]);
+      lanes[3] = ROUND (lanes[3], words[3]);
+      current += 32;
+    } while (current <= end - 32);
+
+    result = ROTATE_LEFT (lanes[0], 1) + ROTATE_LEFT (lanes[1], 7) + ROTATE_LEFT (lanes[2], 12) + ROTATE_LEFT (lanes[3], 18);
+    result = MERGE_ROUND (result, lanes[0]);
+    result = MERGE_ROUND (result, lanes[1]);
+    result = MERGE_ROUND (result, lanes[2]);
+    result = MERGE_ROUND (result, lanes[3]);
+  } else {
+    result = seed + prime5;
+  }
+
+  result += (u64) size;
+
+  for (; current + 8 <= end; current += 8) {
+    u64 word;
+    memcpy (&word, current, sizeof (word));
+    result ^= ROUND (0, word);
+    result = ROTATE_LEFT (result, 27) * prime1 + prime4;
+  }
+
+  if (current + 4 <= end) {
+    u32 word;
+    memcpy (&word, current, sizeof (word));
+    result ^= (u64) word * prime1;
+    result = ROTATE_LEFT (result, 23) * prime2 + prime3;
+    current += 4;
+  }
+
+  for (; current < end; ++current) {
+    result ^= (u64) *current * prime5;
+    result = ROTATE_LEFT (result, 11) * prime1;
+  }
+
+  #undef MERGE_ROUND
+  #undef ROUND
+  #undef ROTATE_LEFT
+
+  result ^= result >> 33;
+  result *= prime2;
+  result ^= result >> 29;
+  result *= prime3;
+  result ^= result >> 32;
+  return result;
+}
+
 void writeFile (const char* relativePath, b8 binary, void* data, size_t size) {
   FILE* out = fopen (relativePath, binary ? "wb" : "w");
   fwrite (data, 1, size, out);
@@ -63,4 +142,81 @@ Result readFile (const char* relativePath, b8 binary, File* output) {
   return Result::Success;
 }
 
+Result mapFile (const char* relativePath, File* output) {
+  int file = open (relativePath, O_RDONLY);
+  if (file == -1) return Result::FileDoesNotExist;
+
+  struct stat info;
+  if (fstat (file, &info) == -1) {
+    close (file);
+    return Result::FileDoesNotExist;
+  }
+
+  output->size = (size_t) info.st_size;
+
+  if (!output->size) {
+    close (file);
+    return Result::FileIsEmpty;
+  }
+
+  output->contents = mmap (nullptr, output->size, PROT_READ, MAP_PRIVATE, file, 0);
+  // Mapping keeps its own reference to the file
+  close (file);
+
+  if (output->contents == MAP_FAILED) return Result::FileDoesNotExist;
+
+  madvise (output->contents, output->size, MADV_SEQUENTIAL);
+  return Result::Success;
+}
+
+void unmapFile (File* file) {
+  munmap (file->contents, file->size);
+}
+
+// Size of the link to the previous block, keeps the memory after it 16 byte aligned
+#define ARENA_HEADER_SIZE 16u
+
+static void pushArenaBlock (Arena* arena, size_t capacity) {
+  u8* block = REI_MALLOC (u8, ARENA_HEADER_SIZE + capacity);
+  *(u8**) block = arena->block;
+
+  arena->block = block;
+  arena->offset = ARENA_HEADER_SIZE;
+  arena->capacity = ARENA_HEADER_SIZE + capacity;
+}
+
+void createArena (size_t blockSize, Arena* output) {
+  output->block = nullptr;
+  output->blockSize = blockSize;
+  pushArenaBlock (output, blockSize);
+}
+
+void destroyArena (Arena* arena) {
+  while (arena->block) {
+    u8* previous = *(u8**) arena->block;
+    free (arena->block);
+    arena->block = previous;
+  }
+}
+
+static size_t alignArenaOffset (const Arena* arena, size_t alignment) {
+  size_t address = (size_t) (arena->block + arena->offset);
+  return arena->offset + ((alignment - address % alignment) % alignment);
+}
+
+void* allocate (Arena* arena, size_t size, size_t alignment) {
+  size_t offset = alignArenaOffset (arena, alignment);
+
+  if (offset + size > arena->capacity) {
+    // Oversized allocations get a block of their own
+    pushArenaBlock (arena, REI_MAX (arena->blockSize, size + alignment));
+    offset = alignArenaOffset (arena, alignment);
+  }
+
+  arena->offset = offset + size;
+  return arena->block + offset;
+}
+
+#undef ARENA_HEADER_SIZE
+
 }
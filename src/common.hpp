@@ -88,6 +88,10 @@
 #  define REI_MAX(a, b) (((a) > (b)) ? (a) : (b))
 #endif
 
+#ifndef REI_ABS
+#  define REI_ABS(value) (((value) < 0) ? -(value) : (value))
+#endif
+
 #ifndef REI_CLAMP
 #  define REI_CLAMP(value, min, max) (REI_MAX (min, REI_MIN (value, max)))
 #endif
@@ -97,17 +101,27 @@
 #endif
 
 #ifndef REI_ALLOCA
-#  define REI_ALLOCA(Type, count) (Type*) alloca (sizeof (Type) * count)
+#  define REI_ALLOCA(Type, count) (Type*) alloca (sizeof (Type) * (count))
 #endif
 
 #ifndef REI_MALLOC
-#  define REI_MALLOC(Type, count) (Type*) malloc (sizeof (Type) * count)
+#  define REI_MALLOC(Type, count) (Type*) malloc (sizeof (Type) * (count))
+#endif
+
+#ifndef REI_ARENA_ALLOC
+#  define REI_ARENA_ALLOC(arena, Type, count) \
+     (Type*) rei::allocate (arena, sizeof (Type) * (count), alignof (Type))
 #endif
 
 #ifndef REI_OFFSET_OF
 #  define REI_OFFSET_OF(structure, member) ((size_t) &(((structure*) nullptr)->member))
 #endif
 
+// Upload vertices in the 16 byte PackedVertex layout instead of the 32 byte Vertex one
+#ifndef REI_PACKED_VERTICES
+#  define REI_PACKED_VERTICES 1
+#endif
+
 #ifdef NDEBUG
 #  ifndef REI_ASSERT
 #    define REI_ASSERT(condition)
@@ -178,7 +192,9 @@ enum LogLevel : u8 {
 enum class Result : u8 {
   Success,
   FileIsEmpty,
-  FileDoesNotExist
+  FileDoesNotExist,
+  InvalidAssetFormat,
+  FileIsNotWritable
 };
 
 struct Vertex {
@@ -187,11 +203,37 @@ struct Vertex {
   f32 u, v;
 };
 
+struct PackedVertex {
+  // snorm16 position relative to the bounds of the mesh, w is unused
+  i16 x, y, z, w;
+  // snorm16 octahedral encoded normal
+  i16 nx, ny;
+  // Half float texture coordinates
+  u16 u, v;
+};
+
+// Layout of the vertices in vertex buffers
+#if REI_PACKED_VERTICES
+typedef PackedVertex GpuVertex;
+#else
+typedef Vertex GpuVertex;
+#endif
+
 struct File {
   size_t size;
   void* contents;
 };
 
+// Linear allocator that releases everything at once. Allocations that don't fit
+// into the current block chain a new one, so the block size is only a hint.
+struct Arena {
+  // Current block, starts with a pointer to the previous one
+  u8* block;
+  size_t offset;
+  size_t capacity;
+  size_t blockSize;
+};
+
 struct Timer {
   static timeval start;
 
@@ -202,9 +244,20 @@ struct Timer {
 void logger (LogLevel level, const char* format, ...);
 
 [[nodiscard]] const char* getError (Result result) noexcept;
+// 64-bit XXH64 hash (github.com/Cyan4973/xxHash)
+[[nodiscard]] u64 hash64 (const void* data, size_t size, u64 seed = 0) noexcept;
 Result readFile (const char* relativePath, b8 binary, File* output);
+// Maps the whole file as read only memory, hinting the kernel that it will be read sequentially.
+// Contents have to be released with unmapFile instead of free.
+Result mapFile (const char* relativePath, File* output);
+void unmapFile (File* file);
 void writeFile (const char* relativePath, b8 binary, void* data, size_t size);
 
+void createArena (size_t blockSize, Arena* output);
+void destroyArena (Arena* arena);
+// Alignment has to be a power of two, memory isn't cleared
+[[nodiscard]] void* allocate (Arena* arena, size_t size, size_t alignment);
+
 };
 
 #endif /* COMMON_HPP */
@@ -1,8 +1,17 @@
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <immintrin.h>
 
 #include "gltf.hpp"
 #include "common.hpp"
+#include "rei_math.inl"
+#include "asset_pack.hpp"
+
+// Skip whitespace 16 bytes at a time, it makes up a good part of pretty printed manifests
+#if defined (__SSE4_2__) && !defined (RAPIDJSON_SSE42)
+#  define RAPIDJSON_SSE42
+#endif
 
 #include <rapidjson/document.h>
 
@@ -34,6 +43,18 @@ u8 countComponents (AccessorType accessorType) noexcept {
   }
 }
 
+u8 getComponentSize (AccessorComponentType componentType) noexcept {
+  switch (componentType) {
+    case AccessorComponentType::Int8: return 1;
+    case AccessorComponentType::Int16: return 2;
+    case AccessorComponentType::Float: return 4;
+    case AccessorComponentType::Uint8: return 1;
+    case AccessorComponentType::Uint16: return 2;
+    case AccessorComponentType::Uint32: return 4;
+    default: return 0;
+  }
+}
+
 AccessorType parseAccessorType (const char* rawType) noexcept {
   if (!strcmp (rawType, "VEC2")) return AccessorType::Vec2;
   if (!strcmp (rawType, "VEC3")) return AccessorType::Vec3;
@@ -70,72 +91,609 @@ AccessorComponentType parseAccessorComponentType (u64 type) noexcept {
   }
 }
 
-void load (const char* relativePath, Data* output) {
-  REI_LOG_INFO ("Loading a gltf model from " ANSI_YELLOW "%s", relativePath);
+meshopt::Mode parseMeshoptMode (const char* rawMode) noexcept {
+  if (!strcmp (rawMode, "ATTRIBUTES")) return meshopt::Mode::Attributes;
+  if (!strcmp (rawMode, "TRIANGLES")) return meshopt::Mode::Triangles;
+  if (!strcmp (rawMode, "INDICES")) return meshopt::Mode::Indices;
+  return meshopt::Mode::Unknown;
+}
 
-  { // Load buffer data from .bin file
-    char binaryPath[256] {};
-    strcpy (binaryPath, relativePath);
-    char* extension = strrchr (binaryPath, '.');
-    memcpy (extension + 1, "bin", 4);
+meshopt::Filter parseMeshoptFilter (const char* rawFilter) noexcept {
+  if (!strcmp (rawFilter, "NONE")) return meshopt::Filter::None;
+  if (!strcmp (rawFilter, "OCTAHEDRAL")) return meshopt::Filter::Octahedral;
+  if (!strcmp (rawFilter, "QUATERNION")) return meshopt::Filter::Quaternion;
+  if (!strcmp (rawFilter, "EXPONENTIAL")) return meshopt::Filter::Exponential;
+  return meshopt::Filter::Unknown;
+}
+
+// Maps the file unless it's stored in the pack
+static void openFile (const char* relativePath, const Pack* pack, File* out, b8* mapped) {
+  *mapped = REI_FALSE;
+  if (pack && (out->contents = (void*) findBlob (pack, relativePath, &out->size))) return;
+
+  REI_CHECK (mapFile (relativePath, out));
+  *mapped = REI_TRUE;
+}
+
+// Estimate of the DOM size relative to the JSON size, anything past it goes to extra chunks
+#ifndef GLTF_DOM_SIZE_RATIO
+#  define GLTF_DOM_SIZE_RATIO 2u
+#endif
+
+// Makes room for count elements in the arena of the output
+#define GLTF_ALLOC(Type, count) REI_ARENA_ALLOC (&output->arena, Type, count)
+
+// Memory taken by the array of count elements, including the worst case alignment
+#define GLTF_ARRAY_SIZE(Type, count) (sizeof (Type) * (count) + alignof (Type))
+
+// Creates the arena of the output once all of the counts are known
+static void createData (Data* output) {
+  createArena (
+    GLTF_ARRAY_SIZE (BufferView, output->bufferViewsCount) +
+    GLTF_ARRAY_SIZE (MeshoptCompression, output->compressionsCount) +
+    GLTF_ARRAY_SIZE (Accessor, output->accessorsCount) +
+    GLTF_ARRAY_SIZE (Primitive, output->primitivesCount) +
+    GLTF_ARRAY_SIZE (Mesh, output->meshesCount) +
+    GLTF_ARRAY_SIZE (Node, output->nodesCount) +
+    GLTF_ARRAY_SIZE (Image, output->imagesCount) +
+    GLTF_ARRAY_SIZE (Texture, output->texturesCount) +
+    GLTF_ARRAY_SIZE (Material, output->materialsCount),
+    &output->arena
+  );
+}
+
+static void composeNode (const f32* translation, const f32* rotation, const f32* scale, Node* out) {
+  alignas (16) math::Mat4 matrix {1.f};
+  math::Vec3 translationVector {translation[0], translation[1], translation[2]};
+  math::Vec4 quaternion {rotation[0], rotation[1], rotation[2], rotation[3]};
+  math::Vec3 scaleVector {scale[0], scale[1], scale[2]};
+
+  math::mat4::translate (&matrix, &translationVector);
+  math::mat4::rotate (&matrix, &quaternion);
+  math::mat4::scale (&matrix, &scaleVector);
+  out->matrix = matrix;
+}
 
-    File binaryFile;
-    REI_CHECK (readFile (binaryPath, REI_TRUE, &binaryFile));
+// Reorders the nodes breadth first from the roots, so that parents come before their children.
+// Parents have to be set with the original indices, nodes in cycles are dropped.
+static void sortNodes (Data* output) {
+  const u32 count = (u32) output->nodesCount;
+  auto nodes = REI_MALLOC (Node, count);
+  memcpy (nodes, output->nodes, sizeof (Node) * count);
 
-    output->buffer = REI_MALLOC (u8, binaryFile.size);
-    memcpy (output->buffer, (u8*) binaryFile.contents, binaryFile.size);
+  // Children of every node, grouped with a counting sort over the parents
+  auto childOffsets = REI_MALLOC (u32, count + 1);
+  auto children = REI_MALLOC (u32, count);
+  auto remap = REI_MALLOC (u32, count);
 
-    free (binaryFile.contents);
+  memset (childOffsets, 0, sizeof (u32) * (count + 1));
+  for (u32 node = 0; node < count; ++node) {
+    if (nodes[node].parent < count) ++childOffsets[nodes[node].parent + 1];
   }
 
-  File gltf;
-  REI_CHECK (readFile (relativePath, REI_FALSE, &gltf));
+  for (u32 node = 0; node < count; ++node) childOffsets[node + 1] += childOffsets[node];
 
-  rapidjson::Document parsedGLTF;
-  parsedGLTF.Parse ((const char*) gltf.contents);
-  free (gltf.contents);
+  for (u32 node = 0; node < count; ++node) {
+    if (nodes[node].parent < count) children[childOffsets[nodes[node].parent]++] = node;
+  }
+
+  for (u32 node = count; node > 0; --node) childOffsets[node] = childOffsets[node - 1];
+  childOffsets[0] = 0;
+
+  // Output doubles as the queue, roots go first in their original order
+  u32 sortedCount = 0;
+  for (u32 node = 0; node < count; ++node) {
+    if (nodes[node].parent >= count) remap[sortedCount++] = node;
+  }
+
+  for (u32 cursor = 0; cursor < sortedCount; ++cursor) {
+    const u32 node = remap[cursor];
+    for (u32 offset = childOffsets[node]; offset < childOffsets[node + 1]; ++offset)
+      remap[sortedCount++] = children[offset];
+  }
+
+  // Remap is the order of original indices, turn it into a lookup of new indices for the parents
+  for (u32 node = 0; node < count; ++node) children[node] = UINT32_MAX;
+  for (u32 node = 0; node < sortedCount; ++node) children[remap[node]] = node;
+
+  for (u32 node = 0; node < sortedCount; ++node) {
+    auto current = &output->nodes[node];
+    *current = nodes[remap[node]];
+    if (current->parent < count) current->parent = children[current->parent];
+  }
+
+  if (sortedCount < count)
+    REI_LOG_WARN ("Dropped " ANSI_RED "%u" ANSI_YELLOW " nodes that aren't reachable from a root", count - sortedCount);
+
+  output->nodesCount = sortedCount;
+
+  free (remap);
+  free (children);
+  free (childOffsets);
+  free (nodes);
+}
+
+void computeWorldMatrices (const Node* nodes, size_t nodesCount, math::Mat4* out) {
+  for (size_t node = 0; node < nodesCount; ++node) {
+    const auto current = &nodes[node];
+
+    if (current->parent == UINT32_MAX) {
+      out[node] = current->matrix;
+    } else {
+      math::mat4::mul (&out[current->parent], &current->matrix, &out[node]);
+    }
+  }
+}
+
+// How the components of an accessor are stored
+struct ComponentFormat {
+  AccessorComponentType type;
+  u32 size;
+  u32 count;
+  // Integer components are multiplied by scale and clamped to minimum, so that -128 and -127 both map to -1
+  f32 scale;
+  f32 minimum;
+};
+
+static void getComponentFormat (const Accessor* accessor, ComponentFormat* out) {
+  out->type = accessor->componentType;
+  out->size = getComponentSize (accessor->componentType);
+  out->count = countComponents (accessor->type);
+  out->scale = 1.f;
+  out->minimum = accessor->normalized ? -1.f : -INFINITY;
+
+  if (!accessor->normalized) return;
+
+  switch (accessor->componentType) {
+    case AccessorComponentType::Int8: out->scale = 1.f / 127.f; break;
+    case AccessorComponentType::Int16: out->scale = 1.f / 32767.f; break;
+    case AccessorComponentType::Uint8: out->scale = 1.f / 255.f; break;
+    case AccessorComponentType::Uint16: out->scale = 1.f / 65535.f; break;
+    default: break;
+  }
+}
+
+// Components aren't necessarily aligned to their size in interleaved buffers
+static f32 decodeComponent (const u8* source, const ComponentFormat* format) {
+  switch (format->type) {
+    case AccessorComponentType::Float: {
+      f32 value;
+      memcpy (&value, source, sizeof (value));
+      return value;
+    }
+
+    case AccessorComponentType::Int8: return REI_MAX ((f32) (i8) *source * format->scale, format->minimum);
+    case AccessorComponentType::Uint8: return (f32) *source * format->scale;
+
+    case AccessorComponentType::Int16: {
+      i16 value;
+      memcpy (&value, source, sizeof (value));
+      return REI_MAX ((f32) value * format->scale, format->minimum);
+    }
+
+    case AccessorComponentType::Uint16: {
+      u16 value;
+      memcpy (&value, source, sizeof (value));
+      return (f32) value * format->scale;
+    }
+
+    case AccessorComponentType::Uint32: {
+      u32 value;
+      memcpy (&value, source, sizeof (value));
+      return (f32) value;
+    }
+
+    default: return 0.f;
+  }
+}
+
+static u32 decodeIndex (const u8* source, AccessorComponentType type) {
+  switch (type) {
+    case AccessorComponentType::Uint8: return *source;
+
+    case AccessorComponentType::Uint16: {
+      u16 value;
+      memcpy (&value, source, sizeof (value));
+      return value;
+    }
+
+    case AccessorComponentType::Uint32: {
+      u32 value;
+      memcpy (&value, source, sizeof (value));
+      return value;
+    }
+
+    default: return 0;
+  }
+}
+
+// Decodes the first components of an element, the ones that the element doesn't have are zeros
+static void decodeElement (const u8* source, const ComponentFormat* format, u32 components, f32* out) {
+  const u32 count = REI_MIN (components, format->count);
+  for (u32 component = 0; component < count; ++component)
+    out[component] = decodeComponent (source + format->size * component, format);
+
+  for (u32 component = count; component < components; ++component) out[component] = 0.f;
+}
+
+// Converts a contiguous run of components, 8 of them at a time with AVX2
+static void convertComponents (const u8* source, size_t count, const ComponentFormat* format, f32* out) {
+  size_t index = 0;
+
+#ifdef __AVX2__
+  const __m256 scale = _mm256_set1_ps (format->scale);
+  const __m256 minimum = _mm256_set1_ps (format->minimum);
+
+  #define CONVERT_COMPONENTS(load, extend) do {                                               \
+    for (; index + 8 <= count; index += 8) {                                                  \
+      __m256 values = _mm256_cvtepi32_ps (extend (load (&source[index * format->size])));     \
+      _mm256_storeu_ps (&out[index], _mm256_max_ps (_mm256_mul_ps (values, scale), minimum)); \
+    }                                                                                         \
+  } while (0)
+
+  #define LOAD_8(address) _mm_loadl_epi64 ((const __m128i*) (address))
+  #define LOAD_16(address) _mm_loadu_si128 ((const __m128i*) (address))
+
+  switch (format->type) {
+    case AccessorComponentType::Int8: CONVERT_COMPONENTS (LOAD_8, _mm256_cvtepi8_epi32); break;
+    case AccessorComponentType::Uint8: CONVERT_COMPONENTS (LOAD_8, _mm256_cvtepu8_epi32); break;
+    case AccessorComponentType::Int16: CONVERT_COMPONENTS (LOAD_16, _mm256_cvtepi16_epi32); break;
+    case AccessorComponentType::Uint16: CONVERT_COMPONENTS (LOAD_16, _mm256_cvtepu16_epi32); break;
+    default: break;
+  }
+
+  #undef LOAD_16
+  #undef LOAD_8
+  #undef CONVERT_COMPONENTS
+#endif
+
+  for (; index < count; ++index) out[index] = decodeComponent (&source[index * format->size], format);
+}
+
+// Widens a contiguous run of indices and adds base to them, 8 of them at a time with AVX2
+static void widenIndices (const u8* source, size_t count, AccessorComponentType type, u32 base, u32* out) {
+  const u32 size = getComponentSize (type);
+  size_t index = 0;
+
+#ifdef __AVX2__
+  const __m256i bases = _mm256_set1_epi32 ((i32) base);
+
+  #define WIDEN_INDICES(load) do {                                             \
+    for (; index + 8 <= count; index += 8) {                                   \
+      __m256i values = _mm256_add_epi32 (load (&source[index * size]), bases); \
+      _mm256_storeu_si256 ((__m256i*) &out[index], values);                    \
+    }                                                                          \
+  } while (0)
+
+  #define LOAD_8(address) _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i*) (address)))
+  #define LOAD_16(address) _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i*) (address)))
+  #define LOAD_32(address) _mm256_loadu_si256 ((const __m256i*) (address))
+
+  switch (type) {
+    case AccessorComponentType::Uint8: WIDEN_INDICES (LOAD_8); break;
+    case AccessorComponentType::Uint16: WIDEN_INDICES (LOAD_16); break;
+    case AccessorComponentType::Uint32: WIDEN_INDICES (LOAD_32); break;
+    default: break;
+  }
+
+  #undef LOAD_32
+  #undef LOAD_16
+  #undef LOAD_8
+  #undef WIDEN_INDICES
+#endif
+
+  for (; index < count; ++index) out[index] = decodeIndex (&source[index * size], type) + base;
+}
+
+// First of count elements of a buffer view, null if any of them is outside of the view or the buffer
+static const u8* getElements (const Data* data, u32 bufferView, u32 byteOffset, u32 stride, u32 elementSize, u32 count) {
+  if (bufferView >= data->bufferViewsCount || !elementSize) return nullptr;
+
+  const auto view = &data->bufferViews[bufferView];
+  const size_t end = count ? (size_t) byteOffset + (size_t) stride * (count - 1) + elementSize : 0;
+
+  const b8 isDecoded = view->buffer == UINT32_MAX;
+  const u8* buffer = isDecoded ? data->decoded : data->buffer;
+  const size_t bufferSize = isDecoded ? data->decodedSize : data->bufferSize;
+
+  if (end > view->byteLength || (size_t) view->byteOffset + view->byteLength > bufferSize) return nullptr;
+  return buffer + view->byteOffset + byteOffset;
+}
+
+static u32 getStride (const Data* data, u32 bufferView, u32 elementSize) {
+  const u32 stride = bufferView < data->bufferViewsCount ? data->bufferViews[bufferView].byteStride : 0;
+  return stride ? stride : elementSize;
+}
+
+// Indices and values of a sparse accessor, returns false if either of them is outside of the buffer
+static b8 getSparse (const Data* data, const Accessor* accessor, u32 valueSize, const u8** indices, const u8** values) {
+  const auto sparse = &accessor->sparse;
+  const u32 indexSize = getComponentSize (sparse->indicesComponentType);
+
+  *indices = getElements (data, sparse->indicesBufferView, sparse->indicesByteOffset, indexSize, indexSize, sparse->count);
+  *values = getElements (data, sparse->valuesBufferView, sparse->valuesByteOffset, valueSize, valueSize, sparse->count);
+
+  return *indices && *values;
+}
+
+void readFloats (const Data* data, const Accessor* accessor, u32 components, f32* out) {
+  ComponentFormat format;
+  getComponentFormat (accessor, &format);
+
+  const u32 elementSize = format.size * format.count;
+  const u32 stride = getStride (data, accessor->bufferView, elementSize);
+  const size_t total = (size_t) accessor->count * components;
+  const u8* elements = getElements (data, accessor->bufferView, accessor->byteOffset, stride, elementSize, accessor->count);
+
+  if (!elements) {
+    if (accessor->bufferView != UINT32_MAX)
+      REI_LOG_WARN ("Accessor " ANSI_RED "%zu" ANSI_YELLOW " is outside of the buffer", (size_t) (accessor - data->accessors));
+
+    memset (out, 0, sizeof (f32) * total);
+  } else if (stride == elementSize && format.count == components) {
+    // Elements are tightly packed and have the components that were asked for, so they convert as a single run
+    if (format.type == AccessorComponentType::Float) {
+      memcpy (out, elements, sizeof (f32) * total);
+    } else {
+      convertComponents (elements, total, &format, out);
+    }
+  } else {
+    for (u32 element = 0; element < accessor->count; ++element)
+      decodeElement (elements + (size_t) stride * element, &format, components, &out[(size_t) element * components]);
+  }
+
+  const u8 *indices, *values;
+  if (!accessor->sparse.count || !getSparse (data, accessor, elementSize, &indices, &values)) return;
+
+  const u32 indexSize = getComponentSize (accessor->sparse.indicesComponentType);
+
+  for (u32 index = 0; index < accessor->sparse.count; ++index) {
+    const u32 element = decodeIndex (indices + indexSize * index, accessor->sparse.indicesComponentType);
+    if (element < accessor->count) decodeElement (values + elementSize * index, &format, components, &out[(size_t) element * components]);
+  }
+}
+
+void readIndices (const Data* data, const Accessor* accessor, u32 base, u32* out) {
+  const AccessorComponentType type = accessor->componentType;
+  const u32 size = type == AccessorComponentType::Float ? 0 : getComponentSize (type);
+  const u32 stride = getStride (data, accessor->bufferView, size);
+  const u8* elements = getElements (data, accessor->bufferView, accessor->byteOffset, stride, size, accessor->count);
+
+  if (!elements) {
+    // Every triangle becomes degenerate
+    REI_LOG_WARN ("Indices " ANSI_RED "%zu" ANSI_YELLOW " are invalid", (size_t) (accessor - data->accessors));
+    for (u32 index = 0; index < accessor->count; ++index) out[index] = base;
+    return;
+  }
+
+  if (stride == size) {
+    widenIndices (elements, accessor->count, type, base, out);
+  } else {
+    for (u32 index = 0; index < accessor->count; ++index)
+      out[index] = decodeIndex (elements + (size_t) stride * index, type) + base;
+  }
+
+  const u8 *indices, *values;
+  if (!accessor->sparse.count || !getSparse (data, accessor, size, &indices, &values)) return;
+
+  const u32 indexSize = getComponentSize (accessor->sparse.indicesComponentType);
+
+  for (u32 index = 0; index < accessor->sparse.count; ++index) {
+    const u32 element = decodeIndex (indices + indexSize * index, accessor->sparse.indicesComponentType);
+    if (element < accessor->count) out[element] = decodeIndex (values + size * index, type) + base;
+  }
+}
+
+// Points compressed buffer views to their decoded data, views that fail to decode become empty
+static void decodeBufferViews (Data* output) {
+  output->decoded = nullptr;
+  output->decodedSize = 0;
+
+  // Every view starts at a 16 byte boundary
+  for (u32 index = 0; index < output->compressionsCount; ++index) {
+    const auto compression = &output->compressions[index];
+    output->decodedSize += ((size_t) compression->count * compression->byteStride + 15) & ~(size_t) 15;
+  }
+
+  if (!output->decodedSize) return;
+  output->decoded = (u8*) allocate (&output->arena, output->decodedSize, 16);
+
+  size_t offset = 0;
+
+  for (u32 index = 0; index < output->compressionsCount; ++index) {
+    const auto compression = &output->compressions[index];
+    const size_t size = (size_t) compression->count * compression->byteStride;
+
+    b8 valid = compression->bufferView < output->bufferViewsCount && !compression->buffer;
+    valid = valid && (size_t) compression->byteOffset + compression->byteLength <= output->bufferSize;
+    valid = valid && meshopt::decode (
+      compression->mode,
+      compression->filter,
+      output->buffer + compression->byteOffset,
+      compression->byteLength,
+      compression->count,
+      compression->byteStride,
+      output->decoded + offset
+    );
+
+    if (compression->bufferView < output->bufferViewsCount) {
+      auto view = &output->bufferViews[compression->bufferView];
+      view->buffer = UINT32_MAX;
+      view->byteOffset = (u32) offset;
+      view->byteLength = valid ? (u32) size : 0;
+    }
+
+    if (!valid) REI_LOG_ERROR ("Failed to decode compressed buffer view " ANSI_YELLOW "%u", compression->bufferView);
+    offset += (size + 15) & ~(size_t) 15;
+  }
+}
+
+// Fills the output from in situ parsed text
+static void parseDom (char* text, void* domMemory, size_t domSize, Data* output) {
+  rapidjson::MemoryPoolAllocator<> domAllocator {domMemory, domSize};
+  rapidjson::Document parsedGLTF {&domAllocator};
+  parsedGLTF.ParseInsitu (text);
+
+  // Every top level array is optional, missing ones are the same as empty ones
+  const rapidjson::Value empty {rapidjson::kArrayType};
+  #define GET_ARRAY(name) (parsedGLTF.HasMember (name) ? parsedGLTF[name] : empty).GetArray ()
+
+  const auto& bufferViews = GET_ARRAY ("bufferViews");
+  const auto& accessors = GET_ARRAY ("accessors");
+  const auto& meshes = GET_ARRAY ("meshes");
+  const auto& nodes = GET_ARRAY ("nodes");
+  const auto& images = GET_ARRAY ("images");
+  const auto& textures = GET_ARRAY ("textures");
+  const auto& materials = GET_ARRAY ("materials");
+
+  #undef GET_ARRAY
 
-  // Load buffer views
-  const auto& bufferViews = parsedGLTF["bufferViews"].GetArray ();
   output->bufferViewsCount = bufferViews.Size ();
-  output->bufferViews = REI_MALLOC (BufferView, output->bufferViewsCount);
+  output->accessorsCount = accessors.Size ();
+
+  output->compressionsCount = 0;
+  for (const auto& bufferView : bufferViews) {
+    const b8 hasExtensions = bufferView.HasMember ("extensions");
+    output->compressionsCount += hasExtensions && bufferView["extensions"].HasMember ("EXT_meshopt_compression");
+  }
+
+  output->meshesCount = meshes.Size ();
+  output->nodesCount = nodes.Size ();
+  output->imagesCount = images.Size ();
+
+  output->primitivesCount = 0;
+  for (const auto& mesh : meshes) output->primitivesCount += mesh["primitives"].GetArray().Size ();
+  output->texturesCount = textures.Size ();
+  output->materialsCount = materials.Size ();
+
+  createData (output);
+
+  // Optional properties fall back to their defaults from the specification
+  #define GET_UINT(object, name, fallback) ((object).HasMember (name) ? (object)[name].GetUint () : (fallback))
+
+  // Load buffer views
+  output->bufferViews = GLTF_ALLOC (BufferView, output->bufferViewsCount);
 
   u32 offset = 0;
   for (const auto& bufferView : bufferViews) {
     auto newBufferView = &output->bufferViews[offset++];
     newBufferView->buffer = bufferView["buffer"].GetUint ();
     newBufferView->byteLength = bufferView["byteLength"].GetUint ();
-    newBufferView->byteOffset = bufferView["byteOffset"].GetUint ();
+    newBufferView->byteOffset = GET_UINT (bufferView, "byteOffset", 0);
+    newBufferView->byteStride = GET_UINT (bufferView, "byteStride", 0);
+  }
+
+  // Load compressed buffer views, they are decoded once the buffer is mapped
+  output->compressions = GLTF_ALLOC (MeshoptCompression, output->compressionsCount);
+
+  u32 compressionIndex = 0;
+  offset = 0;
+
+  for (const auto& bufferView : bufferViews) {
+    ++offset;
+
+    if (!bufferView.HasMember ("extensions") || !bufferView["extensions"].HasMember ("EXT_meshopt_compression")) continue;
+    const auto& compression = bufferView["extensions"]["EXT_meshopt_compression"];
+
+    auto newCompression = &output->compressions[compressionIndex++];
+    newCompression->bufferView = offset - 1;
+    newCompression->buffer = compression["buffer"].GetUint ();
+    newCompression->byteOffset = GET_UINT (compression, "byteOffset", 0);
+    newCompression->byteLength = compression["byteLength"].GetUint ();
+    newCompression->byteStride = compression["byteStride"].GetUint ();
+    newCompression->count = compression["count"].GetUint ();
+    newCompression->mode = parseMeshoptMode (compression["mode"].GetString ());
+
+    newCompression->filter = compression.HasMember ("filter") ?
+      parseMeshoptFilter (compression["filter"].GetString ()) : meshopt::Filter::None;
   }
 
   // Load accessors
-  const auto& accessors = parsedGLTF["accessors"].GetArray ();
-  output->accessorsCount = accessors.Size ();
-  output->accessors = REI_MALLOC (Accessor, output->accessorsCount);
+  output->accessors = GLTF_ALLOC (Accessor, output->accessorsCount);
+  memset (output->accessors, 0, sizeof (Accessor) * output->accessorsCount);
 
   offset = 0;
   for (const auto& accessor : accessors) {
     auto newAccessor = &output->accessors[offset++];
     newAccessor->count = accessor["count"].GetUint ();
-    newAccessor->bufferView = accessor["bufferView"].GetUint ();
-    newAccessor->byteOffset = accessor["byteOffset"].GetUint ();
+    newAccessor->bufferView = GET_UINT (accessor, "bufferView", UINT32_MAX);
+    newAccessor->byteOffset = GET_UINT (accessor, "byteOffset", 0);
+    newAccessor->normalized = accessor.HasMember ("normalized") && accessor["normalized"].GetBool ();
     newAccessor->type = parseAccessorType (accessor["type"].GetString ());
     newAccessor->componentType = parseAccessorComponentType (accessor["componentType"].GetUint ());
+
+    if (accessor.HasMember ("sparse")) {
+      const auto& sparse = accessor["sparse"];
+      const auto& sparseIndices = sparse["indices"];
+      const auto& sparseValues = sparse["values"];
+
+      newAccessor->sparse.count = sparse["count"].GetUint ();
+      newAccessor->sparse.indicesComponentType = parseAccessorComponentType (sparseIndices["componentType"].GetUint ());
+      newAccessor->sparse.indicesBufferView = sparseIndices["bufferView"].GetUint ();
+      newAccessor->sparse.indicesByteOffset = GET_UINT (sparseIndices, "byteOffset", 0);
+      newAccessor->sparse.valuesBufferView = sparseValues["bufferView"].GetUint ();
+      newAccessor->sparse.valuesByteOffset = GET_UINT (sparseValues, "byteOffset", 0);
+    }
   }
 
-  // Load scale vector
-  const auto& defaultNode = *parsedGLTF["nodes"].GetArray().Begin ();
-  const auto& scaleVector = defaultNode["scale"].GetArray ();
+  // Load nodes, parents are resolved from the children of every node
+  output->nodes = GLTF_ALLOC (Node, output->nodesCount);
+  for (u32 index = 0; index < output->nodesCount; ++index) output->nodes[index].parent = UINT32_MAX;
+
+  offset = 0;
+  for (const auto& node : nodes) {
+    auto newNode = &output->nodes[offset++];
+    newNode->mesh = node.HasMember ("mesh") ? node["mesh"].GetUint () : UINT32_MAX;
+    newNode->instancing.translation = newNode->instancing.rotation = newNode->instancing.scale = UINT32_MAX;
+
+    if (node.HasMember ("extensions") && node["extensions"].HasMember ("EXT_mesh_gpu_instancing")) {
+      const auto& attributes = node["extensions"]["EXT_mesh_gpu_instancing"]["attributes"];
+      newNode->instancing.translation = GET_UINT (attributes, "TRANSLATION", UINT32_MAX);
+      newNode->instancing.rotation = GET_UINT (attributes, "ROTATION", UINT32_MAX);
+      newNode->instancing.scale = GET_UINT (attributes, "SCALE", UINT32_MAX);
+    }
+
+    if (node.HasMember ("children")) {
+      for (const auto& child : node["children"].GetArray ()) {
+        if (child.GetUint () < output->nodesCount) output->nodes[child.GetUint ()].parent = offset - 1;
+      }
+    }
+
+    if (node.HasMember ("matrix")) {
+      const auto& matrix = node["matrix"].GetArray ();
+      for (u32 component = 0; component < 16; ++component)
+        (&newNode->matrix.rows[component / 4].x)[component % 4] = matrix[component].GetFloat ();
+
+      continue;
+    }
+
+    f32 translation[3] {0.f, 0.f, 0.f};
+    f32 rotation[4] {0.f, 0.f, 0.f, 1.f};
+    f32 scale[3] {1.f, 1.f, 1.f};
+
+    #define GET_VECTOR(name, vector) do {                                                    \
+      if (node.HasMember (name)) {                                                           \
+        const auto& array = node[name].GetArray ();                                          \
+        for (u32 component = 0; component < REI_ARRAY_SIZE (vector); ++component)            \
+          vector[component] = array[component].GetFloat ();                                  \
+      }                                                                                      \
+    } while (0)
+
+    GET_VECTOR ("translation", translation);
+    GET_VECTOR ("rotation", rotation);
+    GET_VECTOR ("scale", scale);
+
+    #undef GET_VECTOR
+
+    composeNode (translation, rotation, scale, newNode);
+  }
 
-  output->scaleVector.x = scaleVector[0].GetFloat ();
-  output->scaleVector.y = scaleVector[1].GetFloat ();
-  output->scaleVector.z = scaleVector[2].GetFloat ();
+  sortNodes (output);
 
-  // Load primitives
-  const auto& defaultMesh = *parsedGLTF["meshes"].GetArray().Begin ();
-  const auto& primitives = defaultMesh["primitives"].GetArray ();
-  output->mesh.primitivesCount = primitives.Size ();
-  output->mesh.primitives = REI_MALLOC (Primitive, output->mesh.primitivesCount);
+  // Load meshes and their primitives
+  output->meshes = GLTF_ALLOC (Mesh, output->meshesCount);
+  output->primitives = GLTF_ALLOC (Primitive, output->primitivesCount);
+  memset (output->primitives, 0, sizeof (Primitive) * output->primitivesCount);
 
   #define GET_ATTRIBUTE(name, fieldName) do {                                        \
     if (primitive["attributes"].HasMember(name))                                     \
@@ -143,47 +701,55 @@ void load (const char* relativePath, Data* output) {
   } while (0)
 
   offset = 0;
-  for (const auto& primitive : primitives) {
-    auto newPrimitive = &output->mesh.primitives[offset++];
-    GET_ATTRIBUTE ("TEXCOORD_0", uv);
-    GET_ATTRIBUTE ("NORMAL", normal);
-    GET_ATTRIBUTE ("TANGENT", tangent);
-    GET_ATTRIBUTE ("POSITION", position);
+  u32 meshIndex = 0;
+
+  for (const auto& mesh : meshes) {
+    auto newMesh = &output->meshes[meshIndex++];
+    newMesh->firstPrimitive = offset;
+    newMesh->primitivesCount = mesh["primitives"].GetArray().Size ();
+
+    for (const auto& primitive : mesh["primitives"].GetArray ()) {
+      auto newPrimitive = &output->primitives[offset++];
+      newPrimitive->attributes.uv = newPrimitive->attributes.normal = UINT32_MAX;
+      newPrimitive->attributes.tangent = newPrimitive->attributes.position = UINT32_MAX;
 
-    newPrimitive->mode = parsePrimitiveMode (primitive["mode"].GetUint ());
-    newPrimitive->indices = primitive["indices"].GetUint ();
-    newPrimitive->material = primitive["material"].GetUint ();
+      GET_ATTRIBUTE ("TEXCOORD_0", uv);
+      GET_ATTRIBUTE ("NORMAL", normal);
+      GET_ATTRIBUTE ("TANGENT", tangent);
+      GET_ATTRIBUTE ("POSITION", position);
+
+      newPrimitive->mode = parsePrimitiveMode (GET_UINT (primitive, "mode", 4));
+      newPrimitive->indices = GET_UINT (primitive, "indices", UINT32_MAX);
+      newPrimitive->material = GET_UINT (primitive, "material", UINT32_MAX);
+    }
   }
 
   #undef GET_ATTRIBUTE
 
   // Load images
-  const auto& images = parsedGLTF["images"].GetArray ();
-  output->imagesCount = images.Size ();
-  output->images = REI_MALLOC (Image, output->imagesCount);
+  output->images = GLTF_ALLOC (Image, output->imagesCount);
+  memset (output->images, 0, sizeof (Image) * output->imagesCount);
 
   offset = 0;
   for (const auto& image : images) {
     auto newImage = &output->images[offset++];
-    strcpy (newImage->uri, image["uri"].GetString ());
-    newImage->mimeType = parseMimeType (image["mimeType"].GetString ());
+    // Images that are stored in buffer views don't have a uri, and the mime type is optional for the ones that do
+    newImage->mimeType = MimeType::Unknown;
+    if (image.HasMember ("uri")) strcpy (newImage->uri, image["uri"].GetString ());
+    if (image.HasMember ("mimeType")) newImage->mimeType = parseMimeType (image["mimeType"].GetString ());
   }
 
   // Load textures
-  const auto& textures = parsedGLTF["textures"].GetArray ();
-  output->texturesCount = textures.Size ();
-  output->textures = REI_MALLOC (Texture, output->texturesCount);
+  output->textures = GLTF_ALLOC (Texture, output->texturesCount);
 
   offset = 0;
   for (const auto& texture : textures) {
     auto newTexture = &output->textures[offset++];
-    newTexture->source = texture["source"].GetUint ();
+    newTexture->source = GET_UINT (texture, "source", UINT32_MAX);
   }
 
   // Load materials
-  const auto& materials = parsedGLTF["materials"].GetArray ();
-  output->materialsCount = materials.Size ();
-  output->materials = REI_MALLOC (Material, output->materialsCount);
+  output->materials = GLTF_ALLOC (Material, output->materialsCount);
 
   offset = 0;
   for (const auto& material : materials) {
@@ -195,19 +761,700 @@ void load (const char* relativePath, Data* output) {
       newMaterial->alphaMode = AlphaMode::Opaque;
     }
 
-    newMaterial->baseColorTexture =
-      material["pbrMetallicRoughness"]["baseColorTexture"]["index"].GetUint ();
+    newMaterial->baseColorTexture = UINT32_MAX;
+    if (material.HasMember ("pbrMetallicRoughness")) {
+      const auto& pbr = material["pbrMetallicRoughness"];
+      if (pbr.HasMember ("baseColorTexture"))
+        newMaterial->baseColorTexture = GET_UINT (pbr["baseColorTexture"], "index", UINT32_MAX);
+    }
+  }
+
+  #undef GET_UINT
+}
+
+// Finds the JSON and BIN chunks of a binary glTF, the BIN chunk is optional
+static Result parseGlb (const File* file, File* json, File* binary) {
+  const u8* contents = (const u8*) file->contents;
+  if (file->size < sizeof (GlbHeader) + sizeof (GlbChunk)) return Result::InvalidAssetFormat;
+
+  const auto header = (const GlbHeader*) contents;
+  if (header->magic != REI_GLB_MAGIC || header->version != 2) return Result::InvalidAssetFormat;
+  if (header->length > file->size) return Result::InvalidAssetFormat;
+
+  json->size = binary->size = 0;
+  json->contents = binary->contents = nullptr;
+
+  // Chunks are 4 byte aligned, unknown ones have to be skipped
+  size_t offset = sizeof (GlbHeader);
+  while (offset + sizeof (GlbChunk) <= header->length) {
+    const auto chunk = (const GlbChunk*) &contents[offset];
+    offset += sizeof (GlbChunk);
+    if (chunk->length > header->length - offset) return Result::InvalidAssetFormat;
+
+    if (chunk->type == REI_GLB_CHUNK_JSON && !json->contents) {
+      json->size = chunk->length;
+      json->contents = (void*) &contents[offset];
+    } else if (chunk->type == REI_GLB_CHUNK_BIN && !binary->contents) {
+      binary->size = chunk->length;
+      binary->contents = (void*) &contents[offset];
+    }
+
+    offset += chunk->length;
   }
+
+  return json->contents ? Result::Success : Result::InvalidAssetFormat;
+}
+
+// Copies the JSON of the model into a new scratch arena, in situ parsing needs it to be writable and
+// null terminated. The arena has room for reserveRatio bytes per byte of text after the copy.
+// The buffer of the output points into the mapping of the .glb or .bin file (or into the pack),
+// so the geometry is never copied.
+static char* readModel (
+  const char* relativePath,
+  const Pack* pack,
+  u32 reserveRatio,
+  Arena* scratch,
+  size_t* size,
+  Data* output
+) {
+  b8 mapped;
+  File model;
+  openFile (relativePath, pack, &model, &mapped);
+
+  File json, binary;
+  const b8 isBinary = model.size >= 4 && *(const u32*) model.contents == REI_GLB_MAGIC;
+
+  if (isBinary) {
+    REI_CHECK (parseGlb (&model, &json, &binary));
+  } else {
+    json = model;
+
+    char binaryPath[256] {};
+    strcpy (binaryPath, relativePath);
+    char* extension = strrchr (binaryPath, '.');
+    memcpy (extension + 1, "bin", 4);
+
+    b8 binaryMapped;
+    openFile (binaryPath, pack, &binary, &binaryMapped);
+    output->mapping.size = binary.size;
+    output->mapping.contents = binaryMapped ? binary.contents : nullptr;
+  }
+
+  createArena (json.size * (1 + reserveRatio) + 32, scratch);
+
+  char* text = REI_ARENA_ALLOC (scratch, char, json.size + 1);
+  memcpy (text, json.contents, json.size);
+  text[json.size] = '\0';
+  *size = json.size;
+
+  output->buffer = (u8*) binary.contents;
+  output->bufferSize = binary.size;
+
+  if (isBinary) {
+    // Mapping of the whole container stays alive for the buffer
+    output->mapping.size = model.size;
+    output->mapping.contents = mapped ? model.contents : nullptr;
+  } else if (mapped) {
+    unmapFile (&model);
+  }
+
+  return text;
+}
+
+void loadDom (const char* relativePath, const Pack* pack, Data* output) {
+  REI_LOG_INFO ("Loading a gltf model from " ANSI_YELLOW "%s" ANSI_GREEN " with the DOM parser", relativePath);
+
+  // Text and DOM only live until the model is loaded, strings of the DOM point into the text
+  size_t size;
+  Arena scratch;
+  char* text = readModel (relativePath, pack, GLTF_DOM_SIZE_RATIO, &scratch, &size, output);
+
+  size_t domSize = size * GLTF_DOM_SIZE_RATIO;
+  parseDom (text, allocate (&scratch, domSize, 16), domSize, output);
+  destroyArena (&scratch);
+
+  decodeBufferViews (output);
+}
+
+// Fields the SAX handler cares about, everything else is skipped along with its value
+enum class Field : u8 {
+  Unknown,
+
+  // Top level arrays
+  Nodes,
+  Meshes,
+  Images,
+  Textures,
+  Materials,
+  Accessors,
+  BufferViews,
+
+  // Fields of their elements
+  Uri,
+  Type,
+  Mode,
+  Mesh,
+  Index,
+  Scale,
+  Count,
+  Buffer,
+  InstanceScale,
+  Source,
+  Normal,
+  Matrix,
+  Sparse,
+  Values,
+  Filter,
+  Indices,
+  Tangent,
+  Material,
+  MimeType,
+  Position,
+  Children,
+  Rotation,
+  InstanceRotation,
+  AlphaMode,
+  TexCoord0,
+  BufferView,
+  ByteLength,
+  ByteOffset,
+  ByteStride,
+  Primitives,
+  Attributes,
+  Normalized,
+  Translation,
+  InstanceTranslation,
+  Extensions,
+  ComponentType,
+  BaseColorTexture,
+  PbrMetallicRoughness,
+  MeshoptCompression,
+  MeshGpuInstancing
+};
+
+static Field parseField (const char* name, u32 length) noexcept {
+  #define GLTF_FIELD(name) {name, sizeof (name) - 1}
+
+  // Same order as the fields, starting after Unknown
+  static const struct {
+    const char* name;
+    size_t length;
+  } fields[] {
+    GLTF_FIELD ("nodes"),
+    GLTF_FIELD ("meshes"),
+    GLTF_FIELD ("images"),
+    GLTF_FIELD ("textures"),
+    GLTF_FIELD ("materials"),
+    GLTF_FIELD ("accessors"),
+    GLTF_FIELD ("bufferViews"),
+    GLTF_FIELD ("uri"),
+    GLTF_FIELD ("type"),
+    GLTF_FIELD ("mode"),
+    GLTF_FIELD ("mesh"),
+    GLTF_FIELD ("index"),
+    GLTF_FIELD ("scale"),
+    GLTF_FIELD ("count"),
+    GLTF_FIELD ("buffer"),
+    GLTF_FIELD ("SCALE"),
+    GLTF_FIELD ("source"),
+    GLTF_FIELD ("NORMAL"),
+    GLTF_FIELD ("matrix"),
+    GLTF_FIELD ("sparse"),
+    GLTF_FIELD ("values"),
+    GLTF_FIELD ("filter"),
+    GLTF_FIELD ("indices"),
+    GLTF_FIELD ("TANGENT"),
+    GLTF_FIELD ("material"),
+    GLTF_FIELD ("mimeType"),
+    GLTF_FIELD ("POSITION"),
+    GLTF_FIELD ("children"),
+    GLTF_FIELD ("rotation"),
+    GLTF_FIELD ("ROTATION"),
+    GLTF_FIELD ("alphaMode"),
+    GLTF_FIELD ("TEXCOORD_0"),
+    GLTF_FIELD ("bufferView"),
+    GLTF_FIELD ("byteLength"),
+    GLTF_FIELD ("byteOffset"),
+    GLTF_FIELD ("byteStride"),
+    GLTF_FIELD ("primitives"),
+    GLTF_FIELD ("attributes"),
+    GLTF_FIELD ("normalized"),
+    GLTF_FIELD ("translation"),
+    GLTF_FIELD ("TRANSLATION"),
+    GLTF_FIELD ("extensions"),
+    GLTF_FIELD ("componentType"),
+    GLTF_FIELD ("baseColorTexture"),
+    GLTF_FIELD ("pbrMetallicRoughness"),
+    GLTF_FIELD ("EXT_meshopt_compression"),
+    GLTF_FIELD ("EXT_mesh_gpu_instancing")
+  };
+
+  #undef GLTF_FIELD
+
+  for (u32 index = 0; index < REI_ARRAY_SIZE (fields); ++index) {
+    if (fields[index].length == length && !memcmp (fields[index].name, name, length)) return (Field) (index + 1);
+  }
+
+  return Field::Unknown;
+}
+
+// Array that grows while its elements are streamed in and is copied into the arena of the output afterwards
+struct Stream {
+  u8* elements;
+  u32 count;
+  u32 capacity;
+};
+
+static void* pushElement (Stream* stream, size_t elementSize) {
+  if (stream->count == stream->capacity) {
+    stream->capacity = REI_MAX (stream->capacity * 2, 64u);
+    stream->elements = (u8*) realloc (stream->elements, elementSize * stream->capacity);
+  }
+
+  void* element = &stream->elements[elementSize * stream->count++];
+  memset (element, 0, elementSize);
+  return element;
+}
+
+#define GLTF_PUSH(Type, stream) ((Type*) pushElement (stream, sizeof (Type)))
+#define GLTF_LAST(Type, stream) (&((Type*) (stream)->elements)[(stream)->count - 1])
+
+// Child of a node, parents are only resolved once all of the nodes are known
+struct NodeLink {
+  u32 parent;
+  u32 child;
+};
+
+// Deepest level the handler keeps track of, the fields it reads are at most 6 levels deep
+#ifndef GLTF_SAX_MAX_DEPTH
+#  define GLTF_SAX_MAX_DEPTH 8u
+#endif
+
+// Fills the arrays as the tokens stream by, without building a DOM. Depth is the count of open
+// containers, keys and indices hold the current key or element index of every one of them.
+struct SaxHandler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, SaxHandler> {
+  Stream bufferViews;
+  Stream compressions;
+  Stream accessors;
+  Stream primitives;
+  Stream meshes;
+  Stream nodes;
+  Stream links;
+  Stream images;
+  Stream textures;
+  Stream materials;
+
+  u32 indices[GLTF_SAX_MAX_DEPTH];
+  Field keys[GLTF_SAX_MAX_DEPTH];
+  b8 arrays[GLTF_SAX_MAX_DEPTH];
+
+  // Transform of the current node, it's composed once the node ends unless it has a matrix
+  f32 translation[3];
+  f32 rotation[4];
+  f32 scale[3];
+  u32 matrixComponents;
+
+  u32 depth;
+
+  // Counts the value as an element of the array it's in
+  void beginValue () {
+    if (depth < GLTF_SAX_MAX_DEPTH && arrays[depth]) ++indices[depth];
+  }
+
+  b8 isPrimitive () const {
+    return keys[1] == Field::Meshes && keys[3] == Field::Primitives;
+  }
+
+  b8 isCompression () const {
+    return keys[1] == Field::BufferViews && keys[3] == Field::Extensions && keys[4] == Field::MeshoptCompression;
+  }
+
+  bool Number (f64 value) {
+    beginValue ();
+    const u32 number = (u32) value;
+
+    if (depth == 3) {
+      const Field key = keys[3];
+
+      switch (keys[1]) {
+        case Field::BufferViews: {
+          auto bufferView = GLTF_LAST (BufferView, &bufferViews);
+          if (key == Field::Buffer) bufferView->buffer = number;
+          if (key == Field::ByteLength) bufferView->byteLength = number;
+          if (key == Field::ByteOffset) bufferView->byteOffset = number;
+          if (key == Field::ByteStride) bufferView->byteStride = number;
+        } break;
+
+        case Field::Accessors: {
+          auto accessor = GLTF_LAST (Accessor, &accessors);
+          if (key == Field::Count) accessor->count = number;
+          if (key == Field::BufferView) accessor->bufferView = number;
+          if (key == Field::ByteOffset) accessor->byteOffset = number;
+          if (key == Field::ComponentType) accessor->componentType = parseAccessorComponentType (number);
+        } break;
+
+        case Field::Textures: {
+          if (key == Field::Source) GLTF_LAST (Texture, &textures)->source = number;
+        } break;
+
+        case Field::Nodes: {
+          if (key == Field::Mesh) GLTF_LAST (Node, &nodes)->mesh = number;
+        } break;
+
+        default: break;
+      }
+    } else if (depth == 4 && keys[1] == Field::Accessors) {
+      if (keys[3] == Field::Sparse && keys[4] == Field::Count) GLTF_LAST (Accessor, &accessors)->sparse.count = number;
+    } else if (depth == 4 && keys[1] == Field::Nodes) {
+      const u32 component = indices[4];
+
+      switch (keys[3]) {
+        case Field::Children: {
+          auto link = GLTF_PUSH (NodeLink, &links);
+          link->parent = indices[2];
+          link->child = number;
+        } break;
+
+        case Field::Matrix: {
+          if (component >= 16) break;
+          (&GLTF_LAST (Node, &nodes)->matrix.rows[component / 4].x)[component % 4] = (f32) value;
+          ++matrixComponents;
+        } break;
+
+        case Field::Translation: if (component < 3) translation[component] = (f32) value; break;
+        case Field::Rotation: if (component < 4) rotation[component] = (f32) value; break;
+        case Field::Scale: if (component < 3) scale[component] = (f32) value; break;
+
+        default: break;
+      }
+    } else if (depth == 5) {
+      if (isPrimitive ()) {
+        auto primitive = GLTF_LAST (Primitive, &primitives);
+        if (keys[5] == Field::Mode) primitive->mode = parsePrimitiveMode (number);
+        if (keys[5] == Field::Indices) primitive->indices = number;
+        if (keys[5] == Field::Material) primitive->material = number;
+      }
+
+      if (isCompression ()) {
+        auto compression = GLTF_LAST (MeshoptCompression, &compressions);
+        if (keys[5] == Field::Count) compression->count = number;
+        if (keys[5] == Field::Buffer) compression->buffer = number;
+        if (keys[5] == Field::ByteLength) compression->byteLength = number;
+        if (keys[5] == Field::ByteOffset) compression->byteOffset = number;
+        if (keys[5] == Field::ByteStride) compression->byteStride = number;
+      }
+
+      if (keys[1] == Field::Accessors && keys[3] == Field::Sparse) {
+        auto sparse = &GLTF_LAST (Accessor, &accessors)->sparse;
+
+        if (keys[4] == Field::Indices) {
+          if (keys[5] == Field::BufferView) sparse->indicesBufferView = number;
+          if (keys[5] == Field::ByteOffset) sparse->indicesByteOffset = number;
+          if (keys[5] == Field::ComponentType) sparse->indicesComponentType = parseAccessorComponentType (number);
+        } else if (keys[4] == Field::Values) {
+          if (keys[5] == Field::BufferView) sparse->valuesBufferView = number;
+          if (keys[5] == Field::ByteOffset) sparse->valuesByteOffset = number;
+        }
+      }
+
+      if (
+        keys[1] == Field::Materials &&
+        keys[3] == Field::PbrMetallicRoughness &&
+        keys[4] == Field::BaseColorTexture &&
+        keys[5] == Field::Index
+      ) GLTF_LAST (Material, &materials)->baseColorTexture = number;
+    } else if (depth == 6) {
+      if (isPrimitive () && keys[5] == Field::Attributes) {
+        auto attributes = &GLTF_LAST (Primitive, &primitives)->attributes;
+        if (keys[6] == Field::TexCoord0) attributes->uv = number;
+        if (keys[6] == Field::Normal) attributes->normal = number;
+        if (keys[6] == Field::Tangent) attributes->tangent = number;
+        if (keys[6] == Field::Position) attributes->position = number;
+      }
+
+      if (
+        keys[1] == Field::Nodes &&
+        keys[3] == Field::Extensions &&
+        keys[4] == Field::MeshGpuInstancing &&
+        keys[5] == Field::Attributes
+      ) {
+        auto instancing = &GLTF_LAST (Node, &nodes)->instancing;
+        if (keys[6] == Field::InstanceTranslation) instancing->translation = number;
+        if (keys[6] == Field::InstanceRotation) instancing->rotation = number;
+        if (keys[6] == Field::InstanceScale) instancing->scale = number;
+      }
+    }
+
+    return true;
+  }
+
+  bool Int (int value) { return Number (value); }
+  bool Uint (unsigned value) { return Number (value); }
+  bool Int64 (int64_t value) { return Number ((f64) value); }
+  bool Uint64 (uint64_t value) { return Number ((f64) value); }
+  bool Double (double value) { return Number (value); }
+
+  bool String (const char* value, rapidjson::SizeType length, bool) {
+    beginValue ();
+
+    if (depth == 5 && isCompression ()) {
+      auto compression = GLTF_LAST (MeshoptCompression, &compressions);
+      if (keys[5] == Field::Mode) compression->mode = parseMeshoptMode (value);
+      if (keys[5] == Field::Filter) compression->filter = parseMeshoptFilter (value);
+    }
+
+    if (depth != 3) return true;
+    const Field key = keys[3];
+
+    switch (keys[1]) {
+      case Field::Accessors: {
+        if (key == Field::Type) GLTF_LAST (Accessor, &accessors)->type = parseAccessorType (value);
+      } break;
+
+      case Field::Images: {
+        auto image = GLTF_LAST (Image, &images);
+
+        if (key == Field::Uri) {
+          const u32 size = REI_MIN (length, (u32) sizeof (image->uri) - 1);
+          memcpy (image->uri, value, size);
+          image->uri[size] = '\0';
+        }
+
+        if (key == Field::MimeType) image->mimeType = parseMimeType (value);
+      } break;
+
+      case Field::Materials: {
+        if (key == Field::AlphaMode) GLTF_LAST (Material, &materials)->alphaMode = parseAlphaMode (value);
+      } break;
+
+      default: break;
+    }
+
+    return true;
+  }
+
+  bool Key (const char* name, rapidjson::SizeType length, bool) {
+    if (depth < GLTF_SAX_MAX_DEPTH) keys[depth] = parseField (name, length);
+    return true;
+  }
+
+  bool StartObject () {
+    beginValue ();
+    if (++depth >= GLTF_SAX_MAX_DEPTH) return true;
+
+    keys[depth] = Field::Unknown;
+    arrays[depth] = REI_FALSE;
+
+    if (depth == 3) {
+      switch (keys[1]) {
+        case Field::BufferViews: GLTF_PUSH (BufferView, &bufferViews); break;
+        case Field::Accessors: GLTF_PUSH (Accessor, &accessors)->bufferView = UINT32_MAX; break;
+        case Field::Textures: GLTF_PUSH (Texture, &textures)->source = UINT32_MAX; break;
+
+        case Field::Images: {
+          GLTF_PUSH (Image, &images)->mimeType = MimeType::Unknown;
+        } break;
+
+        case Field::Materials: {
+          auto material = GLTF_PUSH (Material, &materials);
+          material->alphaMode = AlphaMode::Opaque;
+          material->baseColorTexture = UINT32_MAX;
+        } break;
+
+        case Field::Meshes: {
+          GLTF_PUSH (Mesh, &meshes)->firstPrimitive = primitives.count;
+        } break;
+
+        case Field::Nodes: {
+          auto node = GLTF_PUSH (Node, &nodes);
+          node->parent = node->mesh = UINT32_MAX;
+          node->instancing.translation = node->instancing.rotation = node->instancing.scale = UINT32_MAX;
+
+          translation[0] = translation[1] = translation[2] = 0.f;
+          rotation[0] = rotation[1] = rotation[2] = 0.f;
+          rotation[3] = scale[0] = scale[1] = scale[2] = 1.f;
+          matrixComponents = 0;
+        } break;
+
+        default: break;
+      }
+    } else if (depth == 5 && isPrimitive ()) {
+      auto primitive = GLTF_PUSH (Primitive, &primitives);
+      primitive->mode = TopologyType::Triangles;
+      primitive->indices = primitive->material = UINT32_MAX;
+      primitive->attributes.uv = primitive->attributes.normal = UINT32_MAX;
+      primitive->attributes.tangent = primitive->attributes.position = UINT32_MAX;
+
+      ++GLTF_LAST (Mesh, &meshes)->primitivesCount;
+    } else if (depth == 5 && isCompression ()) {
+      auto compression = GLTF_PUSH (MeshoptCompression, &compressions);
+      compression->bufferView = indices[2];
+      compression->mode = meshopt::Mode::Unknown;
+      compression->filter = meshopt::Filter::None;
+    }
+
+    return true;
+  }
+
+  bool StartArray () {
+    beginValue ();
+    if (++depth >= GLTF_SAX_MAX_DEPTH) return true;
+
+    keys[depth] = Field::Unknown;
+    arrays[depth] = REI_TRUE;
+    indices[depth] = UINT32_MAX;
+    return true;
+  }
+
+  bool EndObject (rapidjson::SizeType) {
+    if (depth == 3 && keys[1] == Field::Nodes && !matrixComponents)
+      composeNode (translation, rotation, scale, GLTF_LAST (Node, &nodes));
+
+    --depth;
+    return true;
+  }
+
+  bool EndArray (rapidjson::SizeType) { --depth; return true; }
+
+  bool Null () { beginValue (); return true; }
+  bool Bool (bool value) {
+    beginValue ();
+
+    if (depth == 3 && keys[1] == Field::Accessors && keys[3] == Field::Normalized)
+      GLTF_LAST (Accessor, &accessors)->normalized = value;
+
+    return true;
+  }
+};
+
+// Moves the streamed elements into the arena of the output, once it has been created
+#define GLTF_TAKE(Type, stream, array) do {                               \
+    u32 count = (stream)->count;                                          \
+    array = GLTF_ALLOC (Type, count);                                     \
+    if (count) memcpy (array, (stream)->elements, sizeof (Type) * count); \
+    free ((stream)->elements);                                            \
+  } while (0)
+
+void load (const char* relativePath, const Pack* pack, Data* output) {
+  REI_LOG_INFO ("Loading a gltf model from " ANSI_YELLOW "%s", relativePath);
+
+  size_t size;
+  Arena scratch;
+  char* text = readModel (relativePath, pack, 0, &scratch, &size, output);
+
+  SaxHandler handler {};
+
+  rapidjson::Reader reader;
+  rapidjson::InsituStringStream stream {text};
+  reader.Parse<rapidjson::kParseInsituFlag> (stream, handler);
+
+  if (reader.HasParseError ()) {
+    REI_LOG_ERROR (
+      "Failed to parse " ANSI_YELLOW "%s" ANSI_RED " (error %u at offset %zu)",
+      relativePath,
+      (u32) reader.GetParseErrorCode (),
+      reader.GetErrorOffset ()
+    );
+  }
+
+  destroyArena (&scratch);
+
+  output->bufferViewsCount = handler.bufferViews.count;
+  output->compressionsCount = handler.compressions.count;
+  output->accessorsCount = handler.accessors.count;
+  output->primitivesCount = handler.primitives.count;
+  output->meshesCount = handler.meshes.count;
+  output->nodesCount = handler.nodes.count;
+  output->imagesCount = handler.images.count;
+  output->texturesCount = handler.textures.count;
+  output->materialsCount = handler.materials.count;
+
+  createData (output);
+
+  GLTF_TAKE (BufferView, &handler.bufferViews, output->bufferViews);
+  GLTF_TAKE (MeshoptCompression, &handler.compressions, output->compressions);
+  GLTF_TAKE (Accessor, &handler.accessors, output->accessors);
+  GLTF_TAKE (Primitive, &handler.primitives, output->primitives);
+  GLTF_TAKE (Mesh, &handler.meshes, output->meshes);
+  GLTF_TAKE (Node, &handler.nodes, output->nodes);
+  GLTF_TAKE (Image, &handler.images, output->images);
+  GLTF_TAKE (Texture, &handler.textures, output->textures);
+  GLTF_TAKE (Material, &handler.materials, output->materials);
+
+  const auto links = (const NodeLink*) handler.links.elements;
+  for (u32 index = 0; index < handler.links.count; ++index) {
+    if (links[index].child < output->nodesCount) output->nodes[links[index].child].parent = links[index].parent;
+  }
+
+  free (handler.links.elements);
+  sortNodes (output);
+  decodeBufferViews (output);
+}
+
+#undef GLTF_TAKE
+#undef GLTF_LAST
+#undef GLTF_PUSH
+
+// Both parsers have to produce the same arrays
+static b8 compareData (const Data* first, const Data* second) {
+  #define COMPARE(array, count) (                                              \
+    first->count == second->count &&                                           \
+    !memcmp (first->array, second->array, sizeof *first->array * first->count) \
+  )
+
+  b8 same = COMPARE (bufferViews, bufferViewsCount) &&
+    COMPARE (compressions, compressionsCount) &&
+    COMPARE (decoded, decodedSize) &&
+    COMPARE (accessors, accessorsCount) &&
+    COMPARE (primitives, primitivesCount) &&
+    COMPARE (meshes, meshesCount) &&
+    COMPARE (nodes, nodesCount) &&
+    COMPARE (images, imagesCount) &&
+    COMPARE (textures, texturesCount) &&
+    COMPARE (materials, materialsCount);
+
+  #undef COMPARE
+  return same;
+}
+
+void benchmark (const char* relativePath, const Pack* pack, u32 iterations) {
+  u64 saxCycles = 0, domCycles = 0;
+  b8 same = REI_TRUE;
+
+  for (u32 iteration = 0; iteration < iterations; ++iteration) {
+    Data sax, dom;
+
+    u64 start = __rdtsc ();
+    load (relativePath, pack, &sax);
+    saxCycles += __rdtsc () - start;
+
+    start = __rdtsc ();
+    loadDom (relativePath, pack, &dom);
+    domCycles += __rdtsc () - start;
+
+    same = same && compareData (&sax, &dom);
+
+    destroy (&dom);
+    destroy (&sax);
+  }
+
+  REI_LOG_INFO (
+    "Parsing " ANSI_YELLOW "%s" ANSI_GREEN " took " ANSI_YELLOW "%llu" ANSI_GREEN " cycles with SAX and "
+    ANSI_YELLOW "%llu" ANSI_GREEN " with DOM on average",
+    relativePath,
+    saxCycles / REI_MAX (iterations, 1u),
+    domCycles / REI_MAX (iterations, 1u)
+  );
+
+  if (!same) REI_LOGS_WARN ("Parsers produced different results");
 }
 
 void destroy (Data* data) {
-  free (data->materials);
-  free (data->textures);
-  free (data->images);
-  free (data->mesh.primitives);
-  free (data->accessors);
-  free (data->bufferViews);
-  free (data->buffer);
+  if (data->mapping.contents) unmapFile (&data->mapping);
+  destroyArena (&data->arena);
 }
 
+#undef GLTF_ARRAY_SIZE
+#undef GLTF_ALLOC
+
 }
@@ -2,7 +2,32 @@
 #define GLTF_HPP
 
 #include <stddef.h>
+
+#include "common.hpp"
 #include "rei_math_types.hpp"
+#include "mesh_compression.hpp"
+
+// Count of times the model is loaded with both parsers at startup to compare them, 0 disables it
+#ifndef REI_BENCHMARK_GLTF
+#  define REI_BENCHMARK_GLTF 0u
+#endif
+
+// Binary glTF container (.glb), see "GLB File Format Specification" of glTF 2.0
+#ifndef REI_GLB_MAGIC
+#  define REI_GLB_MAGIC 0x46546C67u // glTF
+#endif
+
+#ifndef REI_GLB_CHUNK_JSON
+#  define REI_GLB_CHUNK_JSON 0x4E4F534Au // JSON
+#endif
+
+#ifndef REI_GLB_CHUNK_BIN
+#  define REI_GLB_CHUNK_BIN 0x004E4942u // BIN
+#endif
+
+namespace rei::assets {
+struct Pack;
+}
 
 namespace rei::assets::gltf {
 
@@ -61,14 +86,44 @@ struct Accessor {
   AccessorComponentType componentType;
 
   u32 count;
+  // UINT32_MAX if the accessor doesn't have one, all of its elements are zeros then
   u32 bufferView;
   u32 byteOffset;
+
+  // Integer components are mapped to [0, 1] if they are unsigned and to [-1, 1] if they are signed
+  b32 normalized;
+
+  // Elements at the sparse indices are replaced with the sparse values, count is 0 if the accessor isn't sparse
+  struct {
+    u32 count;
+    AccessorComponentType indicesComponentType;
+    u32 indicesBufferView;
+    u32 indicesByteOffset;
+    u32 valuesBufferView;
+    u32 valuesByteOffset;
+  } sparse;
 };
 
 struct BufferView {
+  // UINT32_MAX if the view was decoded from a compressed one, it points into the decoded buffer then
   u32 buffer;
   u32 byteLength;
   u32 byteOffset;
+  // Distance between the starts of elements, 0 if they are tightly packed
+  u32 byteStride;
+};
+
+// Buffer view compressed with EXT_meshopt_compression, the view itself is replaced with the decoded data
+// once the model is loaded. Only the first buffer is loaded, so compressed data has to be in it.
+struct MeshoptCompression {
+  u32 bufferView;
+  u32 buffer;
+  u32 byteOffset;
+  u32 byteLength;
+  u32 byteStride;
+  u32 count;
+  meshopt::Mode mode;
+  meshopt::Filter filter;
 };
 
 struct Image {
@@ -77,17 +132,20 @@ struct Image {
 };
 
 struct Texture {
+  // UINT32_MAX if the texture doesn't have an image
   u32 source;
 };
 
 struct Material {
   AlphaMode alphaMode;
-  // PBR metallic rougness
+  // PBR metallic rougness, UINT32_MAX if the material isn't textured
   u32 baseColorTexture;
 };
 
+// Accessors of missing attributes and indices are UINT32_MAX
 struct Primitive {
   u32 indices;
+  // UINT32_MAX if the primitive uses the default material
   u32 material;
 
   struct {
@@ -99,22 +157,74 @@ struct Primitive {
   TopologyType mode;
 };
 
+// Primitives of every mesh are a contiguous range of the primitives of the model
 struct Mesh {
-  Primitive* primitives;
-  size_t primitivesCount;
+  u32 firstPrimitive;
+  u32 primitivesCount;
+};
+
+struct Node {
+  // Local transform, translation, rotation and scale are composed into it if the node doesn't have a matrix
+  math::Mat4 matrix;
+  // Parents always come before their children, roots don't have one (UINT32_MAX)
+  u32 parent;
+  // UINT32_MAX if the node doesn't have a mesh
+  u32 mesh;
+
+  // Accessors of the per instance transforms of EXT_mesh_gpu_instancing, UINT32_MAX if they are missing.
+  // The mesh is drawn once for every element of them instead of once for the node.
+  struct {
+    u32 translation;
+    u32 rotation;
+    u32 scale;
+  } instancing;
+};
+
+struct GlbHeader {
+  u32 magic;
+  u32 version;
+  // Size of the whole file, header included
+  u32 length;
+};
+
+// Chunk data follows the header, it's padded to 4 bytes
+struct GlbChunk {
+  u32 length;
+  u32 type;
 };
 
 struct Data {
+  // Every array below is allocated from it
+  Arena arena;
+  // Mapping of the .glb or .bin file that buffer points into,
+  // contents are null if the buffer points into a pack
+  File mapping;
+
   u8* buffer;
   size_t bufferSize;
 
+  // Data of the compressed buffer views, allocated from the arena
+  u8* decoded;
+  size_t decodedSize;
+
   BufferView* bufferViews;
   size_t bufferViewsCount;
 
+  MeshoptCompression* compressions;
+  size_t compressionsCount;
+
   Accessor* accessors;
   size_t accessorsCount;
 
-  Mesh mesh;
+  Primitive* primitives;
+  size_t primitivesCount;
+
+  Mesh* meshes;
+  size_t meshesCount;
+
+  // Whole hierarchy in topological order, nodes that aren't reachable from any root are dropped
+  Node* nodes;
+  size_t nodesCount;
 
   Image* images;
   size_t imagesCount;
@@ -124,20 +234,41 @@ struct Data {
 
   Material* materials;
   size_t materialsCount;
-
-  math::Vec3 scaleVector;
 };
 
 [[nodiscard]] MimeType parseMimeType (const char* rawType) noexcept;
 [[nodiscard]] AlphaMode parseAlphaMode (const char* rawMode) noexcept;
 [[nodiscard]] TopologyType parsePrimitiveMode (u64 mode) noexcept;
 [[nodiscard]] u8 countComponents (AccessorType accessorType) noexcept;
+[[nodiscard]] u8 getComponentSize (AccessorComponentType componentType) noexcept;
 [[nodiscard]] AccessorType parseAccessorType (const char* rawType) noexcept;
 [[nodiscard]] AccessorComponentType parseAccessorComponentType (u64 type) noexcept;
-
-void load (const char* relativePath, Data* output);
+[[nodiscard]] meshopt::Mode parseMeshoptMode (const char* rawMode) noexcept;
+[[nodiscard]] meshopt::Filter parseMeshoptFilter (const char* rawFilter) noexcept;
+
+// Both .gltf models with a .bin next to them and .glb containers are supported, buffer views
+// compressed with EXT_meshopt_compression are decoded and the integer attribute types of
+// KHR_mesh_quantization are decoded by readFloats like any other accessor.
+// Files are looked up in the pack first if it isn't null. The JSON is streamed through
+// a SAX handler that fills the arrays directly, loadDom builds a DOM first and walks it.
+void load (const char* relativePath, const Pack* pack, Data* output);
+void loadDom (const char* relativePath, const Pack* pack, Data* output);
 void destroy (Data* data);
 
+// Decodes the first components of every element of the accessor into tightly packed floats, whatever
+// their component type and stride are, missing components are zeros. Accessors that reach past
+// the end of the buffer are decoded as zeros. out has to fit count * components floats.
+void readFloats (const Data* data, const Accessor* accessor, u32 components, f32* out);
+// Widens the indices of the accessor to 32 bits and adds base to them
+void readIndices (const Data* data, const Accessor* accessor, u32 base, u32* out);
+
+// Concatenates the local transforms of the nodes with the ones of their parents in a single pass,
+// out has to be 16 byte aligned
+void computeWorldMatrices (const Node* nodes, size_t nodesCount, math::Mat4* out);
+
+// Loads the model with both parsers, logs how long they took on average and whether their outputs match
+void benchmark (const char* relativePath, const Pack* pack, u32 iterations);
+
 }
 
 #endif /* GLTF_HPP */
@@ -1,148 +1,250 @@
+#include <stdint.h>
 #include <string.h>
 
 #include "gltf.hpp"
+#include "mesh.hpp"
 #include "common.hpp"
 #include "rei_math.inl"
 #include "gltf_model.hpp"
 #include "asset_baker.hpp"
+#include "upload_manager.hpp"
 
 #include <VulkanMemoryAllocator/include/vk_mem_alloc.h>
 
 namespace rei::gltf {
 
-// Sort primitives by material index so that it would be easier to merge
-// ones with the same material into batches.
-static void sortPrimitives (assets::gltf::Primitive* primitives, i32 low, i32 high) {
-  if (low >= 0 && high >= 0 && low < high) {
-    i32 pivotIndex = 0;
-    // NOTE The cast of (low + high) to unsigned is made because division of
-    // an unsigned integer by a constant is faster than that of a signed one.
-    // After that, unsigned is cast back into signed, because conversion to f32
-    // is faster with signed integers. Also, casting signed->unsigned and vice versa is free.
-    // Reference: Agner Fog's Optimization Manual 1, page 30 and 40.
-    u32 middle = (u32) floorf ((f32) ((i32) ((u32) (low + high) / 2u)));
-    u32 pivot = primitives[middle].material;
-
-    i32 left = low - 1;
-    i32 right = high + 1;
-
-    for (;;) {
-      do ++left; while (primitives[left].material < pivot);
-      do --right; while (primitives[right].material > pivot);
-
-      if (left >= right) {
-        pivotIndex = right;
-	break;
-      }
-
-      REI_SWAP (&primitives[left], &primitives[right]);
-    }
+// Returns the count of written bytes
+static u32 writeBatchIndices (const u32* indices, u32 count, const Batch* batch, u8* out) {
+  const u32 base = (u32) batch->vertexOffset;
 
-    sortPrimitives (primitives, low, pivotIndex);
-    sortPrimitives (primitives, pivotIndex + 1, high);
+  if (batch->indexType == VK_INDEX_TYPE_UINT16) {
+    auto shortIndices = (u16*) out;
+    for (u32 index = 0; index < count; ++index) shortIndices[index] = (u16) (indices[index] - base);
+    return count * (u32) sizeof (u16);
   }
+
+  auto longIndices = (u32*) out;
+  for (u32 index = 0; index < count; ++index) longIndices[index] = indices[index] - base;
+  return count * (u32) sizeof (u32);
+}
+
+// Single white texel compressed the same way as baked textures (an LZ4 block of 4 literals),
+// bound to materials that don't have a base color texture
+static const u8 placeholderPixels[] = {0x40, 0xff, 0xff, 0xff, 0xff};
+static const vku::TextureChunk placeholderChunk {0, 0, sizeof (placeholderPixels), 4};
+
+static void getPlaceholderImage (vku::TextureAllocationInfo* out) {
+  out->pixels = (const char*) placeholderPixels;
+  out->compressedSize = sizeof (placeholderPixels);
+  out->chunks = &placeholderChunk;
+  out->chunksCount = 1;
+  out->file.size = 0;
+  out->file.contents = nullptr;
+
+  out->size = 4;
+  out->mipOffsets[0] = 0;
+  out->width = out->height = 1;
+  out->mipCount = 1;
+  out->format = VKC_TEXTURE_FORMAT;
 }
 
 void load (
   VkDevice device,
   VmaAllocator allocator,
   const vku::TransferContext* transferContext,
+  uploads::Manager* uploadManager,
   VkDescriptorSetLayout descriptorLayout,
   const char* relativePath,
+  const assets::Pack* pack,
   Model* out) {
 
-  assets::gltf::Data gltf;
-  assets::gltf::load (relativePath, &gltf);
-  sortPrimitives (gltf.mesh.primitives, 0, (i32) gltf.mesh.primitivesCount - 1);
+  // Prefer the baked mesh, it only has to be mapped
+  char meshPath[256] {};
+  strcpy (meshPath, relativePath);
+  memcpy (strrchr (meshPath, '.') + 1, "rmesh", 6);
 
-  u32 vertexCount = 0, indexCount = 0;
+  assets::Mesh mesh;
+  if (assets::readMesh (meshPath, pack, &mesh) != Result::Success) {
+    REI_LOG_WARN ("Baked mesh " ANSI_RED "%s" ANSI_YELLOW " is missing, building it from glTF", meshPath);
 
-  for (size_t index = 0; index < gltf.mesh.primitivesCount; ++index) {
-    const auto current = &gltf.mesh.primitives[index];
-    indexCount += gltf.accessors[current->indices].count;
-    vertexCount += gltf.accessors[current->attributes.position].count;
+    assets::gltf::Data gltf;
+    assets::gltf::load (relativePath, pack, &gltf);
+    assets::buildMesh (&gltf, transferContext->jobPool, &mesh);
+    assets::gltf::destroy (&gltf);
+    assets::buildMeshlets (&mesh);
   }
 
-  vku::Buffer stagingBuffer;
-  u32 vertexOffset = 0, indexOffset = 0;
-  auto indexBufferSize = (VkDeviceSize) (sizeof (u32) * indexCount);
-  auto vertexBufferSize = (VkDeviceSize) (sizeof (Vertex) * vertexCount);
-
-  vku::allocateStagingBuffer (allocator, vertexBufferSize + indexBufferSize, &stagingBuffer);
-  VKC_CHECK (vmaMapMemory (allocator, stagingBuffer.allocation, &stagingBuffer.mapped));
+  out->batchesCount = mesh.batchesCount;
+  out->batches = REI_MALLOC (Batch, mesh.batchesCount);
+
+  out->meshletsCount = mesh.meshletsCount;
+  out->meshlets = REI_MALLOC (assets::Meshlet, mesh.meshletsCount);
+  memcpy (out->meshlets, mesh.meshlets, sizeof (assets::Meshlet) * mesh.meshletsCount);
+
+  out->lodsCount = mesh.lodsCount;
+  out->lods = REI_MALLOC (assets::MeshLod, mesh.lodsCount);
+  memcpy (out->lods, mesh.lods, sizeof (assets::MeshLod) * mesh.lodsCount);
+
+  // Every batch gets its own range of the index buffer with the original indices followed by the ones
+  // of its levels of detail. Batches that reference at most 65536 vertices store them in 16 bits.
+  VkDeviceSize indexBufferSize = 0;
+
+  for (u32 index = 0; index < mesh.batchesCount; ++index) {
+    const auto source = &mesh.batches[index];
+    auto batch = &out->batches[index];
+
+    batch->indexCount = source->indexCount;
+    batch->vertexOffset = (i32) source->firstVertex;
+    batch->materialIndex = source->materialIndex;
+    batch->firstMeshlet = source->firstMeshlet;
+    batch->meshletsCount = source->meshletsCount;
+    batch->firstLod = source->firstLod;
+    batch->lodsCount = source->lodsCount;
+    batch->radius = source->radius;
+    memcpy (batch->center, source->center, sizeof (batch->center));
+
+    b8 isShort = source->vertexCount <= UINT16_MAX + 1u;
+    batch->indexType = isShort ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+    for (u32 offset = 0; offset < source->meshletsCount; ++offset)
+      out->meshlets[source->firstMeshlet + offset].firstIndex -= source->firstIndex;
+
+    u32 regionCount = source->indexCount;
+    for (u32 level = 0; level < source->lodsCount; ++level) {
+      auto lod = &out->lods[source->firstLod + level];
+      lod->firstIndex = regionCount;
+      regionCount += lod->indexCount;
+    }
 
-  auto vertices = (Vertex*) stagingBuffer.mapped;
-  auto indices = (u32*) ((u8*) stagingBuffer.mapped + vertexBufferSize);
+    // Offsets have to be aligned to the size of the index type, keep all of them aligned to 4 bytes
+    indexBufferSize = (indexBufferSize + 3) & ~(VkDeviceSize) 3;
+    batch->indexOffset = (u32) indexBufferSize;
+    indexBufferSize += (isShort ? sizeof (u16) : sizeof (u32)) * regionCount;
+  }
 
-  out->batches = REI_MALLOC (Batch, gltf.materialsCount);
+  // Runs of instances that draw the same batches, instances of a mesh are contiguous in baked meshes
+  out->groupsCount = 0;
+  for (u32 index = 0; index < mesh.instancesCount; ++index)
+    out->groupsCount += !index || mesh.instances[index].firstBatch != mesh.instances[index - 1].firstBatch;
 
-  #define GET_ACCESSOR(attribute, result) do {                                           \
-    const auto accessor = &gltf.accessors[currentPrimitive->attributes.attribute];       \
-    const auto bufferView = &gltf.bufferViews[accessor->bufferView];                     \
-    result = (const f32*) (&gltf.buffer[accessor->byteOffset + bufferView->byteOffset]); \
-  } while (0)
+  out->groups = REI_MALLOC (InstanceGroup, out->groupsCount);
+  auto group = out->groups - 1;
 
-  u32 firstIndex = 0;
-  u32 batchOffset = 0;
-  u32 currentMaterial = 0;
-  u32 currentIndexCount = 0;
+  for (u32 index = 0; index < mesh.instancesCount; ++index) {
+    const auto source = &mesh.instances[index];
 
-  const size_t vec2Size = sizeof (f32) * 2;
-  const size_t vec3Size = sizeof (f32) * 3;
+    if (!index || source->firstBatch != mesh.instances[index - 1].firstBatch) {
+      ++group;
+      group->firstInstance = index;
+      group->instancesCount = 0;
+      group->firstBatch = source->firstBatch;
+      group->batchesCount = source->batchesCount;
+    }
 
-  for (size_t primitive = 0; primitive < gltf.mesh.primitivesCount; ++primitive) {
-    const auto currentPrimitive = &gltf.mesh.primitives[primitive];
+    ++group->instancesCount;
+  }
 
-    u32 vertexStart = vertexOffset;
+  auto vertexBufferSize = (VkDeviceSize) (sizeof (GpuVertex) * mesh.vertexCount);
+  auto instanceBufferSize = (VkDeviceSize) (sizeof (math::Mat4) * mesh.instancesCount);
 
-    const f32* uvAccessor = nullptr;
-    const f32* normalAccessor = nullptr;
-    const f32* positionAccessor = nullptr;
+  VkDeviceSize uploadSize = vku::alignUploadSize (vertexBufferSize);
+  uploadSize += vku::alignUploadSize (indexBufferSize);
+  uploadSize += vku::alignUploadSize (instanceBufferSize);
 
-    GET_ACCESSOR (uv, uvAccessor);
-    GET_ACCESSOR (normal, normalAccessor);
-    GET_ACCESSOR (position, positionAccessor);
+  // Images are read up front and streamed right away if there's an upload manager. The rest of them are
+  // uploaded with buffers using a single staging buffer and submit. Placeholder goes right after the images
+  // of the mesh and is never streamed, since materials sample it while their textures aren't there yet.
+  const u32 placeholderIndex = mesh.imagesCount;
+  out->texturesCount = mesh.imagesCount + 1;
+  out->textures = REI_MALLOC (vku::Image, out->texturesCount);
+  out->images = REI_MALLOC (vku::TextureAllocationInfo, out->texturesCount);
+  out->textureTickets = REI_MALLOC (u64, out->texturesCount);
+  getPlaceholderImage (&out->images[placeholderIndex]);
 
-    u32 currentVertexCount = gltf.accessors[currentPrimitive->attributes.position].count;
+  char texturePath[256] {};
+  strcpy (texturePath, relativePath);
+  char* fileName = strrchr (texturePath, '/');
 
-    for (u32 vertex = 0; vertex < currentVertexCount; ++vertex) {
-      auto newVertex = &vertices[vertexOffset++];
+  for (u32 index = 0; index <= placeholderIndex; ++index) {
+    auto image = &out->images[index];
+    out->textureTickets[index] = 0;
 
-      memcpy (&newVertex->u, &uvAccessor[vertex * 2], vec2Size);
-      memcpy (&newVertex->nx, &normalAccessor[vertex * 3], vec3Size);
-      memcpy (&newVertex->x, &positionAccessor[vertex * 3], vec3Size);
+    if (index < placeholderIndex) {
+      strcpy (fileName + 1, mesh.images[index].name);
+      REI_CHECK (assets::readImage (texturePath, pack, image));
+      if (uploadManager)
+        out->textureTickets[index] = uploads::uploadTexture (uploadManager, image, &out->textures[index]);
     }
 
-    const auto accessor = &gltf.accessors[currentPrimitive->indices];
-    const auto bufferView = &gltf.bufferViews[accessor->bufferView];
-    const u16* indexAccessor = (const u16*) &gltf.buffer[accessor->byteOffset + bufferView->byteOffset];
+    // Textures that are too large for the staging ring of the manager are uploaded here as well
+    if (!out->textureTickets[index])
+      uploadSize += vku::alignUploadSize (vku::getTextureUploadSize (transferContext->formatSupport, image));
+  }
 
-    if (currentMaterial == currentPrimitive->material) {
-      currentIndexCount += accessor->count;
-    } else {
-      auto newBatch = &out->batches[batchOffset++];
-      newBatch->firstIndex = firstIndex;
-      newBatch->indexCount = currentIndexCount;
-      newBatch->materialIndex = currentMaterial;
-
-      firstIndex = indexOffset;
-      currentIndexCount = accessor->count;
-      currentMaterial = currentPrimitive->material;
+  vku::UploadBatch uploads;
+  vku::beginUploadBatch (device, allocator, transferContext, uploadSize, &uploads);
+
+  VkDeviceSize verticesOffset, indicesOffset, instancesOffset;
+  void* vertices = vku::reserveUpload (&uploads, vertexBufferSize, &verticesOffset);
+  auto indexData = (u8*) vku::reserveUpload (&uploads, indexBufferSize, &indicesOffset);
+  auto modelMatrices = (math::Mat4*) vku::reserveUpload (&uploads, instanceBufferSize, &instancesOffset);
+
+#if REI_PACKED_VERTICES
+  math::Vec3 quantizationOffset;
+  f32 quantizationScale;
+  assets::getVertexQuantization (&mesh, &quantizationOffset, &quantizationScale);
+  assets::packVertices (
+    mesh.vertices,
+    mesh.vertexCount,
+    &quantizationOffset,
+    quantizationScale,
+    (PackedVertex*) vertices
+  );
+#else
+  memcpy (vertices, mesh.vertices, vertexBufferSize);
+#endif
+
+  for (u32 index = 0; index < mesh.batchesCount; ++index) {
+    const auto source = &mesh.batches[index];
+    const auto batch = &out->batches[index];
+    u8* indices = indexData + batch->indexOffset;
+
+    u32 written = writeBatchIndices (&mesh.indices[source->firstIndex], source->indexCount, batch, indices);
+
+    for (u32 level = 0; level < source->lodsCount; ++level) {
+      const auto lod = &mesh.lods[source->firstLod + level];
+      written += writeBatchIndices (&mesh.indices[lod->firstIndex], lod->indexCount, batch, indices + written);
     }
+  }
 
-    // FIXME This is ugly
-    if (batchOffset == (gltf.materialsCount - 1)) {
-      auto newBatch = &out->batches[batchOffset];
-      newBatch->firstIndex = indexOffset;
-      newBatch->indexCount = currentIndexCount;
-      newBatch->materialIndex = currentMaterial;
+  out->instancesCount = mesh.instancesCount;
+  out->instances = REI_MALLOC (Instance, mesh.instancesCount);
+
+  for (u32 index = 0; index < mesh.instancesCount; ++index) {
+    const auto source = &mesh.instances[index];
+    auto instance = &out->instances[index];
+    instance->meshMatrix = source->matrix;
+
+    // Spheres are scaled by the longest axis, so that they still bound non-uniformly scaled meshes
+    instance->scale = 0.f;
+    for (u32 axis = 0; axis < 3; ++axis) {
+      const auto column = &source->matrix.rows[axis];
+      const f32 length = sqrtf (column->x * column->x + column->y * column->y + column->z * column->z);
+      instance->scale = REI_MAX (instance->scale, length);
     }
 
-    for (u32 index = 0; index < accessor->count; ++index)
-      indices[indexOffset++] = indexAccessor[index] + vertexStart;
-  }
+    // Instances aren't 16 byte aligned, translate and scale need aligned rows
+    alignas (16) math::Mat4 modelMatrix = source->matrix;
 
-  #undef GET_ACCESSOR
+#if REI_PACKED_VERTICES
+    // Positions are dequantized by the model matrix
+    math::Vec3 dequantizationScale {quantizationScale};
+    math::mat4::translate (&modelMatrix, &quantizationOffset);
+    math::mat4::scale (&modelMatrix, &dequantizationScale);
+#endif
+
+    modelMatrices[index] = modelMatrix;
+  }
 
   {
     vku::BufferAllocationInfo allocationInfo;
@@ -159,65 +261,48 @@ void load (
     allocationInfo.bufferUsage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
     vku::allocateBuffer (allocator, &allocationInfo, &out->indexBuffer);
 
-    VkCommandBuffer cmdBuffer;
-    vku::startImmediateCmd (device, transferContext, &cmdBuffer);
-
-    VkBufferCopy copyRegion;
-    copyRegion.srcOffset = 0;
-    copyRegion.dstOffset = 0;
-    copyRegion.size = vertexBufferSize;
-
-    vkCmdCopyBuffer (cmdBuffer, stagingBuffer.handle, out->vertexBuffer.handle, 1, &copyRegion);
-
-    copyRegion.size = indexBufferSize;
-    copyRegion.srcOffset = vertexBufferSize;
-    vkCmdCopyBuffer (cmdBuffer, stagingBuffer.handle, out->indexBuffer.handle, 1, &copyRegion);
+    allocationInfo.size = instanceBufferSize;
+    allocationInfo.bufferUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    allocationInfo.bufferUsage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    vku::allocateBuffer (allocator, &allocationInfo, &out->instanceBuffer);
 
-    vku::submitImmediateCmd (device, transferContext, cmdBuffer);
-    vmaUnmapMemory (allocator, stagingBuffer.allocation);
-    vmaDestroyBuffer (allocator, stagingBuffer.handle, stagingBuffer.allocation);
+    vku::uploadBuffer (&uploads, verticesOffset, vertexBufferSize, out->vertexBuffer.handle);
+    vku::uploadBuffer (&uploads, indicesOffset, indexBufferSize, out->indexBuffer.handle);
+    vku::uploadBuffer (&uploads, instancesOffset, instanceBufferSize, out->instanceBuffer.handle);
   }
 
-  out->modelMatrix = {1.f};
-  math::mat4::scale (&out->modelMatrix, &gltf.scaleVector);
-
-  out->texturesCount = gltf.imagesCount;
-  out->textures = REI_MALLOC (vku::Image, gltf.imagesCount);
-
-  char texturePath[256] {};
-  strcpy (texturePath, relativePath);
-  char* fileName = strrchr (texturePath, '/');
-
-  for (size_t index = 0; index < gltf.imagesCount; ++index) {
-    const auto current = &gltf.images[index];
-
-    strcpy (fileName + 1, current->uri);
-    char* extension = strrchr (texturePath, '.');
-    memcpy (extension + 1, "rtex", 5);
+  for (u32 index = 0; index <= placeholderIndex; ++index) {
+    if (out->textureTickets[index]) continue;
 
-    vku::TextureAllocationInfo allocationInfo;
-    REI_CHECK (assets::readImage (texturePath, &allocationInfo));
-
-    vku::allocateTexture (device, allocator, &allocationInfo, transferContext, &out->textures[index]);
-    free (allocationInfo.pixels);
+    vku::uploadTexture (&uploads, &out->images[index], &out->textures[index]);
+    assets::releaseImage (&out->images[index]);
   }
 
-  out->materialsCount = gltf.materialsCount;
-  const u32 materialsCount = (u32) out->materialsCount;
-  auto materials = REI_MALLOC (Material, materialsCount);
+  vku::submitUploadBatch (&uploads);
 
-  for (size_t i = 0; i < materialsCount; ++i)
-    materials[i].albedoIndex = gltf.materials[i].baseColorTexture;
+  out->materialsCount = mesh.materialsCount;
+  out->pendingMaterialsCount = 0;
+  const u32 materialsCount = (u32) out->materialsCount;
+  const u32 setsCount = materialsCount * REI_FRAMES_COUNT;
+  const u32 allFrames = (1u << REI_FRAMES_COUNT) - 1;
+  auto materials = out->materials = REI_MALLOC (Material, materialsCount);
+
+  for (size_t i = 0; i < materialsCount; ++i) {
+    const u32 albedoImage = mesh.materials[i].albedoImage;
+    materials[i].albedoIndex = albedoImage < mesh.imagesCount ? albedoImage : placeholderIndex;
+    materials[i].boundFrames = out->textureTickets[materials[i].albedoIndex] ? 0 : allFrames;
+    out->pendingMaterialsCount += materials[i].boundFrames != allFrames;
+  }
 
-  assets::gltf::destroy (&gltf);
+  assets::destroyMesh (&mesh);
 
   {
-    VkDescriptorPoolSize poolSize {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, materialsCount};
+    VkDescriptorPoolSize poolSize {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setsCount};
 
     VkDescriptorPoolCreateInfo createInfo;
     createInfo.poolSizeCount = 1;
     createInfo.pPoolSizes = &poolSize;
-    createInfo.maxSets = materialsCount;
+    createInfo.maxSets = setsCount;
     createInfo.sType = DESCRIPTOR_POOL_CREATE_INFO;
 
     createInfo.pNext = nullptr;
@@ -229,8 +314,7 @@ void load (
   {
     VkSamplerCreateInfo createInfo {SAMPLER_CREATE_INFO};
     createInfo.minLod = 0.f;
-    // FIXME Don't hardcode number of mip levels
-    createInfo.maxLod = 11.f;
+    createInfo.maxLod = VK_LOD_CLAMP_NONE;
     createInfo.minFilter = VK_FILTER_LINEAR;
     createInfo.magFilter = VK_FILTER_LINEAR;
     createInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
@@ -241,18 +325,18 @@ void load (
     VKC_CHECK (vkCreateSampler (device, &createInfo, nullptr, &out->sampler));
   }
 
-  auto writes = REI_MALLOC (VkWriteDescriptorSet, materialsCount);
-  auto imageInfos = REI_MALLOC (VkDescriptorImageInfo, materialsCount);
-  out->descriptors = REI_MALLOC (VkDescriptorSet, materialsCount);
+  auto writes = REI_MALLOC (VkWriteDescriptorSet, setsCount);
+  auto imageInfos = REI_MALLOC (VkDescriptorImageInfo, setsCount);
+  out->descriptors = REI_MALLOC (VkDescriptorSet, setsCount);
 
   { // Batch descriptor set allocations
-    auto descriptorLayouts = REI_ALLOCA (VkDescriptorSetLayout, materialsCount);
-    for (u32 i = 0; i < materialsCount; ++i) descriptorLayouts[i] = descriptorLayout;
+    auto descriptorLayouts = REI_ALLOCA (VkDescriptorSetLayout, setsCount);
+    for (u32 i = 0; i < setsCount; ++i) descriptorLayouts[i] = descriptorLayout;
 
     VkDescriptorSetAllocateInfo allocationInfo;
     allocationInfo.pNext = nullptr;
     allocationInfo.pSetLayouts = descriptorLayouts;
-    allocationInfo.descriptorSetCount = materialsCount;
+    allocationInfo.descriptorSetCount = setsCount;
     allocationInfo.descriptorPool = out->descriptorPool;
     allocationInfo.sType = DESCRIPTOR_SET_ALLOCATE_INFO;
 
@@ -260,12 +344,14 @@ void load (
   }
 
   // Batch all descriptor writes to make a single vkUpdateDescriptorSets call.
-  for (size_t index = 0; index < materialsCount; ++index) {
-    auto current = &materials[index];
+  // Materials whose textures are still streaming sample the placeholder.
+  for (size_t index = 0; index < setsCount; ++index) {
+    auto current = &materials[index % materialsCount];
+    const u32 textureIndex = current->boundFrames ? current->albedoIndex : placeholderIndex;
 
     auto albedoInfo = &imageInfos[index];
     albedoInfo->sampler = out->sampler;
-    albedoInfo->imageView = out->textures[current->albedoIndex].view;
+    albedoInfo->imageView = out->textures[textureIndex].view;
     albedoInfo->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
     auto write = &writes[index];
@@ -282,46 +368,355 @@ void load (
     write->pTexelBufferView = nullptr;
   }
 
-  vkUpdateDescriptorSets (device, materialsCount, writes, 0, nullptr);
+  vkUpdateDescriptorSets (device, setsCount, writes, 0, nullptr);
   free (writes);
-  free (materials);
   free (imageInfos);
 }
 
 void destroy (VkDevice device, VmaAllocator allocator, Model* model) {
   vmaDestroyBuffer (allocator, model->indexBuffer.handle, model->indexBuffer.allocation);
   vmaDestroyBuffer (allocator, model->vertexBuffer.handle, model->vertexBuffer.allocation);
+  vmaDestroyBuffer (allocator, model->instanceBuffer.handle, model->instanceBuffer.allocation);
 
   vkDestroySampler (device, model->sampler, nullptr);
 
   vkDestroyDescriptorPool (device, model->descriptorPool, nullptr);
   free (model->descriptors);
+  free (model->materials);
 
   for (size_t index = 0; index < model->texturesCount; ++index) {
     auto current = &model->textures[index];
     vkDestroyImageView (device, current->view, nullptr);
     vmaDestroyImage (allocator, current->handle, current->allocation);
+
+    // Images of textures that were never acquired are still mapped
+    if (model->textureTickets[index]) assets::releaseImage (&model->images[index]);
   }
 
+  free (model->textureTickets);
+  free (model->images);
   free (model->textures);
+  free (model->groups);
+  free (model->instances);
+  free (model->lods);
+  free (model->meshlets);
   free (model->batches);
 }
 
-void Model::draw (VkCommandBuffer cmdBuffer, VkPipelineLayout layout, const math::Mat4* viewProjection) {
-  VkDeviceSize offset = 0;
-  vkCmdBindVertexBuffers (cmdBuffer, 0, 1, &vertexBuffer.handle, &offset);
-  vkCmdBindIndexBuffer (cmdBuffer, indexBuffer.handle, 0, VK_INDEX_TYPE_UINT32);
+static void getRow (const math::Mat4* matrix, u32 row, math::Vec4* out) {
+  const f32* columns[4] = {&matrix->rows[0].x, &matrix->rows[1].x, &matrix->rows[2].x, &matrix->rows[3].x};
 
-  math::Mat4 matrices[2];
-  math::mat4::mul (viewProjection, &modelMatrix, &matrices[0]);
-  matrices[1] = modelMatrix;
-  vkCmdPushConstants (cmdBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof (math::Mat4) * 2, matrices);
+  out->x = columns[0][row];
+  out->y = columns[1][row];
+  out->z = columns[2][row];
+  out->w = columns[3][row];
+}
 
-  for (size_t index = 0; index < materialsCount; ++index) {
-    const auto current = &batches[index];
+// Planes of the frustum in the space that the matrix transforms from (Gribb and Hartmann),
+// points inside of the frustum are in front of every plane.
+static void extractFrustum (const math::Mat4* matrix, math::Vec4* planes) {
+  math::Vec4 rows[4];
+  for (u32 row = 0; row < 4; ++row) getRow (matrix, row, &rows[row]);
+
+  for (u32 plane = 0; plane < 6; ++plane) {
+    const math::Vec4* row = &rows[plane / 2];
+    const f32 sign = plane % 2 ? -1.f : 1.f;
+
+    auto current = &planes[plane];
+    current->x = rows[3].x + sign * row->x;
+    current->y = rows[3].y + sign * row->y;
+    current->z = rows[3].z + sign * row->z;
+    current->w = rows[3].w + sign * row->w;
+
+    f32 length = sqrtf (current->x * current->x + current->y * current->y + current->z * current->z);
+    if (length > 0.f) math::vec4::mulScalar (current, 1.f / length, current);
+  }
+}
+
+// Camera is the point that the matrix projects to x = y = w = 0, returns false for orthographic projections
+static b8 extractCameraPosition (const math::Mat4* matrix, math::Vec3* out) {
+  math::Vec4 x, y, w;
+  getRow (matrix, 0, &x);
+  getRow (matrix, 1, &y);
+  getRow (matrix, 3, &w);
+
+  // Cramer's rule
+  const f32 determinant =
+    x.x * (y.y * w.z - y.z * w.y) -
+    x.y * (y.x * w.z - y.z * w.x) +
+    x.z * (y.x * w.y - y.y * w.x);
+
+  if (REI_ABS (determinant) < 1e-12f) return REI_FALSE;
+
+  out->x = -(x.w * (y.y * w.z - y.z * w.y) - x.y * (y.w * w.z - y.z * w.w) + x.z * (y.w * w.y - y.y * w.w)) / determinant;
+  out->y = -(x.x * (y.w * w.z - y.z * w.w) - x.w * (y.x * w.z - y.z * w.x) + x.z * (y.x * w.w - y.w * w.x)) / determinant;
+  out->z = -(x.x * (y.y * w.w - y.w * w.y) - x.y * (y.x * w.w - y.w * w.x) + x.w * (y.x * w.y - y.y * w.x)) / determinant;
+
+  return REI_TRUE;
+}
+
+static b8 isSphereVisible (const f32* center, f32 radius, const math::Vec4* planes) {
+  for (u32 plane = 0; plane < 6; ++plane) {
+    const auto current = &planes[plane];
+    f32 distance = current->x * center[0] + current->y * center[1] + current->z * center[2];
+    if (distance + current->w < -radius) return REI_FALSE;
+  }
+
+  return REI_TRUE;
+}
+
+static b8 isMeshletVisible (const assets::Meshlet* meshlet, const math::Vec4* planes, const math::Vec3* camera) {
+  if (!isSphereVisible (meshlet->center, meshlet->radius, planes)) return REI_FALSE;
+  if (!camera) return REI_TRUE;
+
+  math::Vec3 offset {
+    meshlet->center[0] - camera->x,
+    meshlet->center[1] - camera->y,
+    meshlet->center[2] - camera->z
+  };
+
+  math::Vec3 axis {meshlet->coneAxis[0], meshlet->coneAxis[1], meshlet->coneAxis[2]};
+  const f32 distance = sqrtf (math::vec3::dot (&offset, &offset));
+
+  return math::vec3::dot (&offset, &axis) <= meshlet->coneCutoff * distance + meshlet->radius;
+}
+
+// Count of the levels of detail of the batch whose error is small enough at the distance of its projected
+// bounding sphere, the last of them is drawn. Depth is the w of the center of the sphere, its radius and
+// the scales of the projection are in the same space. The camera being inside of the sphere always gets
+// the original batch.
+static u32 countLods (const Model* model, const Batch* batch, f32 depth, f32 radius, f32 projectionScale, f32 depthScale) {
+  if (depth <= radius * depthScale) return 0;
+
+  const f32 projectedRadius = radius * projectionScale / depth;
+  u32 level = 0;
+
+  for (; level < batch->lodsCount; ++level) {
+    const auto lod = &model->lods[batch->firstLod + level];
+    if (batch->radius > 0.f && lod->error / batch->radius * projectedRadius > REI_LOD_MAX_SCREEN_ERROR) break;
+  }
+
+  return level;
+}
+
+// Draws the batches of a single instance, culling and levels of detail are computed in its mesh space
+static void drawInstance (
+  const Model* model,
+  VkCommandBuffer cmdBuffer,
+  VkPipelineLayout layout,
+  const VkDescriptorSet* descriptors,
+  const math::Mat4* viewProjection,
+  const InstanceGroup* group) {
+
+  const auto instance = &model->instances[group->firstInstance];
+
+  // Meshlets are culled in mesh space, so that their bounds don't have to be transformed
+  alignas (16) math::Mat4 meshViewProjection;
+  math::mat4::mul (viewProjection, &instance->meshMatrix, &meshViewProjection);
+
+  math::Vec4 planes[6];
+  extractFrustum (&meshViewProjection, planes);
+
+  math::Vec3 camera;
+  b8 hasCamera = extractCameraPosition (&meshViewProjection, &camera);
+
+  // Length of the y row is the focal length times the scale of the mesh, dividing it by the depth (w)
+  // of a point gives the size of a unit of mesh space in normalized device coordinates at that point.
+  math::Vec4 yRow, wRow;
+  getRow (&meshViewProjection, 1, &yRow);
+  getRow (&meshViewProjection, 3, &wRow);
+
+  const f32 projectionScale = sqrtf (yRow.x * yRow.x + yRow.y * yRow.y + yRow.z * yRow.z);
+  const f32 depthScale = sqrtf (wRow.x * wRow.x + wRow.y * wRow.y + wRow.z * wRow.z);
+
+  for (u32 index = group->firstBatch; index < group->firstBatch + group->batchesCount; ++index) {
+    const auto current = &model->batches[index];
+    if (!isSphereVisible (current->center, current->radius, planes)) continue;
 
     VKC_BIND_DESCRIPTORS (cmdBuffer, layout, 1, &descriptors[current->materialIndex]);
-    vkCmdDrawIndexed (cmdBuffer, current->indexCount, 1, current->firstIndex, 0, 0);
+    vkCmdBindIndexBuffer (cmdBuffer, model->indexBuffer.handle, current->indexOffset, current->indexType);
+
+    const f32 depth = wRow.x * current->center[0] + wRow.y * current->center[1] + wRow.z * current->center[2] + wRow.w;
+    const u32 lodsCount = countLods (model, current, depth, current->radius, projectionScale, depthScale);
+
+    if (lodsCount) {
+      const auto lod = &model->lods[current->firstLod + lodsCount - 1];
+      vkCmdDrawIndexed (cmdBuffer, lod->indexCount, 1, lod->firstIndex, current->vertexOffset, group->firstInstance);
+      continue;
+    }
+
+    // Meshlets are contiguous in the index buffer, so visible neighbours are merged into a single draw
+    u32 firstIndex = 0, indexCount = 0;
+
+    for (u32 offset = 0; offset < current->meshletsCount; ++offset) {
+      const auto meshlet = &model->meshlets[current->firstMeshlet + offset];
+      if (!isMeshletVisible (meshlet, planes, hasCamera ? &camera : nullptr)) continue;
+
+      if (indexCount && firstIndex + indexCount == meshlet->firstIndex) {
+        indexCount += meshlet->indexCount;
+        continue;
+      }
+
+      if (indexCount) vkCmdDrawIndexed (cmdBuffer, indexCount, 1, firstIndex, current->vertexOffset, group->firstInstance);
+
+      firstIndex = meshlet->firstIndex;
+      indexCount = meshlet->indexCount;
+    }
+
+    if (indexCount) vkCmdDrawIndexed (cmdBuffer, indexCount, 1, firstIndex, current->vertexOffset, group->firstInstance);
+  }
+}
+
+// Draws a run of instances of a batch with its original indices or the ones of a level of detail
+static void drawInstances (
+  VkCommandBuffer cmdBuffer,
+  const Model* model,
+  const Batch* batch,
+  u32 lodsCount,
+  u32 firstInstance,
+  u32 instancesCount) {
+
+  if (!lodsCount) {
+    vkCmdDrawIndexed (cmdBuffer, batch->indexCount, instancesCount, 0, batch->vertexOffset, firstInstance);
+    return;
+  }
+
+  const auto lod = &model->lods[batch->firstLod + lodsCount - 1];
+  vkCmdDrawIndexed (cmdBuffer, lod->indexCount, instancesCount, lod->firstIndex, batch->vertexOffset, firstInstance);
+}
+
+// Draws the batches of a group of instances, every run of consecutive instances that see a batch is a single
+// instanced draw at the finest level of detail that any of them picks. Culling is done in world space against
+// the bounding spheres of the batches, meshlets aren't culled since their cones differ for every instance.
+static void drawInstanceGroup (
+  const Model* model,
+  VkCommandBuffer cmdBuffer,
+  VkPipelineLayout layout,
+  const VkDescriptorSet* descriptors,
+  const math::Mat4* viewProjection,
+  const math::Vec4* planes,
+  const InstanceGroup* group) {
+
+  math::Vec4 yRow, wRow;
+  getRow (viewProjection, 1, &yRow);
+  getRow (viewProjection, 3, &wRow);
+
+  const f32 projectionScale = sqrtf (yRow.x * yRow.x + yRow.y * yRow.y + yRow.z * yRow.z);
+  const f32 depthScale = sqrtf (wRow.x * wRow.x + wRow.y * wRow.y + wRow.z * wRow.z);
+
+  for (u32 index = group->firstBatch; index < group->firstBatch + group->batchesCount; ++index) {
+    const auto current = &model->batches[index];
+    b8 isBound = REI_FALSE;
+
+    u32 firstInstance = 0, instancesCount = 0, lodsCount = 0;
+
+    for (u32 offset = 0; offset < group->instancesCount; ++offset) {
+      const u32 instanceIndex = group->firstInstance + offset;
+      const auto instance = &model->instances[instanceIndex];
+      const auto matrix = &instance->meshMatrix;
+      const f32* columns[4] = {&matrix->rows[0].x, &matrix->rows[1].x, &matrix->rows[2].x, &matrix->rows[3].x};
+
+      f32 center[3];
+      for (u32 axis = 0; axis < 3; ++axis) {
+        center[axis] =
+          columns[0][axis] * current->center[0] +
+          columns[1][axis] * current->center[1] +
+          columns[2][axis] * current->center[2] +
+          columns[3][axis];
+      }
+
+      const f32 radius = current->radius * instance->scale;
+
+      if (!isSphereVisible (center, radius, planes)) {
+        if (instancesCount) drawInstances (cmdBuffer, model, current, lodsCount, firstInstance, instancesCount);
+        instancesCount = 0;
+        continue;
+      }
+
+      if (!isBound) {
+        VKC_BIND_DESCRIPTORS (cmdBuffer, layout, 1, &descriptors[current->materialIndex]);
+        vkCmdBindIndexBuffer (cmdBuffer, model->indexBuffer.handle, current->indexOffset, current->indexType);
+        isBound = REI_TRUE;
+      }
+
+      const f32 depth = wRow.x * center[0] + wRow.y * center[1] + wRow.z * center[2] + wRow.w;
+      const u32 instanceLods = countLods (model, current, depth, radius, projectionScale, depthScale);
+
+      if (!instancesCount) {
+        firstInstance = instanceIndex;
+        lodsCount = instanceLods;
+      }
+
+      lodsCount = REI_MIN (lodsCount, instanceLods);
+      ++instancesCount;
+    }
+
+    if (instancesCount) drawInstances (cmdBuffer, model, current, lodsCount, firstInstance, instancesCount);
+  }
+}
+
+void Model::update (VkDevice device, const uploads::Manager* uploadManager, u32 frameIndex) {
+  if (!pendingMaterialsCount) return;
+
+  // Mappings can go as soon as the upload is complete
+  for (size_t index = 0; index < texturesCount; ++index) {
+    if (!textureTickets[index] || !uploads::isComplete (uploadManager, textureTickets[index])) continue;
+
+    assets::releaseImage (&images[index]);
+    textureTickets[index] = 0;
+  }
+
+  const u32 frame = 1u << frameIndex;
+  const u32 allFrames = (1u << REI_FRAMES_COUNT) - 1;
+
+  auto writes = REI_ALLOCA (VkWriteDescriptorSet, pendingMaterialsCount);
+  auto imageInfos = REI_ALLOCA (VkDescriptorImageInfo, pendingMaterialsCount);
+  u32 writesCount = 0;
+
+  for (size_t index = 0; index < materialsCount; ++index) {
+    auto current = &materials[index];
+    if ((current->boundFrames & frame) || textureTickets[current->albedoIndex]) continue;
+
+    auto albedoInfo = &imageInfos[writesCount];
+    albedoInfo->sampler = sampler;
+    albedoInfo->imageView = textures[current->albedoIndex].view;
+    albedoInfo->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    auto write = &writes[writesCount++];
+    *write = {WRITE_DESCRIPTOR_SET};
+    write->dstBinding = 0;
+    write->descriptorCount = 1;
+    write->pImageInfo = albedoInfo;
+    write->dstSet = descriptors[frameIndex * materialsCount + index];
+    write->descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+    current->boundFrames |= frame;
+    pendingMaterialsCount -= current->boundFrames == allFrames;
+  }
+
+  if (writesCount) vkUpdateDescriptorSets (device, writesCount, writes, 0, nullptr);
+}
+
+void Model::draw (VkCommandBuffer cmdBuffer, VkPipelineLayout layout, const math::Mat4* viewProjection, u32 frameIndex) {
+  const VkDescriptorSet* frameDescriptors = &descriptors[frameIndex * materialsCount];
+  const VkBuffer buffers[2] {vertexBuffer.handle, instanceBuffer.handle};
+  const VkDeviceSize offsets[2] {0, 0};
+  vkCmdBindVertexBuffers (cmdBuffer, 0, 2, buffers, offsets);
+
+  // Model matrices come from the instance buffer
+  vkCmdPushConstants (cmdBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof (math::Mat4), viewProjection);
+
+  math::Vec4 planes[6];
+  extractFrustum (viewProjection, planes);
+
+  for (size_t index = 0; index < groupsCount; ++index) {
+    const auto group = &groups[index];
+
+    if (group->instancesCount == 1) {
+      drawInstance (this, cmdBuffer, layout, frameDescriptors, viewProjection, group);
+    } else {
+      drawInstanceGroup (this, cmdBuffer, layout, frameDescriptors, viewProjection, planes, group);
+    }
   }
 }
 
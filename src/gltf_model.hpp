@@ -1,52 +1,127 @@
 #ifndef GLTF_MODEL_HPP
 #define GLTF_MODEL_HPP
 
+#include "mesh.hpp"
 #include "vkutils.hpp"
 #include "rei_math_types.hpp"
 
+// Largest error of a simplified batch that is allowed on the screen, in normalized device
+// coordinates (the viewport is 2 units high, so this is about a pixel at 1080p).
+#ifndef REI_LOD_MAX_SCREEN_ERROR
+#  define REI_LOD_MAX_SCREEN_ERROR 0.002f
+#endif
+
+namespace rei::uploads {
+struct Manager;
+}
+
 namespace rei::gltf {
 
 struct Material {
-  size_t albedoIndex;
+  u32 albedoIndex;
+  // Bit for every frame in flight whose descriptor set already samples the albedo texture
+  u32 boundFrames;
 };
 
 // This is used to group multiple primitives with the same material
 struct Batch {
-  u32 firstIndex;
+  // Byte offset of the indices of the batch and its levels of detail in the index buffer,
+  // meshlets and levels of detail index from there.
+  u32 indexOffset;
   u32 indexCount;
+  // Indices are relative to the first vertex of the batch, so that most of them fit into 16 bits
+  i32 vertexOffset;
+  VkIndexType indexType;
   u32 materialIndex;
+  u32 firstMeshlet;
+  u32 meshletsCount;
+  u32 firstLod;
+  u32 lodsCount;
+
+  // Bounding sphere in mesh space
+  f32 center[3];
+  f32 radius;
+};
+
+// Node of the scene that draws a range of batches, its model matrix is in the instance buffer
+struct Instance {
+  // Same as the model matrix, but without the dequantization of positions, meshlet bounds are in this space
+  math::Mat4 meshMatrix;
+  // Largest scale of the mesh matrix, bounding spheres grow by it in world space
+  f32 scale;
+};
+
+// Instances of the same mesh, they are drawn together with instanced draws
+struct InstanceGroup {
+  u32 firstInstance;
+  u32 instancesCount;
+  u32 firstBatch;
+  u32 batchesCount;
 };
 
 struct Model {
   VkSampler sampler;
   VkDescriptorPool descriptorPool;
+  // Sets of every frame in flight follow each other, so that the set of a frame can point to a streamed
+  // texture while other frames still draw with the placeholder
   VkDescriptorSet* descriptors;
 
-  // Count of descriptors and batches
+  Material* materials;
   size_t materialsCount;
+  // Count of materials whose sets don't sample their albedo texture in every frame yet
+  size_t pendingMaterialsCount;
 
   Batch* batches;
+  size_t batchesCount;
+
+  // Culled against the frustum and their normal cones every time the model is drawn
+  assets::Meshlet* meshlets;
+  size_t meshletsCount;
+
+  // Simplified versions of batches, picked by how large their error is on the screen
+  assets::MeshLod* lods;
+  size_t lodsCount;
 
+  // Images of the mesh followed by a white placeholder for materials without a base color texture
   vku::Image* textures;
   size_t texturesCount;
+  // Sources of the textures, the ones that are streamed stay mapped until their upload completes
+  vku::TextureAllocationInfo* images;
+  // Upload of every texture that is streamed by the upload manager, 0 once the texture can be sampled
+  u64* textureTickets;
+
+  // Instances of a group are contiguous, in the same order as their model matrices in the instance buffer
+  Instance* instances;
+  size_t instancesCount;
+
+  InstanceGroup* groups;
+  size_t groupsCount;
 
   vku::Buffer vertexBuffer;
   vku::Buffer indexBuffer;
+  // Model matrices, bound as the per instance vertex stream
+  vku::Buffer instanceBuffer;
 
-  math::Mat4 modelMatrix;
-
-  void draw (VkCommandBuffer cmdBuffer, VkPipelineLayout layout, const math::Mat4* viewProjection);
+  // Points the sets of the frame to textures that finished streaming, the frame must not be in flight.
+  // Has to be called after the uploads were acquired into the command buffer that draws the frame.
+  void update (VkDevice device, const uploads::Manager* uploadManager, u32 frameIndex);
+  void draw (VkCommandBuffer cmdBuffer, VkPipelineLayout layout, const math::Mat4* viewProjection, u32 frameIndex);
 };
 
+// Geometry is uploaded before this returns. Textures are streamed by the upload manager if it isn't null,
+// materials sample the placeholder until theirs are uploaded. The pack has to stay open until then.
 void load (
   VkDevice device,
   VmaAllocator allocator,
   const vku::TransferContext* transferContext,
+  uploads::Manager* uploadManager,
   VkDescriptorSetLayout descriptorLayout,
   const char* relativePath,
+  const assets::Pack* pack,
   Model* out
 );
 
+// Upload manager has to be destroyed first, so that no texture is being streamed
 void destroy (VkDevice device, VmaAllocator allocator, Model* model);
 
 }
@@ -0,0 +1,191 @@
+#include <unistd.h>
+
+#include "job_pool.hpp"
+
+namespace rei::jobs {
+
+static_assert (!(REI_JOBS_QUEUE_CAPACITY & (REI_JOBS_QUEUE_CAPACITY - 1)), "Queue capacity must be a power of two");
+
+// Worker that is executing on the current thread (nullptr for the thread that owns the pool)
+static thread_local Worker* currentWorker = nullptr;
+
+static void push (Queue* queue, const Job* job) {
+  i64 bottom = __atomic_load_n (&queue->bottom, __ATOMIC_RELAXED);
+  i64 top = __atomic_load_n (&queue->top, __ATOMIC_ACQUIRE);
+  REI_ASSERT (bottom - top < (i64) REI_JOBS_QUEUE_CAPACITY);
+
+  queue->jobs[bottom & (REI_JOBS_QUEUE_CAPACITY - 1)] = *job;
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  __atomic_store_n (&queue->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+static b8 pop (Queue* queue, Job* out) {
+  i64 bottom = __atomic_load_n (&queue->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n (&queue->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  i64 top = __atomic_load_n (&queue->top, __ATOMIC_RELAXED);
+
+  if (top > bottom) {
+    // Queue is empty
+    __atomic_store_n (&queue->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return REI_FALSE;
+  }
+
+  *out = queue->jobs[bottom & (REI_JOBS_QUEUE_CAPACITY - 1)];
+  if (top != bottom) return REI_TRUE;
+
+  // This is the last job in the queue, race thieves for it
+  b8 won = __atomic_compare_exchange_n (&queue->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  __atomic_store_n (&queue->bottom, bottom + 1, __ATOMIC_RELAXED);
+  return won;
+}
+
+static b8 steal (Queue* queue, Job* out) {
+  i64 top = __atomic_load_n (&queue->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  i64 bottom = __atomic_load_n (&queue->bottom, __ATOMIC_ACQUIRE);
+
+  if (top >= bottom) return REI_FALSE;
+
+  Job job = queue->jobs[top & (REI_JOBS_QUEUE_CAPACITY - 1)];
+  if (!__atomic_compare_exchange_n (&queue->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return REI_FALSE;
+
+  *out = job;
+  return REI_TRUE;
+}
+
+static b8 findJob (Pool* pool, u32 queueIndex, u32* seed, Job* out) {
+  if (pop (&pool->queues[queueIndex], out)) return REI_TRUE;
+
+  // Start from a random victim so that thieves don't all hammer the same queue
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 17;
+  *seed ^= *seed << 5;
+
+  for (u32 offset = 0; offset < pool->queuesCount; ++offset) {
+    u32 victim = (*seed + offset) % pool->queuesCount;
+    if (victim != queueIndex && steal (&pool->queues[victim], out)) return REI_TRUE;
+  }
+
+  return REI_FALSE;
+}
+
+static void runJob (Pool* pool, const Job* job) {
+  __atomic_sub_fetch (&pool->queuedCount, 1, __ATOMIC_SEQ_CST);
+  job->function (job->data);
+  __atomic_sub_fetch (&pool->pendingCount, 1, __ATOMIC_RELEASE);
+}
+
+static void* workerMain (void* argument) {
+  auto worker = (Worker*) argument;
+  auto pool = worker->pool;
+  currentWorker = worker;
+
+  for (;;) {
+    Job job;
+    if (findJob (pool, worker->index, &worker->seed, &job)) {
+      runJob (pool, &job);
+      continue;
+    }
+
+    // Nothing to do, go to sleep until somebody submits new work
+    pthread_mutex_lock (&pool->mutex);
+    __atomic_add_fetch (&pool->sleepingCount, 1, __ATOMIC_SEQ_CST);
+
+    while (pool->running && !__atomic_load_n (&pool->queuedCount, __ATOMIC_SEQ_CST))
+      pthread_cond_wait (&pool->wakeCondition, &pool->mutex);
+
+    __atomic_sub_fetch (&pool->sleepingCount, 1, __ATOMIC_SEQ_CST);
+    b32 running = pool->running;
+    pthread_mutex_unlock (&pool->mutex);
+
+    if (!running) break;
+  }
+
+  return nullptr;
+}
+
+u32 countHardwareThreads () noexcept {
+  i64 count = sysconf (_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (u32) count : 1u;
+}
+
+void createPool (u32 workersCount, Pool* out) {
+  if (!workersCount) workersCount = countHardwareThreads () - 1;
+
+  out->workersCount = workersCount;
+  out->queuesCount = workersCount + 1;
+  out->pendingCount = out->queuedCount = out->sleepingCount = 0;
+  out->running = REI_TRUE;
+
+  out->queues = (Queue*) aligned_alloc (alignof (Queue), sizeof (Queue) * out->queuesCount);
+  out->workers = REI_MALLOC (Worker, out->queuesCount);
+
+  pthread_mutex_init (&out->mutex, nullptr);
+  pthread_cond_init (&out->wakeCondition, nullptr);
+
+  for (u32 index = 0; index < out->queuesCount; ++index) {
+    out->queues[index].top = out->queues[index].bottom = 0;
+
+    auto worker = &out->workers[index];
+    worker->pool = out;
+    worker->index = index;
+    worker->queue = &out->queues[index];
+    worker->seed = 0x9E3779B9u * (index + 1);
+  }
+
+  // Worker 0 describes the calling thread, so don't spawn anything for it
+  for (u32 index = 1; index < out->queuesCount; ++index) {
+    auto worker = &out->workers[index];
+    pthread_create (&worker->thread, nullptr, workerMain, worker);
+  }
+}
+
+void destroyPool (Pool* pool) {
+  wait (pool);
+
+  pthread_mutex_lock (&pool->mutex);
+  pool->running = REI_FALSE;
+  pthread_cond_broadcast (&pool->wakeCondition);
+  pthread_mutex_unlock (&pool->mutex);
+
+  for (u32 index = 1; index < pool->queuesCount; ++index)
+    pthread_join (pool->workers[index].thread, nullptr);
+
+  pthread_cond_destroy (&pool->wakeCondition);
+  pthread_mutex_destroy (&pool->mutex);
+
+  free (pool->workers);
+  free (pool->queues);
+}
+
+void submit (Pool* pool, PFN_job function, void* data) {
+  Job job {function, data};
+  auto queue = (currentWorker && currentWorker->pool == pool) ? currentWorker->queue : &pool->queues[0];
+
+  __atomic_add_fetch (&pool->pendingCount, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&pool->queuedCount, 1, __ATOMIC_SEQ_CST);
+  push (queue, &job);
+
+  if (__atomic_load_n (&pool->sleepingCount, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock (&pool->mutex);
+    pthread_cond_signal (&pool->wakeCondition);
+    pthread_mutex_unlock (&pool->mutex);
+  }
+}
+
+void wait (Pool* pool) {
+  auto worker = &pool->workers[0];
+
+  while (__atomic_load_n (&pool->pendingCount, __ATOMIC_ACQUIRE)) {
+    Job job;
+    if (findJob (pool, worker->index, &worker->seed, &job)) {
+      runJob (pool, &job);
+    } else {
+      _mm_pause ();
+    }
+  }
+}
+
+}
@@ -0,0 +1,84 @@
+#ifndef JOB_POOL_HPP
+#define JOB_POOL_HPP
+
+#include <pthread.h>
+
+#include "common.hpp"
+
+// Maximum count of jobs that can be queued on a single worker at once
+#ifndef REI_JOBS_QUEUE_CAPACITY
+#  define REI_JOBS_QUEUE_CAPACITY 4096u
+#endif
+
+namespace rei::jobs {
+
+typedef void (*PFN_job) (void* data);
+
+struct Job {
+  PFN_job function;
+  void* data;
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+// Chase-Lev work-stealing deque. The owning thread pushes and pops jobs
+// at the bottom (LIFO, so it keeps working on hot data), while idle workers
+// steal from the top (FIFO, so they take the oldest and usually largest jobs).
+// Reference: Le et al. "Correct and Efficient Work-Stealing for Weak Memory Models".
+struct Queue {
+  Job jobs[REI_JOBS_QUEUE_CAPACITY];
+
+  // Keep indices on separate cache lines since they are written by different threads
+  alignas (64) i64 top;
+  alignas (64) i64 bottom;
+};
+
+#pragma GCC diagnostic pop
+
+struct Pool;
+
+struct Worker {
+  Pool* pool;
+  Queue* queue;
+  pthread_t thread;
+
+  u32 index;
+  // State of a xorshift generator used to pick a victim to steal from
+  u32 seed;
+};
+
+// Queue 0 belongs to the thread that created the pool. That thread
+// has to call wait () to make sure all of the submitted jobs have been completed,
+// and it helps with the work while waiting.
+struct Pool {
+  Queue* queues;
+  Worker* workers;
+  u32 workersCount;
+  u32 queuesCount;
+
+  // Jobs that were submitted, but haven't finished yet
+  u32 pendingCount;
+  // Jobs that are sitting in the queues
+  u32 queuedCount;
+  u32 sleepingCount;
+  b32 running;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeCondition;
+};
+
+[[nodiscard]] u32 countHardwareThreads () noexcept;
+
+// Pass 0 as workersCount to spawn one worker per hardware thread (minus the calling one)
+void createPool (u32 workersCount, Pool* out);
+void destroyPool (Pool* pool);
+
+// Jobs can be submitted either by the thread that created the pool, or by a running job.
+// Only the thread that created the pool is allowed to wait for their completion.
+void submit (Pool* pool, PFN_job function, void* data);
+void wait (Pool* pool);
+
+}
+
+#endif /* JOB_POOL_HPP */
@@ -3,7 +3,10 @@
 #include "window.hpp"
 #include "vkutils.hpp"
 #include "vkcommon.hpp"
+#include "job_pool.hpp"
+#include "asset_pack.hpp"
 #include "gltf_model.hpp"
+#include "upload_manager.hpp"
 #include "rei_math.inl"
 
 #include <xcb/xcb.h>
@@ -11,6 +14,7 @@
 #include <VulkanMemoryAllocator/include/vk_mem_alloc.h>
 
 #define REI_GB_ATTACHMENT_COUNT 3u
+#define REI_UPLOAD_STAGING_SIZE (64ull << 20)
 
 struct Frame {
   VkCommandPool commandPool;
@@ -278,7 +282,7 @@ static void createGBuffer (VkDevice device, VmaAllocator allocator, const GBuffe
   {
     VkPushConstantRange pushConstant;
     pushConstant.offset = 0;
-    pushConstant.size = sizeof (rei::math::Mat4) * 2;
+    pushConstant.size = sizeof (rei::math::Mat4);
     pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     VkPipelineLayoutCreateInfo info;
@@ -300,33 +304,54 @@ static void createGBuffer (VkDevice device, VmaAllocator allocator, const GBuffe
   }
 
   {
-    VkVertexInputBindingDescription binding;
-    binding.binding = 0;
-    binding.stride = sizeof (rei::Vertex);
-    binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    // Model matrices of instances are a second stream, advanced once per instance
+    VkVertexInputBindingDescription bindings[2];
+    bindings[0].binding = 0;
+    bindings[0].stride = sizeof (rei::GpuVertex);
+    bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-    VkVertexInputAttributeDescription attributes[3];
+    bindings[1].binding = 1;
+    bindings[1].stride = sizeof (rei::math::Mat4);
+    bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    VkVertexInputAttributeDescription attributes[7];
     attributes[0].location = 0;
-    attributes[0].binding = binding.binding;
-    attributes[0].offset = REI_OFFSET_OF (rei::Vertex, x);
-    attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributes[0].binding = bindings[0].binding;
+    attributes[0].offset = REI_OFFSET_OF (rei::GpuVertex, x);
 
     attributes[1].location = 1;
-    attributes[1].binding = binding.binding;
-    attributes[1].offset = REI_OFFSET_OF (rei::Vertex, nx);
-    attributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributes[1].binding = bindings[0].binding;
+    attributes[1].offset = REI_OFFSET_OF (rei::GpuVertex, nx);
 
     attributes[2].location = 2;
-    attributes[2].binding = binding.binding;
+    attributes[2].binding = bindings[0].binding;
+    attributes[2].offset = REI_OFFSET_OF (rei::GpuVertex, u);
+
+    // A matrix takes a location for every column
+    for (u32 column = 0; column < 4; ++column) {
+      auto attribute = &attributes[3 + column];
+      attribute->location = 3 + column;
+      attribute->binding = bindings[1].binding;
+      attribute->format = VK_FORMAT_R32G32B32A32_SFLOAT;
+      attribute->offset = (u32) sizeof (rei::math::Vec4) * column;
+    }
+
+#if REI_PACKED_VERTICES
+    attributes[0].format = VK_FORMAT_R16G16B16A16_SNORM;
+    attributes[1].format = VK_FORMAT_R16G16_SNORM;
+    attributes[2].format = VK_FORMAT_R16G16_SFLOAT;
+#else
+    attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
     attributes[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributes[2].offset = REI_OFFSET_OF (rei::Vertex, u);
+#endif
 
     VkPipelineVertexInputStateCreateInfo vertexInputState;
     vertexInputState.pNext = nullptr;
     vertexInputState.flags = VKC_NO_FLAGS;
-    vertexInputState.vertexBindingDescriptionCount = 1;
-    vertexInputState.vertexAttributeDescriptionCount = 3;
-    vertexInputState.pVertexBindingDescriptions = &binding;
+    vertexInputState.vertexBindingDescriptionCount = 2;
+    vertexInputState.vertexAttributeDescriptionCount = 7;
+    vertexInputState.pVertexBindingDescriptions = bindings;
     vertexInputState.pVertexAttributeDescriptions = attributes;
     vertexInputState.sType = PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
@@ -409,7 +434,11 @@ static void createGBuffer (VkDevice device, VmaAllocator allocator, const GBuffe
     info.colorBlendAttachment = colorBlendAttachments;
 
     info.pixelShaderPath = "assets/shaders/deferred_geometry.frag.spv";
+#if REI_PACKED_VERTICES
+    info.vertexShaderPath = "assets/shaders/deferred_geometry_packed.vert.spv";
+#else
     info.vertexShaderPath = "assets/shaders/deferred_geometry.vert.spv";
+#endif
 
     rei::vku::createGraphicsPipeline (device, &info, &out->geometryPass.pipeline);
 
@@ -480,6 +509,11 @@ int main () {
   u32 queueFamilyIndex;
   VkQueue graphicsQueue, presentQueue, computeQueue;
 
+  // Streaming uploads need a queue that no other thread submits to
+  b8 hasUploadQueue;
+  u32 uploadQueueFamily;
+  VkQueue uploadQueue;
+
   VmaAllocator allocator;
 
   rei::vku::Swapchain swapchain;
@@ -494,8 +528,14 @@ int main () {
   GBuffer gbuffer;
 
   rei::imgui::Context imguiContext;
+  rei::jobs::Pool jobPool;
+  rei::vku::FormatSupport formatSupport;
   rei::vku::TransferContext transferContext;
+  rei::uploads::Manager uploadManager;
 
+  // Streamed textures of models point into the pack, so it stays open until they are destroyed
+  rei::assets::Pack pack;
+  b8 packed;
   rei::gltf::Model sponza;
 
   rei::Timer::init ();
@@ -597,44 +637,71 @@ int main () {
     );
 
     {
-      // Make sure that VKC_TEXTURE_FORMAT supports image blitting (which is needed for mipmap generation) on the chosen device
+      // Make sure that VKC_TEXTURE_FORMAT can be sampled with linear filtering on the chosen device
+      // (mipmaps are baked offline, so image blitting is not needed anymore)
       VkFormatProperties formatProperties;
       vkGetPhysicalDeviceFormatProperties (physicalDevice, VKC_TEXTURE_FORMAT, &formatProperties);
 
-      VkFormatFeatureFlags requiredFlags = VK_FORMAT_FEATURE_BLIT_SRC_BIT;
-      requiredFlags |= VK_FORMAT_FEATURE_BLIT_DST_BIT;
+      VkFormatFeatureFlags requiredFlags = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+      requiredFlags |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
 
-      REI_ASSERT (formatProperties.optimalTilingFeatures & requiredFlags);
+      REI_ASSERT ((formatProperties.optimalTilingFeatures & requiredFlags) == requiredFlags);
     }
 
     VkPhysicalDeviceFeatures enabledFeatures {};
 
-    const f32 queuePriority = 1.f;
+    {
+      // Baked textures are block compressed, they are decoded on the CPU if the device can't sample them
+      VkPhysicalDeviceFeatures supportedFeatures;
+      vkGetPhysicalDeviceFeatures (physicalDevice, &supportedFeatures);
+      enabledFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    }
+
+    const f32 queuePriorities[2] {1.f, 1.f};
     // NOTE All required queues have the same index on my device,
     // so I need only one queue create info. Perhaps, I might
     // handle them more appropriately in the future (so that this can work on different devices),
     // but for this will do.
     queueFamilyIndex = indices.graphics;
 
-    VkDeviceQueueCreateInfo queueInfo {DEVICE_QUEUE_CREATE_INFO};
-    queueInfo.queueCount = 1;
-    queueInfo.pQueuePriorities = &queuePriority;
-    queueInfo.queueFamilyIndex = queueFamilyIndex;
+    u32 familiesCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties (physicalDevice, &familiesCount, nullptr);
+
+    auto families = REI_ALLOCA (VkQueueFamilyProperties, familiesCount);
+    vkGetPhysicalDeviceQueueFamilyProperties (physicalDevice, &familiesCount, families);
+
+    // Uploads are streamed on a transfer family if the device has a separate one,
+    // otherwise on a second queue of the graphics family
+    uploadQueueFamily = indices.transfer;
+    const b8 separateFamily = uploadQueueFamily != queueFamilyIndex;
+    hasUploadQueue = separateFamily || families[queueFamilyIndex].queueCount > 1;
+
+    VkDeviceQueueCreateInfo queueInfos[2] {{DEVICE_QUEUE_CREATE_INFO}, {DEVICE_QUEUE_CREATE_INFO}};
+    queueInfos[0].queueCount = (hasUploadQueue && !separateFamily) ? 2 : 1;
+    queueInfos[0].pQueuePriorities = queuePriorities;
+    queueInfos[0].queueFamilyIndex = queueFamilyIndex;
+
+    queueInfos[1].queueCount = 1;
+    queueInfos[1].pQueuePriorities = queuePriorities;
+    queueInfos[1].queueFamilyIndex = uploadQueueFamily;
 
     VkDeviceCreateInfo createInfo {DEVICE_CREATE_INFO};
-    createInfo.queueCreateInfoCount = 1;
-    createInfo.pQueueCreateInfos = &queueInfo;
+    createInfo.queueCreateInfoCount = separateFamily ? 2 : 1;
+    createInfo.pQueueCreateInfos = queueInfos;
     createInfo.pEnabledFeatures = &enabledFeatures;
     createInfo.ppEnabledExtensionNames = requiredExtensions;
     createInfo.enabledExtensionCount = requiredExtensionCount;
 
     VKC_CHECK (vkCreateDevice (physicalDevice, &createInfo, nullptr, &device));
+    rei::vku::queryFormatSupport (physicalDevice, &enabledFeatures, &formatSupport);
+    transferContext.formatSupport = &formatSupport;
 
     rei::vkc::Context::loadDevice (device);
     vkGetDeviceQueue (device, queueFamilyIndex, 0, &presentQueue);
     vkGetDeviceQueue (device, queueFamilyIndex, 0, &computeQueue);
     vkGetDeviceQueue (device, queueFamilyIndex, 0, &graphicsQueue);
     vkGetDeviceQueue (device, queueFamilyIndex, 0, &transferContext.queue);
+    if (hasUploadQueue) vkGetDeviceQueue (device, uploadQueueFamily, separateFamily ? 0 : 1, &uploadQueue);
   }
 
   { // Create allocator
@@ -780,6 +847,22 @@ int main () {
 
     fenceInfo.flags = VKC_NO_FLAGS;
     VKC_CHECK (vkCreateFence (device, &fenceInfo, nullptr, &transferContext.fence));
+
+    rei::jobs::createPool (0, &jobPool);
+    transferContext.jobPool = &jobPool;
+  }
+
+  if (hasUploadQueue) { // Create upload manager, it streams assets while the render loop keeps going
+    rei::uploads::ManagerCreateInfo createInfo;
+    createInfo.queue = uploadQueue;
+    createInfo.queueFamily = uploadQueueFamily;
+    createInfo.ownerFamily = queueFamilyIndex;
+    createInfo.stagingSize = REI_UPLOAD_STAGING_SIZE;
+    createInfo.formatSupport = &formatSupport;
+
+    rei::uploads::createManager (device, allocator, &createInfo, &uploadManager);
+  } else {
+    REI_LOGS_WARN ("Device doesn't have a queue to spare for streaming uploads");
   }
 
   { // Create main descriptor pool
@@ -841,14 +924,28 @@ int main () {
     rei::imgui::create (device, allocator, &createInfo, &imguiContext);
   }
 
-  rei::gltf::load (
-    device,
-    allocator,
-    &transferContext,
-    gbuffer.geometryPass.descriptorLayout,
-    "assets/models/sponza-scene/Sponza.gltf",
-    &sponza
-  );
+  { // Load models, preferring the packed version of assets if there is one
+    packed = rei::assets::openPack ("assets/models/sponza-scene/Sponza.rpak", &pack) == rei::Result::Success;
+
+    #if REI_BENCHMARK_GLTF
+    rei::assets::gltf::benchmark (
+      "assets/models/sponza-scene/Sponza.gltf",
+      packed ? &pack : nullptr,
+      REI_BENCHMARK_GLTF
+    );
+    #endif
+
+    rei::gltf::load (
+      device,
+      allocator,
+      &transferContext,
+      hasUploadQueue ? &uploadManager : nullptr,
+      gbuffer.geometryPass.descriptorLayout,
+      "assets/models/sponza-scene/Sponza.gltf",
+      packed ? &pack : nullptr,
+      &sponza
+    );
+  }
 
   f32 lastTime = 0.f;
   f32 deltaTime = 0.f;
@@ -952,6 +1049,9 @@ int main () {
 
     // Geometry pass of deferred renderer
     VKC_CHECK (vkBeginCommandBuffer (offscreenCmd, &cmdBeginInfo));
+    if (hasUploadQueue) rei::uploads::acquireUploads (&uploadManager, offscreenCmd);
+    sponza.update (device, hasUploadQueue ? &uploadManager : nullptr, frameIndex);
+
     vkCmdBeginRenderPass (offscreenCmd, &offscreenBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
     vkCmdBindPipeline (offscreenCmd, VK_PIPELINE_BIND_POINT_GRAPHICS, gbuffer.geometryPass.pipeline);
 
@@ -963,7 +1063,7 @@ int main () {
 
       rei::math::Mat4 viewProjection;
       rei::math::mat4::mul (&camera.projection, &viewMatrix, &viewProjection);
-      sponza.draw (offscreenCmd, gbuffer.geometryPass.pipelineLayout, &viewProjection);
+      sponza.draw (offscreenCmd, gbuffer.geometryPass.pipelineLayout, &viewProjection, frameIndex);
     }
 
     vkCmdEndRenderPass (offscreenCmd);
@@ -1048,8 +1148,10 @@ RESOURCE_CLEANUP:
 
   // Wait for gpu to finish rendering of the last frame
   vkDeviceWaitIdle (device);
+  if (hasUploadQueue) rei::uploads::destroyManager (&uploadManager);
 
   rei::gltf::destroy (device, allocator, &sponza);
+  if (packed) rei::assets::closePack (&pack);
   rei::imgui::destroy (device, &imguiContext);
   destroyGBuffer (device, allocator, &gbuffer);
 
@@ -1069,6 +1171,7 @@ RESOURCE_CLEANUP:
 
   vkDestroyFence (device, transferContext.fence, nullptr);
   vkDestroyCommandPool (device, transferContext.commandPool, nullptr);
+  rei::jobs::destroyPool (&jobPool);
 
   for (u8 index = 0; index < REI_FRAMES_COUNT; ++index) {
     auto current = &frames[index];
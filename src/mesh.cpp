@@ -0,0 +1,1094 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mesh.hpp"
+#include "job_pool.hpp"
+#include "rei_math.inl"
+#include "asset_pack.hpp"
+#include "mesh_optimizer.hpp"
+
+namespace rei::assets {
+
+// Sort primitives by material index so that it would be easier to merge
+// ones with the same material into batches.
+static void sortPrimitives (gltf::Primitive* primitives, i32 low, i32 high) {
+  if (low >= 0 && high >= 0 && low < high) {
+    i32 pivotIndex = 0;
+    // NOTE The cast of (low + high) to unsigned is made because division of
+    // an unsigned integer by a constant is faster than that of a signed one.
+    // After that, unsigned is cast back into signed, because conversion to f32
+    // is faster with signed integers. Also, casting signed->unsigned and vice versa is free.
+    // Reference: Agner Fog's Optimization Manual 1, page 30 and 40.
+    u32 middle = (u32) floorf ((f32) ((i32) ((u32) (low + high) / 2u)));
+    u32 pivot = primitives[middle].material;
+
+    i32 left = low - 1;
+    i32 right = high + 1;
+
+    for (;;) {
+      do ++left; while (primitives[left].material < pivot);
+      do --right; while (primitives[right].material > pivot);
+
+      if (left >= right) {
+        pivotIndex = right;
+	break;
+      }
+
+      REI_SWAP (&primitives[left], &primitives[right]);
+    }
+
+    sortPrimitives (primitives, low, pivotIndex);
+    sortPrimitives (primitives, pivotIndex + 1, high);
+  }
+}
+
+// Sphere around the center of the bounds of the batch vertices
+static void computeBatchSphere (const Mesh* mesh, MeshBatch* batch) {
+  f32 minimum[3] = {INFINITY, INFINITY, INFINITY};
+  f32 maximum[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+  for (u32 vertex = batch->firstVertex; vertex < batch->firstVertex + batch->vertexCount; ++vertex) {
+    const f32* position = &mesh->vertices[vertex].x;
+
+    for (u32 axis = 0; axis < 3; ++axis) {
+      minimum[axis] = REI_MIN (minimum[axis], position[axis]);
+      maximum[axis] = REI_MAX (maximum[axis], position[axis]);
+    }
+  }
+
+  f32 radiusSquared = 0.f;
+  for (u32 axis = 0; axis < 3; ++axis) batch->center[axis] = (minimum[axis] + maximum[axis]) * .5f;
+
+  for (u32 vertex = batch->firstVertex; vertex < batch->firstVertex + batch->vertexCount; ++vertex) {
+    const f32* position = &mesh->vertices[vertex].x;
+
+    f32 distanceSquared = 0.f;
+    for (u32 axis = 0; axis < 3; ++axis)
+      distanceSquared += (position[axis] - batch->center[axis]) * (position[axis] - batch->center[axis]);
+
+    radiusSquared = REI_MAX (radiusSquared, distanceSquared);
+  }
+
+  batch->radius = sqrtf (radiusSquared);
+}
+
+// Nodes with EXT_mesh_gpu_instancing draw their mesh once for every element of its accessors
+static u32 getNodeInstanceCount (const gltf::Data* gltf, const gltf::Node* node) {
+  if (node->mesh >= gltf->meshesCount) return 0;
+
+  const u32 accessors[] {node->instancing.translation, node->instancing.rotation, node->instancing.scale};
+  u32 count = UINT32_MAX;
+
+  for (u32 index = 0; index < REI_ARRAY_SIZE (accessors); ++index) {
+    if (accessors[index] < gltf->accessorsCount) count = REI_MIN (count, gltf->accessors[accessors[index]].count);
+  }
+
+  return count == UINT32_MAX ? 1 : count;
+}
+
+// Reads at least count elements of an instance transform, missing ones are filled with the identity
+static f32* readInstanceTransforms (const gltf::Data* gltf, u32 accessor, u32 count, u32 components, const f32* identity) {
+  const b8 isValid = accessor < gltf->accessorsCount;
+  const u32 size = isValid ? REI_MAX (count, gltf->accessors[accessor].count) : count;
+  auto out = REI_MALLOC (f32, (size_t) size * components);
+
+  if (isValid) {
+    gltf::readFloats (gltf, &gltf->accessors[accessor], components, out);
+    return out;
+  }
+
+  for (u32 index = 0; index < count; ++index) memcpy (&out[index * components], identity, sizeof (f32) * components);
+  return out;
+}
+
+// One instance for every node with a mesh (or one for every element of its EXT_mesh_gpu_instancing accessors),
+// they share the batches of that mesh. Instances of the same mesh are contiguous, so that they can be drawn together.
+static void buildInstances (const gltf::Data* gltf, const u32* meshBatches, Mesh* out) {
+  // Counting sort of the instances over their meshes
+  auto meshOffsets = REI_MALLOC (u32, gltf->meshesCount + 1);
+  memset (meshOffsets, 0, sizeof (u32) * (gltf->meshesCount + 1));
+
+  for (u32 node = 0; node < gltf->nodesCount; ++node) {
+    const auto current = &gltf->nodes[node];
+    if (current->mesh < gltf->meshesCount) meshOffsets[current->mesh + 1] += getNodeInstanceCount (gltf, current);
+  }
+
+  for (u32 mesh = 0; mesh < gltf->meshesCount; ++mesh) meshOffsets[mesh + 1] += meshOffsets[mesh];
+
+  out->instancesCount = meshOffsets[gltf->meshesCount];
+  out->instances = REI_MALLOC (MeshInstance, out->instancesCount);
+
+  if (!gltf->nodesCount) {
+    free (meshOffsets);
+    return;
+  }
+
+  // Results of mat4::mul are stored with aligned stores
+  auto worldMatrices = (math::Mat4*) aligned_alloc (16, sizeof (math::Mat4) * gltf->nodesCount);
+  gltf::computeWorldMatrices (gltf->nodes, gltf->nodesCount, worldMatrices);
+
+  // Zero translation and the identity quaternion start at the beginning, the unit scale at 4
+  const f32 identity[] {0.f, 0.f, 0.f, 1.f, 1.f, 1.f, 1.f};
+
+  for (u32 node = 0; node < gltf->nodesCount; ++node) {
+    const auto current = &gltf->nodes[node];
+    const u32 count = getNodeInstanceCount (gltf, current);
+    if (!count) continue;
+
+    const u32 firstBatch = meshBatches[current->mesh * 2];
+    const u32 batchesCount = meshBatches[current->mesh * 2 + 1];
+    auto instance = &out->instances[meshOffsets[current->mesh]];
+    meshOffsets[current->mesh] += count;
+
+    if (
+      current->instancing.translation == UINT32_MAX &&
+      current->instancing.rotation == UINT32_MAX &&
+      current->instancing.scale == UINT32_MAX
+    ) {
+      instance->matrix = worldMatrices[node];
+      instance->firstBatch = firstBatch;
+      instance->batchesCount = batchesCount;
+      continue;
+    }
+
+    // Instance transforms are relative to the node
+    f32* translations = readInstanceTransforms (gltf, current->instancing.translation, count, 3, &identity[0]);
+    f32* rotations = readInstanceTransforms (gltf, current->instancing.rotation, count, 4, &identity[0]);
+    f32* scales = readInstanceTransforms (gltf, current->instancing.scale, count, 3, &identity[4]);
+
+    for (u32 index = 0; index < count; ++index, ++instance) {
+      alignas (16) math::Mat4 local {1.f};
+      alignas (16) math::Mat4 matrix;
+
+      math::Vec3 translation {translations[index * 3], translations[index * 3 + 1], translations[index * 3 + 2]};
+      math::Vec4 rotation {rotations[index * 4], rotations[index * 4 + 1], rotations[index * 4 + 2], rotations[index * 4 + 3]};
+      math::Vec3 scale {scales[index * 3], scales[index * 3 + 1], scales[index * 3 + 2]};
+
+      math::mat4::translate (&local, &translation);
+      math::mat4::rotate (&local, &rotation);
+      math::mat4::scale (&local, &scale);
+      math::mat4::mul (&worldMatrices[node], &local, &matrix);
+
+      instance->matrix = matrix;
+      instance->firstBatch = firstBatch;
+      instance->batchesCount = batchesCount;
+    }
+
+    free (translations);
+    free (rotations);
+    free (scales);
+  }
+
+  free (worldMatrices);
+  free (meshOffsets);
+}
+
+static b8 isTriangleMode (gltf::TopologyType mode) noexcept {
+  return mode == gltf::TopologyType::Triangles ||
+    mode == gltf::TopologyType::TriangleStrip ||
+    mode == gltf::TopologyType::TriangleFan;
+}
+
+// Points and lines aren't drawn, so their primitives don't get any vertices
+static u32 getVertexCount (const gltf::Data* gltf, const gltf::Primitive* primitive) {
+  const u32 position = primitive->attributes.position;
+  if (!isTriangleMode (primitive->mode)) return 0;
+  return position < gltf->accessorsCount ? gltf->accessors[position].count : 0;
+}
+
+// Primitives without indices draw their vertices in order
+static u32 getSourceIndexCount (const gltf::Data* gltf, const gltf::Primitive* primitive) {
+  if (!getVertexCount (gltf, primitive)) return 0;
+  if (primitive->indices < gltf->accessorsCount) return gltf->accessors[primitive->indices].count;
+  return getVertexCount (gltf, primitive);
+}
+
+// Strips and fans are converted to lists, incomplete triangles at the end are dropped
+static u32 getIndexCount (const gltf::Data* gltf, const gltf::Primitive* primitive) {
+  const u32 count = getSourceIndexCount (gltf, primitive);
+
+  switch (primitive->mode) {
+    case gltf::TopologyType::Triangles: return count / 3 * 3;
+    case gltf::TopologyType::TriangleFan:
+    case gltf::TopologyType::TriangleStrip: return count >= 3 ? (count - 2) * 3 : 0;
+    default: return 0;
+  }
+}
+
+// Tells whether the indices of the primitive can be read straight into the mesh
+static b8 isTriangleList (const gltf::Data* gltf, const gltf::Primitive* primitive) {
+  return primitive->mode == gltf::TopologyType::Triangles &&
+    getSourceIndexCount (gltf, primitive) == getIndexCount (gltf, primitive);
+}
+
+// Triangles of strips alternate their winding, so that all of them face the same way
+static void triangulate (gltf::TopologyType mode, const u32* indices, u32 indexCount, u32* out) {
+  switch (mode) {
+    case gltf::TopologyType::TriangleStrip: {
+      for (u32 triangle = 0; triangle + 2 < indexCount; ++triangle, out += 3) {
+        const u32 odd = triangle % 2;
+        out[0] = indices[triangle];
+        out[1] = indices[triangle + 1 + odd];
+        out[2] = indices[triangle + 2 - odd];
+      }
+    } break;
+
+    case gltf::TopologyType::TriangleFan: {
+      for (u32 triangle = 0; triangle + 2 < indexCount; ++triangle, out += 3) {
+        out[0] = indices[triangle + 1];
+        out[1] = indices[triangle + 2];
+        out[2] = indices[0];
+      }
+    } break;
+
+    default: {
+      memcpy (out, indices, sizeof (u32) * (indexCount / 3 * 3));
+    } break;
+  }
+}
+
+// Triangles that reference vertices outside of [first, first + count) collapse onto the first vertex,
+// so that nothing reads past the vertices of the primitive. Returns the count of such triangles.
+static u32 collapseInvalidTriangles (u32* indices, u32 indexCount, u32 first, u32 count) {
+  u32 collapsedCount = 0;
+
+  for (u32 index = 0; index < indexCount; index += 3) {
+    u32* triangle = &indices[index];
+    if (triangle[0] - first < count && triangle[1] - first < count && triangle[2] - first < count) continue;
+
+    triangle[0] = triangle[1] = triangle[2] = first;
+    ++collapsedCount;
+  }
+
+  return collapsedCount;
+}
+
+// Missing attributes and ones that don't have an element for every vertex are zeros
+static void readAttribute (const gltf::Data* gltf, u32 accessor, u32 components, u32 vertexCount, f32* out) {
+  if (accessor < gltf->accessorsCount && gltf->accessors[accessor].count == vertexCount) {
+    gltf::readFloats (gltf, &gltf->accessors[accessor], components, out);
+  } else {
+    memset (out, 0, sizeof (f32) * components * vertexCount);
+  }
+}
+
+// Builds whole vertices in registers, two of them fill a cache line. Positions and normals are loaded 4 floats
+// at a time, so both of them have to be followed by at least one more float.
+static void interleaveVertices (const f32* positions, const f32* normals, const f32* uvs, u32 count, Vertex* out) {
+  u32 vertex = 0;
+
+#ifdef __AVX2__
+  for (; vertex < count; ++vertex) {
+    __m128 position = _mm_loadu_ps (&positions[vertex * 3]);
+    __m128 normal = _mm_loadu_ps (&normals[vertex * 3]);
+    __m128 uv = _mm_castpd_ps (_mm_load_sd ((const f64*) &uvs[vertex * 2]));
+
+    // (x, y, z, nx) and (ny, nz, u, v)
+    __m128 low = _mm_blend_ps (position, _mm_shuffle_ps (normal, normal, 0), 8);
+    __m128 high = _mm_shuffle_ps (normal, uv, _MM_SHUFFLE (1, 0, 2, 1));
+
+    _mm256_storeu_ps (&out[vertex].x, _mm256_insertf128_ps (_mm256_castps128_ps256 (low), high, 1));
+  }
+#endif
+
+  for (; vertex < count; ++vertex) {
+    auto newVertex = &out[vertex];
+
+    newVertex->x = positions[vertex * 3];
+    newVertex->y = positions[vertex * 3 + 1];
+    newVertex->z = positions[vertex * 3 + 2];
+    newVertex->nx = normals[vertex * 3];
+    newVertex->ny = normals[vertex * 3 + 1];
+    newVertex->nz = normals[vertex * 3 + 2];
+    newVertex->u = uvs[vertex * 2];
+    newVertex->v = uvs[vertex * 2 + 1];
+  }
+}
+
+static void writeSequentialIndices (u32 base, u32 count, u32* out) {
+  u32 index = 0;
+
+#ifdef __AVX2__
+  const __m256i step = _mm256_set1_epi32 (8);
+  __m256i indices = _mm256_add_epi32 (_mm256_set1_epi32 ((i32) base), _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+
+  for (; index + 8 <= count; index += 8) {
+    _mm256_storeu_si256 ((__m256i*) &out[index], indices);
+    indices = _mm256_add_epi32 (indices, step);
+  }
+#endif
+
+  for (; index < count; ++index) out[index] = base + index;
+}
+
+// Consecutive primitives whose vertices and indices start at the given offsets of the mesh
+struct PrimitivesJob {
+  const gltf::Data* gltf;
+  const gltf::Primitive* primitives;
+  Mesh* mesh;
+  u32 primitivesCount;
+  u32 vertexOffset;
+  u32 indexOffset;
+  u32 maxVertexCount;
+};
+
+static void buildPrimitivesJob (void* data) {
+  auto job = (const PrimitivesJob*) data;
+  const auto gltf = job->gltf;
+
+  // Attributes are decoded into tightly packed floats first, whatever their format is.
+  // Uvs follow the normals and normals follow the positions, so they can be loaded 4 floats at a time.
+  auto positions = REI_MALLOC (f32, (size_t) job->maxVertexCount * 8);
+  f32* normals = positions + (size_t) job->maxVertexCount * 3;
+  f32* uvs = normals + (size_t) job->maxVertexCount * 3;
+
+  u32 vertexOffset = job->vertexOffset, indexOffset = job->indexOffset;
+
+  for (u32 index = 0; index < job->primitivesCount; ++index) {
+    const auto primitive = &job->primitives[index];
+    const u32 vertexCount = getVertexCount (gltf, primitive);
+    const u32 indexCount = getIndexCount (gltf, primitive);
+    const u32 sourceIndexCount = getSourceIndexCount (gltf, primitive);
+
+    readAttribute (gltf, primitive->attributes.uv, 2, vertexCount, uvs);
+    readAttribute (gltf, primitive->attributes.normal, 3, vertexCount, normals);
+    readAttribute (gltf, primitive->attributes.position, 3, vertexCount, positions);
+    interleaveVertices (positions, normals, uvs, vertexCount, &job->mesh->vertices[vertexOffset]);
+
+    // Strips, fans and lists with an incomplete triangle are read aside and converted into the mesh
+    u32* indices = &job->mesh->indices[indexOffset];
+    u32* source = isTriangleList (gltf, primitive) ? indices : REI_MALLOC (u32, sourceIndexCount);
+
+    if (primitive->indices < gltf->accessorsCount) {
+      gltf::readIndices (gltf, &gltf->accessors[primitive->indices], vertexOffset, source);
+    } else {
+      writeSequentialIndices (vertexOffset, sourceIndexCount, source);
+    }
+
+    if (source != indices) {
+      triangulate (primitive->mode, source, sourceIndexCount, indices);
+      free (source);
+    }
+
+    const u32 collapsedCount = collapseInvalidTriangles (indices, indexCount, vertexOffset, vertexCount);
+    if (collapsedCount)
+      REI_LOG_WARN ("%u triangles of a primitive reference vertices that it doesn't have", collapsedCount);
+
+    vertexOffset += vertexCount;
+    indexOffset += indexCount;
+  }
+
+  free (positions);
+}
+
+void buildMesh (const gltf::Data* gltf, jobs::Pool* pool, Mesh* out) {
+  const u32 primitivesCount = (u32) gltf->primitivesCount;
+  auto primitives = REI_MALLOC (gltf::Primitive, primitivesCount);
+  memcpy (primitives, gltf->primitives, sizeof (gltf::Primitive) * primitivesCount);
+
+  // Primitives without a valid material share a default one that goes after the materials of the model
+  const u32 defaultMaterial = (u32) gltf->materialsCount;
+  b8 hasDefaultMaterial = REI_FALSE;
+
+  for (u32 index = 0; index < primitivesCount; ++index) {
+    if (primitives[index].material < defaultMaterial) continue;
+    primitives[index].material = defaultMaterial;
+    hasDefaultMaterial = REI_TRUE;
+  }
+
+  // Primitives are only grouped inside of their own mesh, since instances draw whole meshes
+  for (u32 mesh = 0; mesh < gltf->meshesCount; ++mesh) {
+    const i32 first = (i32) gltf->meshes[mesh].firstPrimitive;
+    sortPrimitives (primitives, first, first + (i32) gltf->meshes[mesh].primitivesCount - 1);
+  }
+
+  // First batch and count of batches of every glTF mesh
+  auto meshBatches = REI_MALLOC (u32, gltf->meshesCount * 2);
+  out->vertexCount = out->indexCount = out->batchesCount = 0;
+
+  for (u32 mesh = 0; mesh < gltf->meshesCount; ++mesh) {
+    const auto current = &gltf->meshes[mesh];
+    meshBatches[mesh * 2] = out->batchesCount;
+
+    for (u32 index = current->firstPrimitive; index < current->firstPrimitive + current->primitivesCount; ++index) {
+      const auto primitive = &primitives[index];
+      const u32 vertexCount = getVertexCount (gltf, primitive);
+
+      if (!isTriangleMode (primitive->mode))
+        REI_LOG_WARN ("Skipping a primitive of mesh %u, only triangles, strips and fans are drawn", mesh);
+
+      out->indexCount += getIndexCount (gltf, primitive);
+      out->vertexCount += vertexCount;
+
+      if (index == current->firstPrimitive || primitive->material != primitives[index - 1].material) ++out->batchesCount;
+    }
+
+    meshBatches[mesh * 2 + 1] = out->batchesCount - meshBatches[mesh * 2];
+  }
+
+  out->file.size = 0;
+  out->file.contents = nullptr;
+
+  out->indices = REI_MALLOC (u32, out->indexCount);
+  out->vertices = REI_MALLOC (Vertex, out->vertexCount);
+  out->batches = REI_MALLOC (MeshBatch, out->batchesCount);
+
+  out->meshletsCount = 0;
+  out->meshlets = nullptr;
+
+  out->lodsCount = 0;
+  out->lods = nullptr;
+
+  // Batches and the offsets of every primitive are laid out first, so that primitives can be decoded in parallel.
+  // Every job takes a run of consecutive primitives with about the same count of vertices.
+  const u32 jobsCount = REI_MIN (primitivesCount, pool ? pool->queuesCount * 4 : 1);
+  auto primitiveJobs = REI_MALLOC (PrimitivesJob, REI_MAX (jobsCount, 1u));
+  auto job = primitiveJobs;
+
+  job->gltf = gltf;
+  job->mesh = out;
+  job->primitives = primitives;
+  job->primitivesCount = job->vertexOffset = job->indexOffset = job->maxVertexCount = 0;
+
+  u32 vertexOffset = 0, indexOffset = 0;
+  MeshBatch* currentBatch = nullptr;
+
+  for (u32 primitive = 0, mesh = 0; primitive < primitivesCount; ++primitive) {
+    const auto currentPrimitive = &primitives[primitive];
+
+    // Meshes are contiguous ranges of primitives, a new one always starts a new batch
+    while (primitive >= gltf->meshes[mesh].firstPrimitive + gltf->meshes[mesh].primitivesCount) ++mesh;
+    b8 firstOfMesh = primitive == gltf->meshes[mesh].firstPrimitive;
+
+    if (!currentBatch || firstOfMesh || currentBatch->materialIndex != currentPrimitive->material) {
+      currentBatch = currentBatch ? currentBatch + 1 : out->batches;
+      currentBatch->indexCount = currentBatch->vertexCount = 0;
+      currentBatch->firstMeshlet = currentBatch->meshletsCount = 0;
+      currentBatch->firstLod = currentBatch->lodsCount = 0;
+      currentBatch->firstIndex = indexOffset;
+      currentBatch->firstVertex = vertexOffset;
+      currentBatch->materialIndex = currentPrimitive->material;
+    }
+
+    const u32 currentVertexCount = getVertexCount (gltf, currentPrimitive);
+    const u32 currentIndexCount = getIndexCount (gltf, currentPrimitive);
+
+    // Next job starts once this one has its share of the vertices
+    const u64 jobEnd = (u64) out->vertexCount * (u64) (job - primitiveJobs + 1) / jobsCount;
+
+    if (job->primitivesCount && vertexOffset >= jobEnd && job + 1 < primitiveJobs + jobsCount) {
+      ++job;
+      job->gltf = gltf;
+      job->mesh = out;
+      job->primitives = currentPrimitive;
+      job->vertexOffset = vertexOffset;
+      job->indexOffset = indexOffset;
+      job->primitivesCount = job->maxVertexCount = 0;
+    }
+
+    ++job->primitivesCount;
+    job->maxVertexCount = REI_MAX (job->maxVertexCount, currentVertexCount);
+
+    vertexOffset += currentVertexCount;
+    indexOffset += currentIndexCount;
+    currentBatch->indexCount += currentIndexCount;
+    currentBatch->vertexCount += currentVertexCount;
+  }
+
+  const u32 usedJobsCount = primitivesCount ? (u32) (job - primitiveJobs + 1) : 0;
+
+  for (u32 index = 0; index < usedJobsCount; ++index) {
+    if (pool) {
+      jobs::submit (pool, buildPrimitivesJob, &primitiveJobs[index]);
+    } else {
+      buildPrimitivesJob (&primitiveJobs[index]);
+    }
+  }
+
+  if (pool) jobs::wait (pool);
+
+  free (primitiveJobs);
+  free (primitives);
+
+  // Weld inside of every batch, they have to keep their own contiguous vertex ranges
+  u32 weldedCount = 0;
+
+  for (u32 index = 0; index < out->batchesCount; ++index) {
+    auto batch = &out->batches[index];
+    u32* indices = &out->indices[batch->firstIndex];
+
+    for (u32 offset = 0; offset < batch->indexCount; ++offset) indices[offset] -= batch->firstVertex;
+
+    memmove (&out->vertices[weldedCount], &out->vertices[batch->firstVertex], sizeof (Vertex) * batch->vertexCount);
+    batch->firstVertex = weldedCount;
+    batch->vertexCount = weldVertices (
+      &out->vertices[weldedCount],
+      batch->vertexCount,
+      indices,
+      batch->indexCount,
+      REI_WELD_EPSILON
+    );
+
+    for (u32 offset = 0; offset < batch->indexCount; ++offset) indices[offset] += batch->firstVertex;
+    weldedCount += batch->vertexCount;
+  }
+
+  if (weldedCount < out->vertexCount) {
+    REI_LOG_INFO (
+      "Welded %u of %u vertices (%.2f KiB saved)",
+      out->vertexCount - weldedCount,
+      out->vertexCount,
+      (f64) (sizeof (Vertex) * (out->vertexCount - weldedCount)) / 1024.0
+    );
+  }
+
+  out->vertexCount = weldedCount;
+
+  out->imagesCount = 0;
+  out->images = REI_MALLOC (MeshImage, gltf->imagesCount);
+  // Baked index of every glTF image, UINT32_MAX for the ones that were skipped
+  auto imageIndices = REI_MALLOC (u32, gltf->imagesCount);
+
+  for (u32 index = 0; index < gltf->imagesCount; ++index) {
+    const char* uri = gltf->images[index].uri;
+    imageIndices[index] = UINT32_MAX;
+
+    // Images without a uri are stored in buffer views, they can't be baked. Dots in directories aren't extensions.
+    const char* fileName = strrchr (uri, '/');
+    const char* extension = strrchr (fileName ? fileName : uri, '.');
+    const size_t stemLength = extension ? (size_t) (extension - uri) : 0;
+
+    if (!extension || stemLength + sizeof (".rtex") > sizeof (out->images[0].name)) {
+      REI_LOG_WARN ("Image %u " ANSI_RED "%s" ANSI_YELLOW " can't be baked, its materials use a placeholder", index, uri);
+      continue;
+    }
+
+    auto image = &out->images[out->imagesCount];
+    memcpy (image->name, uri, stemLength);
+    memcpy (image->name + stemLength, ".rtex", sizeof (".rtex"));
+    imageIndices[index] = out->imagesCount++;
+  }
+
+  out->materialsCount = defaultMaterial + hasDefaultMaterial;
+  out->materials = REI_MALLOC (MeshMaterial, out->materialsCount);
+
+  if (hasDefaultMaterial) {
+    out->materials[defaultMaterial].albedoImage = UINT32_MAX;
+    out->materials[defaultMaterial].alphaMode = gltf::AlphaMode::Opaque;
+  }
+
+  for (u32 index = 0; index < defaultMaterial; ++index) {
+    const auto source = &gltf->materials[index];
+    auto material = &out->materials[index];
+
+    material->alphaMode = source->alphaMode;
+    // Textures without an image are treated the same as a missing one
+    const u32 image = source->baseColorTexture < gltf->texturesCount ?
+      gltf->textures[source->baseColorTexture].source : UINT32_MAX;
+    material->albedoImage = image < gltf->imagesCount ? imageIndices[image] : UINT32_MAX;
+  }
+
+  free (imageIndices);
+
+  buildInstances (gltf, meshBatches, out);
+  free (meshBatches);
+
+  for (u32 axis = 0; axis < 3; ++axis) {
+    out->boundsMin[axis] = out->vertexCount ? INFINITY : 0.f;
+    out->boundsMax[axis] = out->vertexCount ? -INFINITY : 0.f;
+  }
+
+  for (u32 index = 0; index < out->vertexCount; ++index) {
+    const f32* position = &out->vertices[index].x;
+
+    for (u32 axis = 0; axis < 3; ++axis) {
+      out->boundsMin[axis] = REI_MIN (out->boundsMin[axis], position[axis]);
+      out->boundsMax[axis] = REI_MAX (out->boundsMax[axis], position[axis]);
+    }
+  }
+
+  for (u32 index = 0; index < out->batchesCount; ++index)
+    computeBatchSphere (out, &out->batches[index]);
+}
+
+static i16 quantizeSnorm16 (f32 value) {
+  return (i16) roundf (REI_CLAMP (value, -1.f, 1.f) * 32767.f);
+}
+
+// Octahedral encoding of a unit vector (Cigolle et al., "A Survey of Efficient Representations for Independent Unit Vectors")
+static void encodeOctahedral (const f32* normal, i16* out) {
+  f32 length = REI_ABS (normal[0]) + REI_ABS (normal[1]) + REI_ABS (normal[2]);
+  if (length <= 0.f) length = 1.f;
+
+  f32 x = normal[0] / length;
+  f32 y = normal[1] / length;
+
+  // Lower hemisphere is folded over the diagonals
+  if (normal[2] < 0.f) {
+    f32 foldedX = (1.f - REI_ABS (y)) * (x >= 0.f ? 1.f : -1.f);
+    f32 foldedY = (1.f - REI_ABS (x)) * (y >= 0.f ? 1.f : -1.f);
+    x = foldedX;
+    y = foldedY;
+  }
+
+  out[0] = quantizeSnorm16 (x);
+  out[1] = quantizeSnorm16 (y);
+}
+
+void getVertexQuantization (const Mesh* mesh, math::Vec3* offset, f32* scale) {
+  offset->x = (mesh->boundsMin[0] + mesh->boundsMax[0]) * .5f;
+  offset->y = (mesh->boundsMin[1] + mesh->boundsMax[1]) * .5f;
+  offset->z = (mesh->boundsMin[2] + mesh->boundsMax[2]) * .5f;
+
+  *scale = 0.f;
+  for (u32 axis = 0; axis < 3; ++axis)
+    *scale = REI_MAX (*scale, (mesh->boundsMax[axis] - mesh->boundsMin[axis]) * .5f);
+
+  if (*scale <= 0.f) *scale = 1.f;
+}
+
+void packVertices (const Vertex* vertices, u32 count, const math::Vec3* offset, f32 scale, PackedVertex* out) {
+  const f32 inverseScale = 1.f / scale;
+
+  for (u32 index = 0; index < count; ++index) {
+    const auto source = &vertices[index];
+    auto packed = &out[index];
+
+    packed->x = quantizeSnorm16 ((source->x - offset->x) * inverseScale);
+    packed->y = quantizeSnorm16 ((source->y - offset->y) * inverseScale);
+    packed->z = quantizeSnorm16 ((source->z - offset->z) * inverseScale);
+    packed->w = 0;
+
+    encodeOctahedral (&source->nx, &packed->nx);
+
+    packed->u = _cvtss_sh (source->u, _MM_FROUND_TO_NEAREST_INT);
+    packed->v = _cvtss_sh (source->v, _MM_FROUND_TO_NEAREST_INT);
+  }
+}
+
+void destroyMesh (Mesh* mesh) {
+  // Meshes read from a pack point into it with a zero sized file, the pack unmaps them
+  if (mesh->file.contents) {
+    if (mesh->file.size) unmapFile (&mesh->file);
+    return;
+  }
+
+  free (mesh->images);
+  free (mesh->materials);
+  free (mesh->lods);
+  free (mesh->meshlets);
+  free (mesh->instances);
+  free (mesh->batches);
+  free (mesh->vertices);
+  free (mesh->indices);
+}
+
+static void loadPosition (const Vertex* vertex, math::Vec3* out) {
+  out->x = vertex->x;
+  out->y = vertex->y;
+  out->z = vertex->z;
+}
+
+// Returns false for degenerate triangles
+static b8 getTriangleNormal (const Mesh* mesh, const u32* corners, math::Vec3* out) {
+  math::Vec3 a, b, c, ab, ac;
+  loadPosition (&mesh->vertices[corners[0]], &a);
+  loadPosition (&mesh->vertices[corners[1]], &b);
+  loadPosition (&mesh->vertices[corners[2]], &c);
+
+  math::vec3::sub (&b, &a, &ab);
+  math::vec3::sub (&c, &a, &ac);
+  math::vec3::cross (&ab, &ac, out);
+
+  if (math::vec3::dot (out, out) <= 0.f) return REI_FALSE;
+
+  math::vec3::normalize (out);
+  return REI_TRUE;
+}
+
+// Fills the bounds of the triangles [firstIndex, firstIndex + indexCount)
+static void computeMeshletBounds (const Mesh* mesh, Meshlet* meshlet) {
+  for (u32 axis = 0; axis < 3; ++axis) {
+    meshlet->boundsMin[axis] = INFINITY;
+    meshlet->boundsMax[axis] = -INFINITY;
+  }
+
+  const u32* indices = &mesh->indices[meshlet->firstIndex];
+
+  for (u32 index = 0; index < meshlet->indexCount; ++index) {
+    const f32* position = &mesh->vertices[indices[index]].x;
+
+    for (u32 axis = 0; axis < 3; ++axis) {
+      meshlet->boundsMin[axis] = REI_MIN (meshlet->boundsMin[axis], position[axis]);
+      meshlet->boundsMax[axis] = REI_MAX (meshlet->boundsMax[axis], position[axis]);
+    }
+  }
+
+  // Sphere around the center of the box, it's a bit looser than the minimal one but much cheaper to find
+  math::Vec3 center {
+    (meshlet->boundsMin[0] + meshlet->boundsMax[0]) * .5f,
+    (meshlet->boundsMin[1] + meshlet->boundsMax[1]) * .5f,
+    (meshlet->boundsMin[2] + meshlet->boundsMax[2]) * .5f
+  };
+
+  f32 radiusSquared = 0.f;
+  math::Vec3 axis {0.f};
+
+  for (u32 index = 0; index < meshlet->indexCount; ++index) {
+    math::Vec3 position, offset;
+    loadPosition (&mesh->vertices[indices[index]], &position);
+    math::vec3::sub (&position, &center, &offset);
+
+    radiusSquared = REI_MAX (radiusSquared, math::vec3::dot (&offset, &offset));
+  }
+
+  for (u32 index = 0; index < meshlet->indexCount; index += 3) {
+    math::Vec3 normal;
+    if (getTriangleNormal (mesh, &indices[index], &normal)) math::vec3::add (&axis, &normal, &axis);
+  }
+
+  memcpy (meshlet->center, &center.x, sizeof (meshlet->center));
+  meshlet->radius = sqrtf (radiusSquared);
+
+  // Cone that contains the normals of all of the triangles,
+  // a cutoff of 1 never passes the test, so it disables culling.
+  meshlet->coneCutoff = 1.f;
+  memset (meshlet->coneAxis, 0, sizeof (meshlet->coneAxis));
+
+  if (math::vec3::dot (&axis, &axis) <= 0.f) return;
+  math::vec3::normalize (&axis);
+  memcpy (meshlet->coneAxis, &axis.x, sizeof (meshlet->coneAxis));
+
+  f32 minimumDot = 1.f;
+
+  for (u32 index = 0; index < meshlet->indexCount; index += 3) {
+    math::Vec3 normal;
+    if (getTriangleNormal (mesh, &indices[index], &normal))
+      minimumDot = REI_MIN (minimumDot, math::vec3::dot (&normal, &axis));
+  }
+
+  // Cone is wider than a hemisphere
+  if (minimumDot <= 0.f) return;
+
+  // Sine of the cone angle
+  meshlet->coneCutoff = sqrtf (1.f - minimumDot * minimumDot);
+}
+
+void buildMeshlets (Mesh* mesh) {
+  // Upper bound, every meshlet but the last one of a batch is full in either vertices or triangles
+  u32 capacity = mesh->batchesCount;
+  for (u32 index = 0; index < mesh->batchesCount; ++index) {
+    const auto batch = &mesh->batches[index];
+    capacity += batch->indexCount / 3 / REI_MESHLET_MAX_TRIANGLES + batch->indexCount / REI_MESHLET_MAX_VERTICES;
+  }
+
+  mesh->meshletsCount = 0;
+  mesh->meshlets = (Meshlet*) realloc (mesh->meshlets, sizeof (Meshlet) * capacity);
+
+  // Meshlet that the vertex was last added to
+  auto owners = REI_MALLOC (u32, mesh->vertexCount);
+  memset (owners, 0xFF, sizeof (u32) * mesh->vertexCount);
+
+  for (u32 index = 0; index < mesh->batchesCount; ++index) {
+    auto batch = &mesh->batches[index];
+    batch->firstMeshlet = mesh->meshletsCount;
+
+    Meshlet* meshlet = nullptr;
+    u32 vertexCount = 0;
+
+    // Triangles are taken in order, so the optimized order keeps meshlets compact
+    for (u32 triangle = batch->firstIndex; triangle < batch->firstIndex + batch->indexCount; triangle += 3) {
+      const u32* corners = &mesh->indices[triangle];
+
+      u32 newVertices = 0;
+      if (meshlet) {
+        for (u32 corner = 0; corner < 3; ++corner)
+          newVertices += owners[corners[corner]] != mesh->meshletsCount - 1;
+      }
+
+      b8 isFull = !meshlet || vertexCount + newVertices > REI_MESHLET_MAX_VERTICES;
+      isFull = isFull || meshlet->indexCount / 3 == REI_MESHLET_MAX_TRIANGLES;
+
+      if (isFull) {
+        if (meshlet) computeMeshletBounds (mesh, meshlet);
+
+        meshlet = &mesh->meshlets[mesh->meshletsCount++];
+        meshlet->firstIndex = triangle;
+        meshlet->indexCount = 0;
+        vertexCount = 0;
+      }
+
+      for (u32 corner = 0; corner < 3; ++corner) {
+        if (owners[corners[corner]] == mesh->meshletsCount - 1) continue;
+
+        owners[corners[corner]] = mesh->meshletsCount - 1;
+        ++vertexCount;
+      }
+
+      meshlet->indexCount += 3;
+    }
+
+    if (meshlet) computeMeshletBounds (mesh, meshlet);
+    batch->meshletsCount = mesh->meshletsCount - batch->firstMeshlet;
+  }
+
+  free (owners);
+}
+
+void buildLods (Mesh* mesh) {
+  mesh->lodsCount = 0;
+  mesh->lods = (MeshLod*) realloc (mesh->lods, sizeof (MeshLod) * mesh->batchesCount * (REI_MESH_MAX_LODS - 1));
+
+  u32 maxIndexCount = 0;
+  for (u32 index = 0; index < mesh->batchesCount; ++index)
+    maxIndexCount = REI_MAX (maxIndexCount, mesh->batches[index].indexCount);
+
+  // Simplify copies a whole batch before reducing it, so levels are built in scratch memory
+  // and only the accepted indices are appended to the mesh
+  u64 capacity = mesh->indexCount;
+  auto clusters = REI_MALLOC (u32, maxIndexCount / 3 + 1);
+  auto source = REI_MALLOC (u32, maxIndexCount);
+  auto output = REI_MALLOC (u32, maxIndexCount);
+
+  for (u32 index = 0; index < mesh->batchesCount; ++index) {
+    auto batch = &mesh->batches[index];
+    batch->firstLod = mesh->lodsCount;
+    batch->lodsCount = 0;
+
+    for (u32 offset = 0; offset < batch->indexCount; ++offset)
+      source[offset] = mesh->indices[batch->firstIndex + offset] - batch->firstVertex;
+
+    u32 previousCount = batch->indexCount;
+
+    for (u32 level = 1; level < REI_MESH_MAX_LODS; ++level) {
+      const u32 target = (batch->indexCount >> level) / 3 * 3;
+
+      // Each level is simplified from the original, so that errors don't accumulate
+      f32 error;
+      u32 indexCount = simplify (
+        source,
+        batch->indexCount,
+        &mesh->vertices[batch->firstVertex],
+        batch->vertexCount,
+        target,
+        output,
+        &error
+      );
+
+      // Locked vertices stopped the simplification, coarser levels wouldn't get any simpler
+      if (indexCount > previousCount - previousCount / 4) break;
+
+      optimizeVertexCache (output, indexCount, batch->vertexCount, clusters);
+
+      if (mesh->indexCount + indexCount > capacity) {
+        capacity = REI_MAX (capacity * 2, (u64) mesh->indexCount + indexCount);
+        mesh->indices = (u32*) realloc (mesh->indices, sizeof (u32) * capacity);
+      }
+
+      u32* indices = &mesh->indices[mesh->indexCount];
+      for (u32 offset = 0; offset < indexCount; ++offset) indices[offset] = output[offset] + batch->firstVertex;
+
+      auto lod = &mesh->lods[mesh->lodsCount++];
+      lod->firstIndex = mesh->indexCount;
+      lod->indexCount = indexCount;
+      lod->error = error;
+
+      ++batch->lodsCount;
+      mesh->indexCount += indexCount;
+      previousCount = indexCount;
+    }
+  }
+
+  mesh->indices = (u32*) realloc (mesh->indices, sizeof (u32) * mesh->indexCount);
+
+  free (output);
+  free (source);
+  free (clusters);
+}
+
+// Tells whether count elements starting at first fit into total without overflowing
+static b8 isRangeValid (u64 first, u64 count, u64 total) noexcept {
+  return first <= total && count <= total - first;
+}
+
+static b8 isArrayValid (u64 offset, size_t elementSize, u32 count, size_t size) noexcept {
+  return offset <= size && (size - offset) / elementSize >= count;
+}
+
+// Indices of a range have to reference vertices of its batch
+static b8 areIndicesValid (const u32* indices, u32 count, const MeshBatch* batch) noexcept {
+  for (u32 index = 0; index < count; ++index)
+    if (indices[index] - batch->firstVertex >= batch->vertexCount) return REI_FALSE;
+
+  return REI_TRUE;
+}
+
+static Result parseMesh (const void* data, size_t size, Mesh* out) {
+  const auto header = (const MeshHeader*) data;
+
+  b8 valid = size >= sizeof (MeshHeader) && header->magic == REI_MESH_MAGIC;
+  valid = valid && header->version == REI_MESH_VERSION && header->vertexSize == sizeof (Vertex);
+  valid = valid && isArrayValid (header->indicesOffset, sizeof (u32), header->indexCount, size);
+  valid = valid && isArrayValid (header->verticesOffset, sizeof (Vertex), header->vertexCount, size);
+  valid = valid && isArrayValid (header->batchesOffset, sizeof (MeshBatch), header->batchesCount, size);
+  valid = valid && isArrayValid (header->instancesOffset, sizeof (MeshInstance), header->instancesCount, size);
+  valid = valid && isArrayValid (header->meshletsOffset, sizeof (Meshlet), header->meshletsCount, size);
+  valid = valid && isArrayValid (header->lodsOffset, sizeof (MeshLod), header->lodsCount, size);
+  valid = valid && isArrayValid (header->materialsOffset, sizeof (MeshMaterial), header->materialsCount, size);
+  valid = valid && isArrayValid (header->imagesOffset, sizeof (MeshImage), header->imagesCount, size);
+
+  if (!valid) return Result::InvalidAssetFormat;
+
+  auto bytes = (u8*) data;
+  const auto indices = (const u32*) (bytes + header->indicesOffset);
+  const auto batches = (const MeshBatch*) (bytes + header->batchesOffset);
+  const auto instances = (const MeshInstance*) (bytes + header->instancesOffset);
+  const auto meshlets = (const Meshlet*) (bytes + header->meshletsOffset);
+  const auto lods = (const MeshLod*) (bytes + header->lodsOffset);
+  const auto materials = (const MeshMaterial*) (bytes + header->materialsOffset);
+  const auto images = (const MeshImage*) (bytes + header->imagesOffset);
+
+  // Arrays point straight into the file, so every index that is used to address them is checked once here
+  for (u32 index = 0; index < header->batchesCount; ++index) {
+    const auto batch = &batches[index];
+
+    if (
+      !isRangeValid (batch->firstIndex, batch->indexCount, header->indexCount) ||
+      !isRangeValid (batch->firstVertex, batch->vertexCount, header->vertexCount) ||
+      !isRangeValid (batch->firstMeshlet, batch->meshletsCount, header->meshletsCount) ||
+      !isRangeValid (batch->firstLod, batch->lodsCount, header->lodsCount) ||
+      batch->materialIndex >= header->materialsCount ||
+      !areIndicesValid (&indices[batch->firstIndex], batch->indexCount, batch)
+    ) {
+      return Result::InvalidAssetFormat;
+    }
+
+    // Meshlets are drawn relative to the first index of their batch
+    for (u32 offset = 0; offset < batch->meshletsCount; ++offset) {
+      const auto meshlet = &meshlets[batch->firstMeshlet + offset];
+      if (
+        meshlet->firstIndex < batch->firstIndex ||
+        !isRangeValid (meshlet->firstIndex - batch->firstIndex, meshlet->indexCount, batch->indexCount)
+      ) {
+        return Result::InvalidAssetFormat;
+      }
+    }
+
+    for (u32 level = 0; level < batch->lodsCount; ++level) {
+      const auto lod = &lods[batch->firstLod + level];
+      if (
+        !isRangeValid (lod->firstIndex, lod->indexCount, header->indexCount) ||
+        !areIndicesValid (&indices[lod->firstIndex], lod->indexCount, batch)
+      ) {
+        return Result::InvalidAssetFormat;
+      }
+    }
+  }
+
+  for (u32 index = 0; index < header->instancesCount; ++index) {
+    const auto instance = &instances[index];
+    if (!isRangeValid (instance->firstBatch, instance->batchesCount, header->batchesCount))
+      return Result::InvalidAssetFormat;
+  }
+
+  for (u32 index = 0; index < header->materialsCount; ++index) {
+    const u32 albedoImage = materials[index].albedoImage;
+    if (albedoImage != UINT32_MAX && albedoImage >= header->imagesCount) return Result::InvalidAssetFormat;
+  }
+
+  for (u32 index = 0; index < header->imagesCount; ++index) {
+    const auto name = images[index].name;
+    if (!memchr (name, '\0', sizeof (images[index].name))) return Result::InvalidAssetFormat;
+  }
+
+  out->indices = (u32*) (bytes + header->indicesOffset);
+  out->images = (MeshImage*) (bytes + header->imagesOffset);
+  out->vertices = (Vertex*) (bytes + header->verticesOffset);
+  out->batches = (MeshBatch*) (bytes + header->batchesOffset);
+  out->instances = (MeshInstance*) (bytes + header->instancesOffset);
+  out->meshlets = (Meshlet*) (bytes + header->meshletsOffset);
+  out->lods = (MeshLod*) (bytes + header->lodsOffset);
+  out->materials = (MeshMaterial*) (bytes + header->materialsOffset);
+
+  out->indexCount = header->indexCount;
+  out->vertexCount = header->vertexCount;
+  out->imagesCount = header->imagesCount;
+  out->batchesCount = header->batchesCount;
+  out->instancesCount = header->instancesCount;
+  out->meshletsCount = header->meshletsCount;
+  out->lodsCount = header->lodsCount;
+  out->materialsCount = header->materialsCount;
+  memcpy (out->boundsMin, header->boundsMin, sizeof (out->boundsMin));
+  memcpy (out->boundsMax, header->boundsMax, sizeof (out->boundsMax));
+
+  return Result::Success;
+}
+
+Result readMesh (const char* relativePath, const Pack* pack, Mesh* out) {
+  if (pack) {
+    size_t size;
+    const void* blob = findBlob (pack, relativePath, &size);
+
+    if (blob) {
+      // Pack owns the mapping, the mesh only remembers that its arrays point into it
+      Result result = parseMesh (blob, size, out);
+      out->file.size = 0;
+      out->file.contents = (void*) blob;
+      return result;
+    }
+  }
+
+  Result result = mapFile (relativePath, &out->file);
+  if (result != Result::Success) return result;
+
+  result = parseMesh (out->file.contents, out->file.size, out);
+  if (result != Result::Success) unmapFile (&out->file);
+
+  return result;
+}
+
+void writeMesh (const char* relativePath, const Mesh* mesh) {
+  MeshHeader header {};
+  header.magic = REI_MESH_MAGIC;
+  header.version = REI_MESH_VERSION;
+  header.vertexSize = sizeof (Vertex);
+  header.indexCount = mesh->indexCount;
+  header.vertexCount = mesh->vertexCount;
+  header.imagesCount = mesh->imagesCount;
+  header.batchesCount = mesh->batchesCount;
+  header.instancesCount = mesh->instancesCount;
+  header.meshletsCount = mesh->meshletsCount;
+  header.lodsCount = mesh->lodsCount;
+  header.materialsCount = mesh->materialsCount;
+  memcpy (header.boundsMin, mesh->boundsMin, sizeof (header.boundsMin));
+  memcpy (header.boundsMax, mesh->boundsMax, sizeof (header.boundsMax));
+
+  // Vertices and indices are stored next to each other, so they can be copied into staging at once
+  header.batchesOffset = sizeof (MeshHeader);
+  header.instancesOffset = header.batchesOffset + sizeof (MeshBatch) * mesh->batchesCount;
+  header.meshletsOffset = header.instancesOffset + sizeof (MeshInstance) * mesh->instancesCount;
+  header.lodsOffset = header.meshletsOffset + sizeof (Meshlet) * mesh->meshletsCount;
+  header.materialsOffset = header.lodsOffset + sizeof (MeshLod) * mesh->lodsCount;
+  header.imagesOffset = header.materialsOffset + sizeof (MeshMaterial) * mesh->materialsCount;
+  header.verticesOffset = header.imagesOffset + sizeof (MeshImage) * mesh->imagesCount;
+  header.indicesOffset = header.verticesOffset + sizeof (Vertex) * mesh->vertexCount;
+
+  FILE* output = fopen (relativePath, "wb");
+  REI_ASSERT (output);
+
+  fwrite (&header, sizeof (MeshHeader), 1, output);
+  fwrite (mesh->batches, sizeof (MeshBatch), mesh->batchesCount, output);
+  fwrite (mesh->instances, sizeof (MeshInstance), mesh->instancesCount, output);
+  fwrite (mesh->meshlets, sizeof (Meshlet), mesh->meshletsCount, output);
+  fwrite (mesh->lods, sizeof (MeshLod), mesh->lodsCount, output);
+  fwrite (mesh->materials, sizeof (MeshMaterial), mesh->materialsCount, output);
+  fwrite (mesh->images, sizeof (MeshImage), mesh->imagesCount, output);
+  fwrite (mesh->vertices, sizeof (Vertex), mesh->vertexCount, output);
+  fwrite (mesh->indices, sizeof (u32), mesh->indexCount, output);
+
+  fclose (output);
+}
+
+}
@@ -0,0 +1,184 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include "common.hpp"
+#include "gltf.hpp"
+
+#ifndef REI_MESH_MAGIC
+#  define REI_MESH_MAGIC 0x48534D52u // RMSH
+#endif
+
+#ifndef REI_MESH_VERSION
+#  define REI_MESH_VERSION 6u
+#endif
+
+// Meshlet limits, same as the ones recommended for mesh shaders
+#ifndef REI_MESHLET_MAX_VERTICES
+#  define REI_MESHLET_MAX_VERTICES 64u
+#endif
+
+#ifndef REI_MESHLET_MAX_TRIANGLES
+#  define REI_MESHLET_MAX_TRIANGLES 124u
+#endif
+
+// Levels of detail of every batch, including the original one
+#ifndef REI_MESH_MAX_LODS
+#  define REI_MESH_MAX_LODS 4u
+#endif
+
+namespace rei::jobs {
+struct Pool;
+}
+
+namespace rei::assets {
+
+struct Pack;
+
+// Primitives that share a material. Vertices of a batch are stored contiguously,
+// and its indices only reference vertices from its own range.
+struct MeshBatch {
+  u32 firstIndex;
+  u32 indexCount;
+  u32 firstVertex;
+  u32 vertexCount;
+  u32 materialIndex;
+  u32 firstMeshlet;
+  u32 meshletsCount;
+  // Simplified versions of the batch, the original one is not included
+  u32 firstLod;
+  u32 lodsCount;
+
+  // Bounding sphere of the batch, used to pick the level of detail
+  f32 center[3];
+  f32 radius;
+};
+
+// Index range of a simplified batch, it uses the same vertices as the original
+struct MeshLod {
+  u32 firstIndex;
+  u32 indexCount;
+  // Upper bound of the distance to the original surface in mesh space
+  f32 error;
+};
+
+// Small cluster of triangles of a batch that can be culled on its own.
+// Its triangles are a contiguous range of the index buffer.
+struct Meshlet {
+  f32 center[3];
+  f32 radius;
+
+  f32 boundsMin[3];
+  u32 firstIndex;
+  f32 boundsMax[3];
+  u32 indexCount;
+
+  // Every triangle faces away from a camera at position p if
+  // dot (center - p, coneAxis) > coneCutoff * length (center - p) + radius
+  f32 coneAxis[3];
+  f32 coneCutoff;
+};
+
+// Node of the glTF scene graph that draws a range of batches, every glTF mesh
+// owns a contiguous range of them that all of its instances share
+struct MeshInstance {
+  // World matrix of the node, times the instance transform if it has EXT_mesh_gpu_instancing
+  math::Mat4 matrix;
+  u32 firstBatch;
+  u32 batchesCount;
+};
+
+struct MeshMaterial {
+  // Index into the images of the mesh, UINT32_MAX if the material isn't textured
+  u32 albedoImage;
+  gltf::AlphaMode alphaMode;
+};
+
+struct MeshImage {
+  // Baked image path relative to the model (e.g. "textures/bricks.rtex")
+  char name[256];
+};
+
+// Every .rmesh starts with this header, offsets are relative to the start of the file
+struct MeshHeader {
+  u32 magic;
+  u32 version;
+
+  u32 vertexCount;
+  u32 indexCount;
+  u32 batchesCount;
+  u32 materialsCount;
+  u32 imagesCount;
+  u32 vertexSize;
+
+  u32 instancesCount;
+  u32 flags;
+
+  f32 boundsMin[3];
+  u32 meshletsCount;
+  f32 boundsMax[3];
+  u32 lodsCount;
+
+  u64 batchesOffset;
+  u64 instancesOffset;
+  u64 meshletsOffset;
+  u64 lodsOffset;
+  u64 materialsOffset;
+  u64 imagesOffset;
+  u64 verticesOffset;
+  u64 indicesOffset;
+};
+
+// CPU side mesh that is either built from a glTF model or read from a baked file
+struct Mesh {
+  Vertex* vertices;
+  // Indices of simplified batches follow the ones of all of the original batches
+  u32* indices;
+  MeshBatch* batches;
+  MeshInstance* instances;
+  Meshlet* meshlets;
+  MeshLod* lods;
+  MeshMaterial* materials;
+  MeshImage* images;
+
+  // Mapping that arrays point into, contents are null if the mesh owns its arrays
+  // and size is zero if they point into a pack
+  File file;
+
+  // Bounds of the vertex positions in mesh space, instance matrices aren't applied
+  f32 boundsMin[3];
+  f32 boundsMax[3];
+
+  u32 vertexCount;
+  u32 indexCount;
+  u32 batchesCount;
+  u32 instancesCount;
+  u32 meshletsCount;
+  u32 materialsCount;
+  u32 imagesCount;
+  u32 lodsCount;
+};
+
+// Groups primitives of every glTF mesh by material, interleaves their vertices and creates an instance
+// for every node that references a mesh (or for every element of its EXT_mesh_gpu_instancing accessors).
+// Primitives are decoded in parallel if there's a pool.
+void buildMesh (const gltf::Data* gltf, jobs::Pool* pool, Mesh* out);
+void destroyMesh (Mesh* mesh);
+
+// Splits every batch into meshlets, this has to be done after its triangles are reordered
+void buildMeshlets (Mesh* mesh);
+// Appends up to REI_MESH_MAX_LODS - 1 simplified index ranges of every batch to the indices
+void buildLods (Mesh* mesh);
+
+// Positions are quantized with the same scale on every axis, so that the dequantization
+// can be folded into the model matrix without distorting normals.
+void getVertexQuantization (const Mesh* mesh, math::Vec3* offset, f32* scale);
+// Offset and scale map the bounds of the mesh into the [-1, 1] range of snorm16 positions
+void packVertices (const Vertex* vertices, u32 count, const math::Vec3* offset, f32 scale, PackedVertex* out);
+
+// Mesh is looked up in the pack first if it isn't null
+Result readMesh (const char* relativePath, const Pack* pack, Mesh* out);
+void writeMesh (const char* relativePath, const Mesh* mesh);
+
+}
+
+#endif /* MESH_HPP */
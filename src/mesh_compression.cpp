@@ -0,0 +1,483 @@
+#include <math.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "mesh_compression.hpp"
+
+namespace rei::meshopt {
+
+// Upper 4 bits of the first byte of every stream, the lower ones are the version
+static const u8 vertexHeader = 0xa0;
+static const u8 triangleHeader = 0xe0;
+static const u8 sequenceHeader = 0xd0;
+
+// Attribute bytes are encoded in groups of 16, vertices in blocks that fit into 8 KiB
+static const u32 byteGroupSize = 16;
+static const u32 byteGroupDecodeLimit = 24;
+static const u32 vertexBlockMaxSize = 256;
+static const u32 vertexBlockSizeBytes = 8192;
+// First vertex is stored at the end of the stream, padded to at least this size
+static const u32 vertexTailMinSize = 32;
+
+// Values that don't fit into the bits of a group are escaped with the largest value,
+// the escaped bytes follow the packed bits in order.
+static const u8* decodeBytesGroup (const u8* data, u32 bits, u8* out) {
+  if (!bits) {
+    memset (out, 0, byteGroupSize);
+    return data;
+  }
+
+  if (bits == 8) {
+    memcpy (out, data, byteGroupSize);
+    return data + byteGroupSize;
+  }
+
+  const u8* escaped = data + byteGroupSize * bits / 8;
+  const u32 escape = (1u << bits) - 1;
+
+  // Values are packed starting from the most significant bits
+  for (u32 index = 0; index < byteGroupSize; ++index) {
+    const u32 bit = index * bits;
+    const u32 value = (u32) (data[bit / 8] >> (8 - bits - bit % 8)) & escape;
+    out[index] = value == escape ? *escaped++ : (u8) value;
+  }
+
+  return escaped;
+}
+
+// Header of the stream has 2 bits per group, they select 0, 2, 4 or 8 bits per value
+static const u8* decodeBytes (const u8* data, const u8* end, u8* out, u32 count) {
+  const u8* header = data;
+  const u32 groupsCount = count / byteGroupSize;
+  const u32 headerSize = (groupsCount + 3) / 4;
+
+  if ((size_t) (end - data) < headerSize) return nullptr;
+  data += headerSize;
+
+  for (u32 group = 0; group < groupsCount; ++group) {
+    // Escaped bytes of a group can't reach past the limit, so they aren't checked one by one
+    if ((size_t) (end - data) < byteGroupDecodeLimit) return nullptr;
+
+    const u32 mode = (u32) (header[group / 4] >> (group % 4 * 2)) & 3;
+    data = decodeBytesGroup (data, mode ? 1u << mode : 0, &out[group * byteGroupSize]);
+  }
+
+  return data;
+}
+
+// Every byte of a vertex is stored as a stream of zigzag encoded deltas to the same byte of the previous vertex,
+// last holds the previous vertex and is updated to the last one of the block.
+static const u8* decodeVertexBlock (const u8* data, const u8* end, u32 count, u32 stride, u8* last, u8* out) {
+  u8 values[vertexBlockMaxSize];
+  const u32 alignedCount = (count + byteGroupSize - 1) & ~(byteGroupSize - 1);
+
+  const __m128i one = _mm_set1_epi8 (1);
+  const __m128i lowBits = _mm_set1_epi8 (0x7f);
+
+  for (u32 byte = 0; byte < stride; ++byte) {
+    data = decodeBytes (data, end, values, alignedCount);
+    if (!data) return nullptr;
+
+    // Deltas are decoded and prefix summed 16 at a time, carrying the last sum over to the next group
+    __m128i previous = _mm_set1_epi8 ((char) last[byte]);
+
+    for (u32 group = 0; group < alignedCount; group += byteGroupSize) {
+      __m128i encoded = _mm_loadu_si128 ((const __m128i*) &values[group]);
+
+      // (value >> 1) ^ -(value & 1)
+      __m128i sign = _mm_sub_epi8 (_mm_setzero_si128 (), _mm_and_si128 (encoded, one));
+      __m128i sums = _mm_xor_si128 (_mm_and_si128 (_mm_srli_epi16 (encoded, 1), lowBits), sign);
+
+      sums = _mm_add_epi8 (sums, _mm_slli_si128 (sums, 1));
+      sums = _mm_add_epi8 (sums, _mm_slli_si128 (sums, 2));
+      sums = _mm_add_epi8 (sums, _mm_slli_si128 (sums, 4));
+      sums = _mm_add_epi8 (sums, _mm_slli_si128 (sums, 8));
+      sums = _mm_add_epi8 (sums, previous);
+      _mm_storeu_si128 ((__m128i*) &values[group], sums);
+
+      // Broadcast the last byte
+      previous = _mm_shufflehi_epi16 (_mm_unpackhi_epi8 (sums, sums), 0xff);
+      previous = _mm_shuffle_epi32 (previous, 0xff);
+    }
+
+    for (u32 vertex = 0; vertex < count; ++vertex) out[vertex * stride + byte] = values[vertex];
+  }
+
+  memcpy (last, &out[(count - 1) * stride], stride);
+  return data;
+}
+
+b8 decodeVertices (const u8* data, size_t size, u32 count, u32 stride, u8* out) {
+  if (!stride || stride > 256 || stride % 4) return REI_FALSE;
+
+  const u32 tailSize = REI_MAX (stride, vertexTailMinSize);
+  if (size < 1 + tailSize || (data[0] & 0xf0) != vertexHeader || (data[0] & 0x0f)) return REI_FALSE;
+
+  const u8* end = data + size;
+  const u32 blockSize = REI_MIN ((vertexBlockSizeBytes / stride) & ~(byteGroupSize - 1), vertexBlockMaxSize);
+
+  u8 last[256];
+  memcpy (last, end - stride, stride);
+
+  const u8* current = data + 1;
+  for (u32 first = 0; first < count; first += blockSize) {
+    const u32 blockCount = REI_MIN (blockSize, count - first);
+    current = decodeVertexBlock (current, end, blockCount, stride, last, &out[(size_t) first * stride]);
+    if (!current) return REI_FALSE;
+  }
+
+  return (size_t) (end - current) == tailSize;
+}
+
+static u32 decodeVByte (const u8** data) {
+  u8 lead = *(*data)++;
+  if (lead < 128) return lead;
+
+  u32 result = lead & 127u, shift = 7;
+  for (u32 index = 0; index < 4; ++index, shift += 7) {
+    u8 group = *(*data)++;
+    result |= (u32) (group & 127u) << shift;
+    if (group < 128) break;
+  }
+
+  return result;
+}
+
+// Zigzag encoded delta to the previous index
+static u32 decodeIndex (const u8** data, u32 last) {
+  const u32 value = decodeVByte (data);
+  return last + ((value >> 1) ^ (0u - (value & 1)));
+}
+
+static void writeIndex (u8* out, u32 stride, size_t index, u32 value) {
+  if (stride == 2) {
+    ((u16*) out)[index] = (u16) value;
+  } else {
+    ((u32*) out)[index] = value;
+  }
+}
+
+// FIFOs of the last 16 edges and vertices, both the encoder and the decoder update them the same way
+struct TriangleState {
+  u32 edges[16][2];
+  u32 vertices[16];
+  u32 edgeOffset;
+  u32 vertexOffset;
+};
+
+static void pushEdge (TriangleState* state, u32 a, u32 b) {
+  state->edges[state->edgeOffset][0] = a;
+  state->edges[state->edgeOffset][1] = b;
+  state->edgeOffset = (state->edgeOffset + 1) & 15;
+}
+
+static void pushVertex (TriangleState* state, u32 vertex, b8 condition) {
+  state->vertices[state->vertexOffset] = vertex;
+  state->vertexOffset = (state->vertexOffset + condition) & 15;
+}
+
+static u32 getVertex (const TriangleState* state, u32 distance) {
+  return state->vertices[(state->vertexOffset - distance) & 15];
+}
+
+b8 decodeTriangles (const u8* data, size_t size, u32 count, u32 stride, u8* out) {
+  if (count % 3 || (stride != 2 && stride != 4)) return REI_FALSE;
+  if (size < 1 + count / 3 + 16 || (data[0] & 0xf0) != triangleHeader || (data[0] & 0x0f) > 1) return REI_FALSE;
+
+  TriangleState state;
+  memset (&state, 0xff, sizeof (state));
+  state.edgeOffset = state.vertexOffset = 0;
+
+  // Version 1 uses the last two codes of a vertex from the FIFO for indices next to the last free one
+  const u32 fifoLimit = (data[0] & 0x0f) >= 1 ? 13 : 15;
+  u32 next = 0, last = 0;
+
+  // Every triangle has a code, free indices and codes that aren't in the table follow all of them.
+  // The table takes the last 16 bytes, a triangle reads at most 16 bytes of data so it's checked once.
+  const u8* code = data + 1;
+  const u8* current = code + count / 3;
+  const u8* safeEnd = data + size - 16;
+  const u8* codeTable = safeEnd;
+
+  for (u32 index = 0; index < count; index += 3) {
+    if (current > safeEnd) return REI_FALSE;
+
+    const u32 triangle = *code++;
+
+    if (triangle < 0xf0) {
+      // Triangle shares an edge from the FIFO, the third vertex is the next one, one from the FIFO or a free one
+      const u32* edge = state.edges[(state.edgeOffset - 1 - (triangle >> 4)) & 15];
+      const u32 a = edge[0], b = edge[1];
+      const u32 vertexCode = triangle & 15;
+      u32 c;
+
+      if (vertexCode < fifoLimit) {
+        c = vertexCode ? getVertex (&state, 1 + vertexCode) : next++;
+        pushVertex (&state, c, !vertexCode);
+      } else {
+        // 13 and 14 are the previous and the next index of the last free one
+        last = c = vertexCode == 15 ? decodeIndex (&current, last) : last + (vertexCode == 13 ? -1u : 1u);
+        pushVertex (&state, c, REI_TRUE);
+      }
+
+      writeIndex (out, stride, index, a);
+      writeIndex (out, stride, index + 1, b);
+      writeIndex (out, stride, index + 2, c);
+
+      pushEdge (&state, c, b);
+      pushEdge (&state, a, c);
+      continue;
+    }
+
+    // Triangle doesn't share an edge, codes of its second and third vertices are either in the table
+    // (and the first one is the next vertex) or in the data
+    const b8 inTable = triangle < 0xfe;
+    const u32 codes = inTable ? codeTable[triangle & 15] : *current++;
+    const u32 bCode = codes >> 4, cCode = codes & 15;
+
+    // Codes that aren't in the table restart the vertex numbering if both of them are zero
+    if (!inTable && !codes) next = 0;
+
+    // Outside of the table 15 stands for a free index
+    const b8 freeA = !inTable && triangle == 0xff;
+    const b8 freeB = !inTable && bCode == 15;
+    const b8 freeC = !inTable && cCode == 15;
+
+    u32 a = freeA ? 0 : next++;
+    u32 b = !bCode ? next++ : getVertex (&state, bCode);
+    u32 c = !cCode ? next++ : getVertex (&state, cCode);
+
+    if (freeA) last = a = decodeIndex (&current, last);
+    if (freeB) last = b = decodeIndex (&current, last);
+    if (freeC) last = c = decodeIndex (&current, last);
+
+    writeIndex (out, stride, index, a);
+    writeIndex (out, stride, index + 1, b);
+    writeIndex (out, stride, index + 2, c);
+
+    pushVertex (&state, a, REI_TRUE);
+    pushVertex (&state, b, !bCode || freeB);
+    pushVertex (&state, c, !cCode || freeC);
+
+    pushEdge (&state, b, a);
+    pushEdge (&state, c, b);
+    pushEdge (&state, a, c);
+  }
+
+  return current == safeEnd;
+}
+
+b8 decodeIndices (const u8* data, size_t size, u32 count, u32 stride, u8* out) {
+  if (stride != 2 && stride != 4) return REI_FALSE;
+  if (size < 1 + (size_t) count + 4 || (data[0] & 0xf0) != sequenceHeader || (data[0] & 0x0f) > 1) return REI_FALSE;
+
+  // Indices are deltas to one of two baselines, an index reads at most 5 bytes and there's a 4 byte tail
+  const u8* current = data + 1;
+  const u8* safeEnd = data + size - 4;
+  u32 last[2] {};
+
+  for (u32 index = 0; index < count; ++index) {
+    if (current >= safeEnd) return REI_FALSE;
+
+    u32 value = decodeVByte (&current);
+    const u32 baseline = value & 1;
+    value >>= 1;
+
+    last[baseline] += (value >> 1) ^ (0u - (value & 1));
+    writeIndex (out, stride, index, last[baseline]);
+  }
+
+  return current == safeEnd;
+}
+
+static i32 roundSigned (f32 value) {
+  return (i32) (value + (value >= 0.f ? .5f : -.5f));
+}
+
+// z is the quantization scale of x and y, the result is normalized to it
+static void decodeOctahedral (f32 x, f32 y, f32 z, f32 maximum, i32* out) {
+  z -= REI_ABS (x) + REI_ABS (y);
+
+  // Lower hemisphere is folded over the diagonals
+  const f32 fold = REI_MIN (z, 0.f);
+  x += x >= 0.f ? fold : -fold;
+  y += y >= 0.f ? fold : -fold;
+
+  const f32 scale = maximum / sqrtf (x * x + y * y + z * z);
+  out[0] = roundSigned (x * scale);
+  out[1] = roundSigned (y * scale);
+  out[2] = roundSigned (z * scale);
+}
+
+static f32 loadSigned (const u8* data, b8 isShort) {
+  if (!isShort) return (f32) (i8) *data;
+
+  i16 value;
+  memcpy (&value, data, sizeof (value));
+  return (f32) value;
+}
+
+static void storeSigned (u8* data, b8 isShort, i32 value) {
+  if (!isShort) {
+    *data = (u8) (i8) value;
+    return;
+  }
+
+  i16 result = (i16) value;
+  memcpy (data, &result, sizeof (result));
+}
+
+// 8 or 16-bit components, w is left alone. 4 elements are decoded at a time with SSE.
+static void filterOctahedral (u32 count, u32 stride, u8* data) {
+  const b8 isShort = stride == 8;
+  const u32 size = stride / 4;
+  const f32 maximum = isShort ? 32767.f : 127.f;
+
+  const __m128 signMask = _mm_set1_ps (-0.f);
+  const __m128 half = _mm_set1_ps (.5f);
+
+  u32 element = 0;
+
+  for (; element + 4 <= count; element += 4) {
+    alignas (16) f32 components[3][4];
+    alignas (16) i32 results[3][4];
+
+    for (u32 offset = 0; offset < 4; ++offset) {
+      for (u32 component = 0; component < 3; ++component)
+        components[component][offset] = loadSigned (&data[(element + offset) * stride + component * size], isShort);
+    }
+
+    __m128 x = _mm_load_ps (components[0]);
+    __m128 y = _mm_load_ps (components[1]);
+    __m128 z = _mm_load_ps (components[2]);
+
+    z = _mm_sub_ps (z, _mm_add_ps (_mm_andnot_ps (signMask, x), _mm_andnot_ps (signMask, y)));
+
+    // Flipping the sign of the fold with the one of x or y, same as the scalar version
+    __m128 fold = _mm_min_ps (z, _mm_setzero_ps ());
+    x = _mm_add_ps (x, _mm_xor_ps (fold, _mm_and_ps (x, signMask)));
+    y = _mm_add_ps (y, _mm_xor_ps (fold, _mm_and_ps (y, signMask)));
+
+    __m128 length = _mm_sqrt_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (x, x), _mm_mul_ps (y, y)), _mm_mul_ps (z, z)));
+    __m128 scale = _mm_div_ps (_mm_set1_ps (maximum), length);
+
+    #define ROUND_SIGNED(value) _mm_cvttps_epi32 (_mm_add_ps (value, _mm_or_ps (half, _mm_and_ps (value, signMask))))
+
+    _mm_store_si128 ((__m128i*) results[0], ROUND_SIGNED (_mm_mul_ps (x, scale)));
+    _mm_store_si128 ((__m128i*) results[1], ROUND_SIGNED (_mm_mul_ps (y, scale)));
+    _mm_store_si128 ((__m128i*) results[2], ROUND_SIGNED (_mm_mul_ps (z, scale)));
+
+    #undef ROUND_SIGNED
+
+    for (u32 offset = 0; offset < 4; ++offset) {
+      for (u32 component = 0; component < 3; ++component)
+        storeSigned (&data[(element + offset) * stride + component * size], isShort, results[component][offset]);
+    }
+  }
+
+  for (; element < count; ++element) {
+    u8* current = &data[element * stride];
+    i32 result[3];
+
+    decodeOctahedral (
+      loadSigned (current, isShort),
+      loadSigned (current + size, isShort),
+      loadSigned (current + size * 2, isShort),
+      maximum,
+      result
+    );
+
+    for (u32 component = 0; component < 3; ++component) storeSigned (current + component * size, isShort, result[component]);
+  }
+}
+
+// 16-bit components, the lowest 2 bits of w are the index of the component that was left out
+// and the rest of them are the quantization scale of the other three
+static void filterQuaternion (u32 count, u8* data) {
+  for (u32 element = 0; element < count; ++element) {
+    i16 components[4];
+    memcpy (components, &data[element * 8], sizeof (components));
+
+    const f32 scale = 1.f / sqrtf (2.f) / (f32) (components[3] | 3);
+    const f32 x = (f32) components[0] * scale;
+    const f32 y = (f32) components[1] * scale;
+    const f32 z = (f32) components[2] * scale;
+
+    // Clamped, so that precision errors don't turn into NaNs
+    const f32 squared = 1.f - x * x - y * y - z * z;
+    const f32 w = sqrtf (REI_MAX (squared, 0.f));
+
+    const u32 missing = (u32) components[3] & 3;
+    i16 result[4];
+    result[(missing + 1) & 3] = (i16) roundSigned (x * 32767.f);
+    result[(missing + 2) & 3] = (i16) roundSigned (y * 32767.f);
+    result[(missing + 3) & 3] = (i16) roundSigned (z * 32767.f);
+    result[missing] = (i16) roundSigned (w * 32767.f);
+
+    memcpy (&data[element * 8], result, sizeof (result));
+  }
+}
+
+// Signed 24-bit mantissa in the low bits and a signed 8-bit exponent in the high ones, 4 values at a time with SSE
+static void filterExponential (size_t count, u8* data) {
+  size_t index = 0;
+
+  for (; index + 4 <= count; index += 4) {
+    __m128i values = _mm_loadu_si128 ((const __m128i*) &data[index * 4]);
+    __m128i mantissa = _mm_srai_epi32 (_mm_slli_epi32 (values, 8), 8);
+    __m128i exponent = _mm_srai_epi32 (values, 24);
+
+    // 2 ^ exponent built from its bits
+    __m128 power = _mm_castsi128_ps (_mm_slli_epi32 (_mm_add_epi32 (exponent, _mm_set1_epi32 (127)), 23));
+    _mm_storeu_ps ((f32*) &data[index * 4], _mm_mul_ps (power, _mm_cvtepi32_ps (mantissa)));
+  }
+
+  for (; index < count; ++index) {
+    u32 value;
+    memcpy (&value, &data[index * 4], sizeof (value));
+
+    const i32 mantissa = (i32) (value << 8) >> 8;
+    const i32 exponent = (i32) value >> 24;
+
+    const u32 powerBits = (u32) (exponent + 127) << 23;
+    f32 power;
+    memcpy (&power, &powerBits, sizeof (power));
+
+    const f32 result = power * (f32) mantissa;
+    memcpy (&data[index * 4], &result, sizeof (result));
+  }
+}
+
+b8 applyFilter (Filter filter, u32 count, u32 stride, u8* data) {
+  switch (filter) {
+    case Filter::None: return REI_TRUE;
+
+    case Filter::Octahedral: {
+      if (stride != 4 && stride != 8) return REI_FALSE;
+      filterOctahedral (count, stride, data);
+    } return REI_TRUE;
+
+    case Filter::Quaternion: {
+      if (stride != 8) return REI_FALSE;
+      filterQuaternion (count, data);
+    } return REI_TRUE;
+
+    case Filter::Exponential: {
+      if (stride % 4) return REI_FALSE;
+      filterExponential ((size_t) count * stride / 4, data);
+    } return REI_TRUE;
+
+    default: return REI_FALSE;
+  }
+}
+
+b8 decode (Mode mode, Filter filter, const u8* data, size_t size, u32 count, u32 stride, u8* out) {
+  switch (mode) {
+    case Mode::Attributes: return decodeVertices (data, size, count, stride, out) && applyFilter (filter, count, stride, out);
+    case Mode::Triangles: return filter == Filter::None && decodeTriangles (data, size, count, stride, out);
+    case Mode::Indices: return filter == Filter::None && decodeIndices (data, size, count, stride, out);
+    default: return REI_FALSE;
+  }
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef MESH_COMPRESSION_HPP
+#define MESH_COMPRESSION_HPP
+
+#include "common.hpp"
+
+// Decoders for buffer views compressed with EXT_meshopt_compression, the bitstreams are the ones of meshoptimizer.
+// Reference: https://github.com/KhronosGroup/glTF/tree/main/extensions/2.0/Vendor/EXT_meshopt_compression
+namespace rei::meshopt {
+
+enum class Mode : u32 {
+  // Vertex attributes, byte deltas between neighbouring elements
+  Attributes,
+  // Index buffer of a triangle list
+  Triangles,
+  // Any other index sequence
+  Indices,
+
+  Unknown
+};
+
+// Filters are applied to attributes once they are decoded
+enum class Filter : u32 {
+  None,
+  // Normals and tangents, x and y are octahedral coordinates and z is the quantization scale
+  Octahedral,
+  // Rotations, the largest component is left out and reconstructed
+  Quaternion,
+  // Floats with a 24-bit mantissa and a shared or separate 8-bit exponent
+  Exponential,
+
+  Unknown
+};
+
+// Return false if the data is malformed. out has to fit count * stride bytes, stride is the size of
+// an element (a multiple of 4 up to 256 for attributes, 2 or 4 for indices).
+[[nodiscard]] b8 decodeVertices (const u8* data, size_t size, u32 count, u32 stride, u8* out);
+[[nodiscard]] b8 decodeTriangles (const u8* data, size_t size, u32 count, u32 stride, u8* out);
+[[nodiscard]] b8 decodeIndices (const u8* data, size_t size, u32 count, u32 stride, u8* out);
+
+// Filters the decoded attributes in place, returns false if the stride doesn't suit the filter
+[[nodiscard]] b8 applyFilter (Filter filter, u32 count, u32 stride, u8* data);
+
+// Decodes with the codec of the mode and applies the filter
+[[nodiscard]] b8 decode (Mode mode, Filter filter, const u8* data, size_t size, u32 count, u32 stride, u8* out);
+
+}
+
+#endif /* MESH_COMPRESSION_HPP */
@@ -0,0 +1,701 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mesh.hpp"
+#include "rei_math.inl"
+#include "mesh_optimizer.hpp"
+
+namespace rei::assets {
+
+struct ClusterSortKey {
+  f32 key;
+  u32 cluster;
+};
+
+// Simulates a FIFO cache where the vertex was transformed at cacheTime,
+// bumping the timestamp by more than the cache size flushes the whole cache.
+static b8 isCacheMiss (u32 vertex, u32* cacheTime, u32* timestamp) {
+  if (*timestamp - cacheTime[vertex] <= REI_VERTEX_CACHE_SIZE) return REI_FALSE;
+
+  cacheTime[vertex] = (*timestamp)++;
+  return REI_TRUE;
+}
+
+static int compareClusterKeys (const void* a, const void* b) {
+  f32 first = ((const ClusterSortKey*) a)->key;
+  f32 second = ((const ClusterSortKey*) b)->key;
+
+  // Descending, clusters that face away from the center go first
+  return (first < second) - (first > second);
+}
+
+VertexCacheStatistics analyzeVertexCache (const u32* indices, u32 indexCount, u32 vertexCount) {
+  VertexCacheStatistics statistics {};
+  if (!indexCount || !vertexCount) return statistics;
+
+  auto cacheTime = REI_MALLOC (u32, vertexCount);
+  memset (cacheTime, 0, sizeof (u32) * vertexCount);
+
+  u32 misses = 0;
+  u32 timestamp = REI_VERTEX_CACHE_SIZE + 1;
+
+  for (u32 index = 0; index < indexCount; ++index)
+    misses += isCacheMiss (indices[index], cacheTime, &timestamp);
+
+  free (cacheTime);
+
+  statistics.acmr = (f32) misses / (f32) (indexCount / 3);
+  statistics.atvr = (f32) misses / (f32) vertexCount;
+  return statistics;
+}
+
+u32 optimizeVertexCache (u32* indices, u32 indexCount, u32 vertexCount, u32* clusters) {
+  const u32 trianglesCount = indexCount / 3;
+
+  // Triangles that use each vertex, offsets are turned into ends while the lists are filled
+  auto liveCounts = REI_MALLOC (u32, vertexCount);
+  auto adjacencyOffsets = REI_MALLOC (u32, vertexCount + 1);
+  auto adjacency = REI_MALLOC (u32, indexCount);
+
+  memset (liveCounts, 0, sizeof (u32) * vertexCount);
+  for (u32 index = 0; index < indexCount; ++index) ++liveCounts[indices[index]];
+
+  adjacencyOffsets[0] = 0;
+  for (u32 vertex = 0; vertex < vertexCount; ++vertex)
+    adjacencyOffsets[vertex + 1] = adjacencyOffsets[vertex] + liveCounts[vertex];
+
+  for (u32 index = 0; index < indexCount; ++index)
+    adjacency[adjacencyOffsets[indices[index]]++] = index / 3;
+
+  for (u32 vertex = 0; vertex < vertexCount; ++vertex)
+    adjacencyOffsets[vertex] -= liveCounts[vertex];
+
+  auto cacheTime = REI_MALLOC (u32, vertexCount);
+  memset (cacheTime, 0, sizeof (u32) * vertexCount);
+
+  auto emitted = REI_MALLOC (b8, trianglesCount);
+  memset (emitted, 0, sizeof (b8) * trianglesCount);
+
+  // Every emitted index is pushed once, so neither of these can overflow
+  auto deadEnds = REI_MALLOC (u32, indexCount);
+  auto candidates = REI_MALLOC (u32, indexCount);
+  auto output = REI_MALLOC (u32, indexCount);
+
+  u32 clustersCount = 1;
+  clusters[0] = 0;
+
+  u32 outputCount = 0, deadEndsCount = 0;
+  u32 timestamp = REI_VERTEX_CACHE_SIZE + 1;
+  u32 cursor = 0;
+  i64 fanning = vertexCount ? 0 : -1;
+
+  while (fanning >= 0) {
+    u32 candidatesCount = 0;
+    const u32 vertex = (u32) fanning;
+
+    // Emit all of the remaining triangles around the fanning vertex
+    for (u32 offset = adjacencyOffsets[vertex]; offset < adjacencyOffsets[vertex + 1]; ++offset) {
+      const u32 triangle = adjacency[offset];
+      if (emitted[triangle]) continue;
+
+      for (u32 corner = 0; corner < 3; ++corner) {
+        const u32 current = indices[triangle * 3 + corner];
+
+        output[outputCount++] = current;
+        deadEnds[deadEndsCount++] = current;
+        candidates[candidatesCount++] = current;
+
+        --liveCounts[current];
+        isCacheMiss (current, cacheTime, &timestamp);
+      }
+
+      emitted[triangle] = REI_TRUE;
+    }
+
+    // The next fanning vertex is the oldest candidate that will still be in the cache
+    // after all of its remaining triangles are emitted
+    fanning = -1;
+    i64 bestPriority = -1;
+
+    for (u32 index = 0; index < candidatesCount; ++index) {
+      const u32 current = candidates[index];
+      if (!liveCounts[current]) continue;
+
+      i64 priority = 0;
+      const u32 age = timestamp - cacheTime[current];
+      if (age + 2 * liveCounts[current] <= REI_VERTEX_CACHE_SIZE) priority = age;
+
+      if (priority > bestPriority) {
+        bestPriority = priority;
+        fanning = current;
+      }
+    }
+
+    if (fanning >= 0) continue;
+
+    // Dead end, fall back to the most recently used vertex that has triangles left,
+    // and to the next one in input order if there aren't any
+    while (deadEndsCount && fanning < 0) {
+      const u32 current = deadEnds[--deadEndsCount];
+      if (liveCounts[current]) fanning = current;
+    }
+
+    while (cursor < vertexCount && fanning < 0) {
+      if (liveCounts[cursor]) fanning = cursor;
+      ++cursor;
+    }
+
+    if (fanning >= 0 && outputCount / 3 > clusters[clustersCount - 1])
+      clusters[clustersCount++] = outputCount / 3;
+  }
+
+  memcpy (indices, output, sizeof (u32) * trianglesCount * 3);
+
+  free (output);
+  free (candidates);
+  free (deadEnds);
+  free (emitted);
+  free (cacheTime);
+  free (adjacency);
+  free (adjacencyOffsets);
+  free (liveCounts);
+
+  return clustersCount;
+}
+
+void optimizeOverdraw (
+  u32* indices,
+  u32 indexCount,
+  const Vertex* vertices,
+  u32 vertexCount,
+  const u32* clusters,
+  u32 clustersCount) {
+
+  const u32 trianglesCount = indexCount / 3;
+  if (!trianglesCount) return;
+
+  auto cacheTime = REI_MALLOC (u32, vertexCount);
+  memset (cacheTime, 0, sizeof (u32) * vertexCount);
+
+  // Split hard clusters wherever the part up to that point is about as cache efficient
+  // as the whole cluster, so that restarting with a cold cache costs little.
+  auto softClusters = REI_MALLOC (u32, trianglesCount + 1);
+  u32 softClustersCount = 0;
+  u32 timestamp = REI_VERTEX_CACHE_SIZE + 1;
+
+  for (u32 cluster = 0; cluster < clustersCount; ++cluster) {
+    const u32 start = clusters[cluster];
+    const u32 end = cluster + 1 < clustersCount ? clusters[cluster + 1] : trianglesCount;
+
+    u32 clusterMisses = 0;
+    timestamp += REI_VERTEX_CACHE_SIZE + 1;
+
+    for (u32 index = start * 3; index < end * 3; ++index)
+      clusterMisses += isCacheMiss (indices[index], cacheTime, &timestamp);
+
+    const f32 threshold = (f32) clusterMisses / (f32) (end - start) * REI_OVERDRAW_THRESHOLD;
+
+    u32 misses = 0, triangles = 0;
+    timestamp += REI_VERTEX_CACHE_SIZE + 1;
+    softClusters[softClustersCount++] = start;
+
+    for (u32 triangle = start; triangle < end; ++triangle) {
+      for (u32 corner = 0; corner < 3; ++corner)
+        misses += isCacheMiss (indices[triangle * 3 + corner], cacheTime, &timestamp);
+
+      ++triangles;
+
+      if (triangle + 1 < end && (f32) misses / (f32) triangles <= threshold) {
+        softClusters[softClustersCount++] = triangle + 1;
+        timestamp += REI_VERTEX_CACHE_SIZE + 1;
+        misses = triangles = 0;
+      }
+    }
+  }
+
+  free (cacheTime);
+
+  // Area weighted centroid and normal of every cluster
+  auto centroids = REI_MALLOC (math::Vec3, softClustersCount);
+  auto normals = REI_MALLOC (math::Vec3, softClustersCount);
+  math::Vec3 meshCentroid {0.f};
+  f32 meshArea = 0.f;
+
+  for (u32 cluster = 0; cluster < softClustersCount; ++cluster) {
+    const u32 start = softClusters[cluster];
+    const u32 end = cluster + 1 < softClustersCount ? softClusters[cluster + 1] : trianglesCount;
+
+    math::Vec3 centroid {0.f}, normal {0.f};
+    f32 area = 0.f;
+
+    for (u32 triangle = start; triangle < end; ++triangle) {
+      const Vertex* corners[3];
+      for (u32 corner = 0; corner < 3; ++corner) corners[corner] = &vertices[indices[triangle * 3 + corner]];
+
+      math::Vec3 a {corners[0]->x, corners[0]->y, corners[0]->z};
+      math::Vec3 b {corners[1]->x, corners[1]->y, corners[1]->z};
+      math::Vec3 c {corners[2]->x, corners[2]->y, corners[2]->z};
+
+      math::Vec3 ab, ac, triangleNormal;
+      math::vec3::sub (&b, &a, &ab);
+      math::vec3::sub (&c, &a, &ac);
+      math::vec3::cross (&ab, &ac, &triangleNormal);
+
+      const f32 triangleArea = sqrtf (math::vec3::dot (&triangleNormal, &triangleNormal));
+
+      math::Vec3 triangleCentroid;
+      math::vec3::add (&a, &b, &triangleCentroid);
+      math::vec3::add (&triangleCentroid, &c, &triangleCentroid);
+      math::vec3::mulScalar (&triangleCentroid, triangleArea / 3.f, &triangleCentroid);
+
+      math::vec3::add (&centroid, &triangleCentroid, &centroid);
+      math::vec3::add (&normal, &triangleNormal, &normal);
+      area += triangleArea;
+    }
+
+    math::vec3::add (&meshCentroid, &centroid, &meshCentroid);
+    meshArea += area;
+
+    if (area > 0.f) math::vec3::mulScalar (&centroid, 1.f / area, &centroid);
+    if (math::vec3::dot (&normal, &normal) > 0.f) math::vec3::normalize (&normal);
+
+    centroids[cluster] = centroid;
+    normals[cluster] = normal;
+  }
+
+  if (meshArea > 0.f) math::vec3::mulScalar (&meshCentroid, 1.f / meshArea, &meshCentroid);
+
+  auto keys = REI_MALLOC (ClusterSortKey, softClustersCount);
+
+  for (u32 cluster = 0; cluster < softClustersCount; ++cluster) {
+    math::Vec3 offset;
+    math::vec3::sub (&centroids[cluster], &meshCentroid, &offset);
+
+    keys[cluster].cluster = cluster;
+    keys[cluster].key = math::vec3::dot (&offset, &normals[cluster]);
+  }
+
+  qsort (keys, softClustersCount, sizeof (ClusterSortKey), compareClusterKeys);
+
+  auto output = REI_MALLOC (u32, trianglesCount * 3);
+  u32 outputCount = 0;
+
+  for (u32 index = 0; index < softClustersCount; ++index) {
+    const u32 cluster = keys[index].cluster;
+    const u32 start = softClusters[cluster];
+    const u32 end = cluster + 1 < softClustersCount ? softClusters[cluster + 1] : trianglesCount;
+
+    memcpy (&output[outputCount], &indices[start * 3], sizeof (u32) * (end - start) * 3);
+    outputCount += (end - start) * 3;
+  }
+
+  memcpy (indices, output, sizeof (u32) * outputCount);
+
+  free (output);
+  free (keys);
+  free (normals);
+  free (centroids);
+  free (softClusters);
+}
+
+// Attributes of the vertex as they are compared while welding
+static void getWeldKey (const Vertex* vertex, f32 epsilon, i32* out) {
+  const f32* attributes = &vertex->x;
+  const u32 attributesCount = sizeof (Vertex) / sizeof (f32);
+
+  for (u32 index = 0; index < attributesCount; ++index) {
+    if (epsilon > 0.f) {
+      out[index] = (i32) floorf (attributes[index] / epsilon + .5f);
+    } else {
+      // Bit patterns, but with negative zero being the same as zero
+      f32 value = attributes[index] == 0.f ? 0.f : attributes[index];
+      memcpy (&out[index], &value, sizeof (f32));
+    }
+  }
+}
+
+u32 weldVertices (Vertex* vertices, u32 vertexCount, u32* indices, u32 indexCount, f32 epsilon) {
+  const u32 keySize = sizeof (Vertex) / sizeof (f32);
+
+  u32 tableSize = 1;
+  while (tableSize < vertexCount * 2) tableSize <<= 1;
+
+  // Open addressing with linear probing, slots hold the welded vertex
+  auto table = REI_MALLOC (u32, tableSize);
+  memset (table, 0xFF, sizeof (u32) * tableSize);
+
+  auto keys = REI_MALLOC (i32, (size_t) vertexCount * keySize);
+  auto remap = REI_MALLOC (u32, vertexCount);
+  u32 weldedCount = 0;
+
+  for (u32 vertex = 0; vertex < vertexCount; ++vertex) {
+    i32* key = &keys[(size_t) weldedCount * keySize];
+    getWeldKey (&vertices[vertex], epsilon, key);
+
+    u32 slot = (u32) hash64 (key, sizeof (i32) * keySize) & (tableSize - 1);
+
+    while (table[slot] != UINT32_MAX && memcmp (&keys[(size_t) table[slot] * keySize], key, sizeof (i32) * keySize))
+      slot = (slot + 1) & (tableSize - 1);
+
+    if (table[slot] == UINT32_MAX) {
+      table[slot] = weldedCount;
+      vertices[weldedCount++] = vertices[vertex];
+    }
+
+    remap[vertex] = table[slot];
+  }
+
+  for (u32 index = 0; index < indexCount; ++index) indices[index] = remap[indices[index]];
+
+  free (remap);
+  free (keys);
+  free (table);
+
+  return weldedCount;
+}
+
+void optimizeVertexFetch (Vertex* vertices, u32* indices, u32 indexCount, u32 vertexCount) {
+  auto remap = REI_MALLOC (u32, vertexCount);
+  memset (remap, 0xFF, sizeof (u32) * vertexCount);
+
+  auto reordered = REI_MALLOC (Vertex, vertexCount);
+  u32 nextVertex = 0;
+
+  for (u32 index = 0; index < indexCount; ++index) {
+    u32* mapped = &remap[indices[index]];
+
+    if (*mapped == UINT32_MAX) {
+      *mapped = nextVertex;
+      reordered[nextVertex++] = vertices[indices[index]];
+    }
+
+    indices[index] = *mapped;
+  }
+
+  // Vertices that aren't referenced are kept at the end, so that the vertex count doesn't change
+  for (u32 vertex = 0; vertex < vertexCount; ++vertex)
+    if (remap[vertex] == UINT32_MAX) reordered[nextVertex++] = vertices[vertex];
+
+  memcpy (vertices, reordered, sizeof (Vertex) * vertexCount);
+
+  free (reordered);
+  free (remap);
+}
+
+// Sum of squared distances to a set of planes (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics"),
+// upper triangle of the symmetric 4x4 matrix.
+struct Quadric {
+  f64 a2, ab, ac, ad;
+  f64 b2, bc, bd;
+  f64 c2, cd;
+  f64 d2;
+};
+
+struct Collapse {
+  f32 cost;
+  u32 from;
+  u32 to;
+};
+
+struct SortedPosition {
+  f32 x, y, z;
+  u32 vertex;
+};
+
+static int compareCollapses (const void* a, const void* b) {
+  f32 first = ((const Collapse*) a)->cost;
+  f32 second = ((const Collapse*) b)->cost;
+  return (first > second) - (first < second);
+}
+
+static int comparePositions (const void* a, const void* b) {
+  const auto first = (const SortedPosition*) a;
+  const auto second = (const SortedPosition*) b;
+
+  if (first->x != second->x) return first->x < second->x ? -1 : 1;
+  if (first->y != second->y) return first->y < second->y ? -1 : 1;
+  if (first->z != second->z) return first->z < second->z ? -1 : 1;
+  return 0;
+}
+
+static int compareEdges (const void* a, const void* b) {
+  u64 first = *(const u64*) a;
+  u64 second = *(const u64*) b;
+  return (first > second) - (first < second);
+}
+
+static void addQuadric (Quadric* out, const Quadric* quadric) {
+  f64* values = &out->a2;
+  const f64* added = &quadric->a2;
+  for (u32 index = 0; index < sizeof (Quadric) / sizeof (f64); ++index) values[index] += added[index];
+}
+
+static f64 evaluateQuadric (const Quadric* q, const Vertex* vertex) {
+  const f64 x = vertex->x, y = vertex->y, z = vertex->z;
+
+  f64 result = q->a2 * x * x + q->b2 * y * y + q->c2 * z * z + q->d2;
+  result += 2.0 * (q->ab * x * y + q->ac * x * z + q->bc * y * z);
+  result += 2.0 * (q->ad * x + q->bd * y + q->cd * z);
+  return result > 0.0 ? result : 0.0;
+}
+
+static void getNormal (const Vertex* a, const Vertex* b, const Vertex* c, math::Vec3* out) {
+  math::Vec3 ab {b->x - a->x, b->y - a->y, b->z - a->z};
+  math::Vec3 ac {c->x - a->x, c->y - a->y, c->z - a->z};
+  math::vec3::cross (&ab, &ac, out);
+}
+
+// Vertices that share their position with another one (uv or normal seams) and vertices on open edges
+// can't be moved without tearing the surface, so they are never collapsed.
+static void findLockedVertices (const u32* indices, u32 indexCount, const Vertex* vertices, u32 vertexCount, b8* locked) {
+  memset (locked, 0, sizeof (b8) * vertexCount);
+
+  auto positions = REI_MALLOC (SortedPosition, vertexCount);
+  for (u32 vertex = 0; vertex < vertexCount; ++vertex) {
+    positions[vertex].x = vertices[vertex].x;
+    positions[vertex].y = vertices[vertex].y;
+    positions[vertex].z = vertices[vertex].z;
+    positions[vertex].vertex = vertex;
+  }
+
+  qsort (positions, vertexCount, sizeof (SortedPosition), comparePositions);
+
+  for (u32 index = 1; index < vertexCount; ++index) {
+    if (comparePositions (&positions[index - 1], &positions[index])) continue;
+
+    locked[positions[index - 1].vertex] = REI_TRUE;
+    locked[positions[index].vertex] = REI_TRUE;
+  }
+
+  free (positions);
+
+  // Edges that belong to a single triangle
+  auto edges = REI_MALLOC (u64, indexCount);
+  for (u32 index = 0; index < indexCount; ++index) {
+    u32 a = indices[index];
+    u32 b = indices[index % 3 == 2 ? index - 2 : index + 1];
+    edges[index] = (u64) REI_MIN (a, b) << 32 | REI_MAX (a, b);
+  }
+
+  qsort (edges, indexCount, sizeof (u64), compareEdges);
+
+  for (u32 index = 0; index < indexCount;) {
+    u32 end = index + 1;
+    while (end < indexCount && edges[end] == edges[index]) ++end;
+
+    if (end - index == 1) {
+      locked[edges[index] >> 32] = REI_TRUE;
+      locked[edges[index] & UINT32_MAX] = REI_TRUE;
+    }
+
+    index = end;
+  }
+
+  free (edges);
+}
+
+u32 simplify (
+  const u32* indices,
+  u32 indexCount,
+  const Vertex* vertices,
+  u32 vertexCount,
+  u32 targetIndexCount,
+  u32* out,
+  f32* error) {
+
+  memcpy (out, indices, sizeof (u32) * indexCount);
+  *error = 0.f;
+
+  auto locked = REI_MALLOC (b8, vertexCount);
+  findLockedVertices (indices, indexCount, vertices, vertexCount, locked);
+
+  auto quadrics = REI_MALLOC (Quadric, vertexCount);
+  memset (quadrics, 0, sizeof (Quadric) * vertexCount);
+
+  for (u32 index = 0; index < indexCount; index += 3) {
+    math::Vec3 normal;
+    const Vertex* a = &vertices[indices[index]];
+    getNormal (a, &vertices[indices[index + 1]], &vertices[indices[index + 2]], &normal);
+
+    if (math::vec3::dot (&normal, &normal) <= 0.f) continue;
+    math::vec3::normalize (&normal);
+
+    const f64 na = normal.x, nb = normal.y, nc = normal.z;
+    const f64 nd = -(na * a->x + nb * a->y + nc * a->z);
+    const Quadric plane {na * na, na * nb, na * nc, na * nd, nb * nb, nb * nc, nb * nd, nc * nc, nc * nd, nd * nd};
+
+    for (u32 corner = 0; corner < 3; ++corner) addQuadric (&quadrics[indices[index + corner]], &plane);
+  }
+
+  auto remap = REI_MALLOC (u32, vertexCount);
+  auto touched = REI_MALLOC (b8, vertexCount);
+  auto liveCounts = REI_MALLOC (u32, vertexCount);
+  auto adjacencyOffsets = REI_MALLOC (u32, vertexCount + 1);
+  auto adjacency = REI_MALLOC (u32, indexCount);
+  auto collapses = REI_MALLOC (Collapse, indexCount * 2);
+
+  f64 maximumCost = 0.0;
+
+  while (indexCount > targetIndexCount) {
+    // Triangles around every vertex, rebuilt every pass since collapses change them
+    memset (liveCounts, 0, sizeof (u32) * vertexCount);
+    for (u32 index = 0; index < indexCount; ++index) ++liveCounts[out[index]];
+
+    adjacencyOffsets[0] = 0;
+    for (u32 vertex = 0; vertex < vertexCount; ++vertex)
+      adjacencyOffsets[vertex + 1] = adjacencyOffsets[vertex] + liveCounts[vertex];
+
+    for (u32 index = 0; index < indexCount; ++index)
+      adjacency[adjacencyOffsets[out[index]]++] = index / 3;
+
+    for (u32 vertex = 0; vertex < vertexCount; ++vertex)
+      adjacencyOffsets[vertex] -= liveCounts[vertex];
+
+    u32 collapsesCount = 0;
+
+    for (u32 index = 0; index < indexCount; ++index) {
+      u32 from = out[index];
+      u32 to = out[index % 3 == 2 ? index - 2 : index + 1];
+
+      for (u32 direction = 0; direction < 2; ++direction) {
+        if (!locked[from]) {
+          Quadric merged = quadrics[from];
+          addQuadric (&merged, &quadrics[to]);
+
+          auto collapse = &collapses[collapsesCount++];
+          collapse->from = from;
+          collapse->to = to;
+          collapse->cost = (f32) evaluateQuadric (&merged, &vertices[to]);
+        }
+
+        REI_SWAP (&from, &to);
+      }
+    }
+
+    if (!collapsesCount) break;
+    qsort (collapses, collapsesCount, sizeof (Collapse), compareCollapses);
+
+    for (u32 vertex = 0; vertex < vertexCount; ++vertex) remap[vertex] = vertex;
+    memset (touched, 0, sizeof (b8) * vertexCount);
+
+    // Every collapse removes about two triangles, only do a part of the remaining ones per pass,
+    // so that the cheapest collapses are picked from up to date costs.
+    const u32 collapsesLimit = (indexCount - targetIndexCount) / 6 + 1;
+    u32 collapsed = 0;
+
+    for (u32 index = 0; index < collapsesCount && collapsed < collapsesLimit; ++index) {
+      const auto collapse = &collapses[index];
+      if (touched[collapse->from] || touched[collapse->to]) continue;
+
+      // Triangles that stay after the collapse must not flip
+      b8 flips = REI_FALSE;
+      const u32 first = adjacencyOffsets[collapse->from], last = adjacencyOffsets[collapse->from + 1];
+
+      for (u32 offset = first; offset < last && !flips; ++offset) {
+        const u32* triangle = &out[adjacency[offset] * 3];
+        if (triangle[0] == collapse->to || triangle[1] == collapse->to || triangle[2] == collapse->to) continue;
+
+        const Vertex* before[3];
+        const Vertex* after[3];
+
+        for (u32 corner = 0; corner < 3; ++corner) {
+          before[corner] = &vertices[triangle[corner]];
+          after[corner] = triangle[corner] == collapse->from ? &vertices[collapse->to] : before[corner];
+        }
+
+        math::Vec3 beforeNormal, afterNormal;
+        getNormal (before[0], before[1], before[2], &beforeNormal);
+        getNormal (after[0], after[1], after[2], &afterNormal);
+
+        flips = math::vec3::dot (&beforeNormal, &afterNormal) <= 0.f;
+      }
+
+      if (flips) continue;
+
+      remap[collapse->from] = collapse->to;
+      addQuadric (&quadrics[collapse->to], &quadrics[collapse->from]);
+      maximumCost = REI_MAX (maximumCost, (f64) collapse->cost);
+      ++collapsed;
+
+      // Neighbouring triangles changed, so the rest of their collapses have to wait for the next pass
+      for (u32 offset = first; offset < last; ++offset) {
+        const u32* triangle = &out[adjacency[offset] * 3];
+        for (u32 corner = 0; corner < 3; ++corner) touched[triangle[corner]] = REI_TRUE;
+      }
+    }
+
+    if (!collapsed) break;
+
+    // Drop triangles that became degenerate
+    u32 writeOffset = 0;
+
+    for (u32 index = 0; index < indexCount; index += 3) {
+      u32 a = remap[out[index]], b = remap[out[index + 1]], c = remap[out[index + 2]];
+      if (a == b || b == c || a == c) continue;
+
+      out[writeOffset++] = a;
+      out[writeOffset++] = b;
+      out[writeOffset++] = c;
+    }
+
+    indexCount = writeOffset;
+  }
+
+  free (collapses);
+  free (adjacency);
+  free (adjacencyOffsets);
+  free (liveCounts);
+  free (touched);
+  free (remap);
+  free (quadrics);
+  free (locked);
+
+  // Quadrics sum squared distances to planes, so this never underestimates the distance to the original surface
+  *error = (f32) sqrt (maximumCost);
+  return indexCount;
+}
+
+void optimizeMesh (Mesh* mesh) {
+  VertexCacheStatistics before {}, after {};
+  auto clusters = REI_MALLOC (u32, mesh->indexCount / 3 + 1);
+
+  for (u32 index = 0; index < mesh->batchesCount; ++index) {
+    const auto batch = &mesh->batches[index];
+    u32* indices = &mesh->indices[batch->firstIndex];
+    Vertex* vertices = &mesh->vertices[batch->firstVertex];
+
+    for (u32 offset = 0; offset < batch->indexCount; ++offset) indices[offset] -= batch->firstVertex;
+
+    auto statistics = analyzeVertexCache (indices, batch->indexCount, batch->vertexCount);
+    before.acmr += statistics.acmr * (f32) batch->indexCount;
+    before.atvr += statistics.atvr * (f32) batch->vertexCount;
+
+    u32 clustersCount = optimizeVertexCache (indices, batch->indexCount, batch->vertexCount, clusters);
+    optimizeOverdraw (indices, batch->indexCount, vertices, batch->vertexCount, clusters, clustersCount);
+    optimizeVertexFetch (vertices, indices, batch->indexCount, batch->vertexCount);
+
+    statistics = analyzeVertexCache (indices, batch->indexCount, batch->vertexCount);
+    after.acmr += statistics.acmr * (f32) batch->indexCount;
+    after.atvr += statistics.atvr * (f32) batch->vertexCount;
+
+    for (u32 offset = 0; offset < batch->indexCount; ++offset) indices[offset] += batch->firstVertex;
+  }
+
+  free (clusters);
+
+  // Batches are weighted by their size, so the numbers describe the mesh as a whole
+  const f32 indexCount = (f32) REI_MAX (mesh->indexCount, 1u);
+  const f32 vertexCount = (f32) REI_MAX (mesh->vertexCount, 1u);
+
+  REI_LOG_INFO (
+    "Optimized %u batches, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+    mesh->batchesCount,
+    (f64) (before.acmr / indexCount),
+    (f64) (after.acmr / indexCount),
+    (f64) (before.atvr / vertexCount),
+    (f64) (after.atvr / vertexCount)
+  );
+}
+
+}
@@ -0,0 +1,82 @@
+#ifndef MESH_OPTIMIZER_HPP
+#define MESH_OPTIMIZER_HPP
+
+#include "common.hpp"
+
+// Size of the simulated FIFO post-transform cache. 16 is a conservative
+// estimate that doesn't hurt GPUs with larger caches.
+#ifndef REI_VERTEX_CACHE_SIZE
+#  define REI_VERTEX_CACHE_SIZE 16u
+#endif
+
+// How much worse than the cluster it was split from (in ACMR) a cluster
+// is allowed to be, when clusters are split for overdraw ordering.
+#ifndef REI_OVERDRAW_THRESHOLD
+#  define REI_OVERDRAW_THRESHOLD 1.05f
+#endif
+
+// Vertices whose attributes all differ by less than this are merged when meshes are built,
+// 0 only merges vertices that are exactly the same.
+#ifndef REI_WELD_EPSILON
+#  define REI_WELD_EPSILON 0.f
+#endif
+
+namespace rei::assets {
+
+struct Mesh;
+
+struct VertexCacheStatistics {
+  // Average cache miss ratio, transformed vertices per triangle (0.5 is the best case, 3 is the worst)
+  f32 acmr;
+  // Average transformed to vertex ratio (1 is the best case)
+  f32 atvr;
+};
+
+// All of the functions below take indices relative to the first vertex of the range
+
+[[nodiscard]] VertexCacheStatistics analyzeVertexCache (const u32* indices, u32 indexCount, u32 vertexCount);
+
+// Reorders triangles with Tipsify (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+// Offsets (in triangles) of clusters that start at dead ends are written to clusters, which has to fit
+// indexCount / 3 + 1 entries, returns the count of clusters.
+u32 optimizeVertexCache (u32* indices, u32 indexCount, u32 vertexCount, u32* clusters);
+
+// Splits clusters further as long as the cache efficiency stays within REI_OVERDRAW_THRESHOLD
+// and sorts them so that the ones facing away from the center of the mesh are drawn first.
+void optimizeOverdraw (
+  u32* indices,
+  u32 indexCount,
+  const Vertex* vertices,
+  u32 vertexCount,
+  const u32* clusters,
+  u32 clustersCount
+);
+
+// Merges duplicate vertices with a hash table, removes them from the array and remaps the indices.
+// With a positive epsilon attributes are snapped to a grid of that size before they are compared,
+// so vertices close to a cell boundary may stay apart. Returns the new count of vertices.
+u32 weldVertices (Vertex* vertices, u32 vertexCount, u32* indices, u32 indexCount, f32 epsilon);
+
+// Stores vertices in the order they are first referenced by the indices and remaps the indices
+void optimizeVertexFetch (Vertex* vertices, u32* indices, u32 indexCount, u32 vertexCount);
+
+// Collapses edges in the order of their quadric error until there are at most targetIndexCount indices,
+// or nothing can be collapsed anymore. Vertices on open edges and seams stay in place, so there are no
+// cracks between batches. Writes up to indexCount indices to out and returns their count, error is
+// an upper bound of the distance between the result and the original surface.
+u32 simplify (
+  const u32* indices,
+  u32 indexCount,
+  const Vertex* vertices,
+  u32 vertexCount,
+  u32 targetIndexCount,
+  u32* out,
+  f32* error
+);
+
+// Runs the reordering passes above on every batch of the mesh and reports the cache statistics
+void optimizeMesh (Mesh* mesh);
+
+}
+
+#endif /* MESH_OPTIMIZER_HPP */
@@ -175,6 +175,20 @@ static inline void mul (const Mat4* a, const Mat4* b, Mat4* out) noexcept {
   #undef MUL_ROW
 }
 
+// Quaternion is (x, y, z, w) with w being the real part, it has to be normalized
+static inline void rotate (Mat4* matrix, const Vec4* quaternion) noexcept {
+  const f32 x = quaternion->x, y = quaternion->y, z = quaternion->z, w = quaternion->w;
+
+  alignas (16) Mat4 rotation {1.f};
+  rotation.rows[0] = {1.f - 2.f * (y * y + z * z), 2.f * (x * y + z * w), 2.f * (x * z - y * w), 0.f};
+  rotation.rows[1] = {2.f * (x * y - z * w), 1.f - 2.f * (x * x + z * z), 2.f * (y * z + x * w), 0.f};
+  rotation.rows[2] = {2.f * (x * z + y * w), 2.f * (y * z - x * w), 1.f - 2.f * (x * x + y * y), 0.f};
+
+  alignas (16) Mat4 result;
+  mul (matrix, &rotation, &result);
+  *matrix = result;
+}
+
 } /* mat4 */
 
 static inline void lookAt (const Vec3* eye, const Vec3* center, const Vec3* up, Mat4* out) noexcept {
@@ -0,0 +1,462 @@
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "upload_manager.hpp"
+
+#include <VulkanMemoryAllocator/include/vk_mem_alloc.h>
+
+namespace rei::uploads {
+
+static_assert (!(REI_UPLOAD_QUEUE_CAPACITY & (REI_UPLOAD_QUEUE_CAPACITY - 1)), "Queue capacity must be a power of two");
+
+static void initQueue (Queue* queue) {
+  queue->head = queue->tail = 0;
+
+  // Slot is free for the producer whose position matches its sequence
+  for (u64 index = 0; index < REI_UPLOAD_QUEUE_CAPACITY; ++index)
+    queue->slots[index].sequence = index;
+}
+
+static b8 isEmpty (Queue* queue) {
+  return __atomic_load_n (&queue->head, __ATOMIC_SEQ_CST) == __atomic_load_n (&queue->tail, __ATOMIC_RELAXED);
+}
+
+static b8 push (Queue* queue, const Transfer* transfer, u64* position) {
+  u64 head = __atomic_load_n (&queue->head, __ATOMIC_RELAXED);
+
+  for (;;) {
+    auto slot = &queue->slots[head & (REI_UPLOAD_QUEUE_CAPACITY - 1)];
+    u64 sequence = __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE);
+    i64 difference = (i64) (sequence - head);
+
+    // Slot still holds a transfer from the previous lap, so the queue is full
+    if (difference < 0) return REI_FALSE;
+
+    if (difference > 0) {
+      head = __atomic_load_n (&queue->head, __ATOMIC_RELAXED);
+    } else if (__atomic_compare_exchange_n (&queue->head, &head, head + 1, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      slot->transfer = *transfer;
+      __atomic_store_n (&slot->sequence, head + 1, __ATOMIC_RELEASE);
+
+      *position = head;
+      return REI_TRUE;
+    }
+  }
+}
+
+static b8 pop (Queue* queue, Transfer* out, u64* position) {
+  u64 tail = __atomic_load_n (&queue->tail, __ATOMIC_RELAXED);
+
+  for (;;) {
+    auto slot = &queue->slots[tail & (REI_UPLOAD_QUEUE_CAPACITY - 1)];
+    u64 sequence = __atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE);
+    i64 difference = (i64) (sequence - (tail + 1));
+
+    // Slot wasn't written yet, so the queue is empty
+    if (difference < 0) return REI_FALSE;
+
+    if (difference > 0) {
+      tail = __atomic_load_n (&queue->tail, __ATOMIC_RELAXED);
+    } else if (__atomic_compare_exchange_n (&queue->tail, &tail, tail + 1, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      *out = slot->transfer;
+      __atomic_store_n (&slot->sequence, tail + REI_UPLOAD_QUEUE_CAPACITY, __ATOMIC_RELEASE);
+
+      *position = tail;
+      return REI_TRUE;
+    }
+  }
+}
+
+static b8 popRequest (Manager* manager, Transfer* out) {
+  u64 position;
+  if (!pop (manager->requests, out, &position)) return REI_FALSE;
+
+  out->ticket = position + 1;
+  return REI_TRUE;
+}
+
+// Finds contiguous staging memory for size bytes, returns false if the ring doesn't have that much free space yet
+static b8 findStaging (const Manager* manager, VkDeviceSize size, u64* start) {
+  const u64 capacity = manager->stagingBuffer.size;
+  u64 head = manager->stagingHead;
+
+  // Uploads can't wrap around, so the end of the ring is skipped when the upload doesn't fit into it
+  const u64 position = head % capacity;
+  if (position + size > capacity) head += capacity - position;
+
+  *start = head;
+  return head + size - manager->stagingTail <= capacity;
+}
+
+// Hands uploads of finished submissions over to the owner thread, returns false if nothing was retired
+static b8 retire (Manager* manager, u64 timeout) {
+  // Nobody is going to acquire anything once the manager is being destroyed
+  const b32 running = __atomic_load_n (&manager->running, __ATOMIC_ACQUIRE);
+  b8 retired = REI_FALSE;
+
+  while (manager->submissionsCount) {
+    auto submission = &manager->submissions[manager->firstSubmission];
+
+    VkResult result = vkWaitForFences (manager->device, 1, &submission->fence, VK_TRUE, timeout);
+    if (result == VK_TIMEOUT) break;
+    VKC_CHECK (result);
+
+    for (; running && submission->completedCount < submission->transfersCount; ++submission->completedCount) {
+      u64 position;
+      if (!push (manager->completions, &submission->transfers[submission->completedCount], &position))
+        return retired;
+    }
+
+    manager->stagingTail = submission->stagingEnd;
+    VKC_CHECK (vkResetFences (manager->device, 1, &submission->fence));
+    VKC_CHECK (vkResetCommandPool (manager->device, submission->commandPool, VKC_NO_FLAGS));
+
+    manager->firstSubmission = (manager->firstSubmission + 1) % REI_UPLOAD_SUBMISSIONS_COUNT;
+    --manager->submissionsCount;
+    retired = REI_TRUE;
+    timeout = 0;
+  }
+
+  // Nothing is in flight, so the ring can start over and fit uploads as large as itself
+  if (!manager->submissionsCount) manager->stagingHead = manager->stagingTail = 0;
+
+  return retired;
+}
+
+static void recordTransfer (vku::UploadBatch* batch, const Transfer* transfer) {
+  if (transfer->texture) {
+    vku::uploadTexture (batch, transfer->texture, transfer->image);
+    return;
+  }
+
+  VkDeviceSize offset;
+  void* staging = vku::reserveUpload (batch, transfer->size, &offset);
+  memcpy (staging, transfer->data, transfer->size);
+
+  vku::uploadBuffer (batch, offset, transfer->size, transfer->buffer);
+}
+
+// Records requests into the next free submission for as long as they fit, and submits it.
+// Leaves the request that didn't fit in pending.
+static void recordSubmission (Manager* manager, u64 start, Transfer* pending, b8* hasPending) {
+  const u32 index = (manager->firstSubmission + manager->submissionsCount) % REI_UPLOAD_SUBMISSIONS_COUNT;
+  auto submission = &manager->submissions[index];
+  submission->transfersCount = submission->completedCount = 0;
+
+  VkCommandBufferBeginInfo beginInfo {COMMAND_BUFFER_BEGIN_INFO};
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  VKC_CHECK (vkBeginCommandBuffer (submission->cmdBuffer, &beginInfo));
+
+  // Batch sees only the staging memory of the upload that is being recorded
+  vku::UploadBatch batch;
+  batch.device = manager->device;
+  batch.allocator = manager->allocator;
+  batch.cmdBuffer = submission->cmdBuffer;
+  batch.stagingBuffer = manager->stagingBuffer;
+  batch.srcQueueFamily = manager->queueFamily;
+  batch.dstQueueFamily = manager->ownerFamily;
+  batch.transferContext = &manager->transferContext;
+
+  const u64 capacity = manager->stagingBuffer.size;
+
+  for (;;) {
+    const VkDeviceSize size = vku::alignUploadSize (pending->size);
+    batch.offset = start % capacity;
+    batch.stagingBuffer.size = batch.offset + size;
+    manager->stagingHead = start + size;
+
+    recordTransfer (&batch, pending);
+    submission->transfers[submission->transfersCount++] = *pending;
+
+    *hasPending = REI_FALSE;
+    if (submission->transfersCount == REI_UPLOAD_BATCH_CAPACITY) break;
+
+    *hasPending = popRequest (manager, pending);
+    if (!*hasPending || !findStaging (manager, vku::alignUploadSize (pending->size), &start)) break;
+  }
+
+  submission->stagingEnd = manager->stagingHead;
+  VKC_CHECK (vkEndCommandBuffer (submission->cmdBuffer));
+
+  VkSubmitInfo submitInfo {SUBMIT_INFO};
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &submission->cmdBuffer;
+
+  VKC_CHECK (vkQueueSubmit (manager->transferContext.queue, 1, &submitInfo, submission->fence));
+  ++manager->submissionsCount;
+}
+
+static void* uploadMain (void* argument) {
+  auto manager = (Manager*) argument;
+
+  // Request that didn't fit into the previous submission
+  Transfer pending;
+  b8 hasPending = REI_FALSE;
+
+  for (;;) {
+    retire (manager, 0);
+    if (!hasPending) hasPending = popRequest (manager, &pending);
+
+    if (hasPending) {
+      u64 start;
+
+      if (
+        manager->submissionsCount == REI_UPLOAD_SUBMISSIONS_COUNT ||
+        !findStaging (manager, vku::alignUploadSize (pending.size), &start)
+      ) {
+        // Wait for the oldest submission to give its slot and staging memory back,
+        // it can't be retired while the owner thread is behind with acquiring uploads
+        if (!retire (manager, UINT64_MAX)) usleep (1000);
+        continue;
+      }
+
+      recordSubmission (manager, start, &pending, &hasPending);
+      continue;
+    }
+
+    if (manager->submissionsCount) {
+      // Keep picking up new requests while the transfer queue is busy
+      if (!retire (manager, 1000000)) usleep (1000);
+      continue;
+    }
+
+    // Nothing to do, go to sleep until somebody requests an upload
+    pthread_mutex_lock (&manager->mutex);
+    __atomic_store_n (&manager->sleeping, REI_TRUE, __ATOMIC_SEQ_CST);
+
+    while (manager->running && isEmpty (manager->requests))
+      pthread_cond_wait (&manager->wakeCondition, &manager->mutex);
+
+    __atomic_store_n (&manager->sleeping, REI_FALSE, __ATOMIC_SEQ_CST);
+    b32 running = manager->running;
+    pthread_mutex_unlock (&manager->mutex);
+
+    if (!running && isEmpty (manager->requests)) break;
+  }
+
+  return nullptr;
+}
+
+static u64 request (Manager* manager, const Transfer* transfer) {
+  REI_ASSERT (transfer->size);
+
+  if (vku::alignUploadSize (transfer->size) > manager->stagingBuffer.size) {
+    REI_LOG_ERROR (
+      "Upload of " ANSI_YELLOW "%llu" ANSI_RED " bytes doesn't fit into the staging ring of " ANSI_YELLOW "%llu",
+      (unsigned long long) transfer->size,
+      (unsigned long long) manager->stagingBuffer.size
+    );
+
+    return 0;
+  }
+
+  // Queue is full only when the upload thread is far behind, so let it catch up
+  u64 position;
+  while (!push (manager->requests, transfer, &position)) sched_yield ();
+
+  if (__atomic_load_n (&manager->sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock (&manager->mutex);
+    pthread_cond_signal (&manager->wakeCondition);
+    pthread_mutex_unlock (&manager->mutex);
+  }
+
+  return position + 1;
+}
+
+void createManager (VkDevice device, VmaAllocator allocator, const ManagerCreateInfo* createInfo, Manager* out) {
+  out->device = device;
+  out->allocator = allocator;
+  out->queueFamily = createInfo->queueFamily;
+  out->ownerFamily = createInfo->ownerFamily;
+
+  out->transferContext.fence = VK_NULL_HANDLE;
+  out->transferContext.commandPool = VK_NULL_HANDLE;
+  out->transferContext.queue = createInfo->queue;
+  out->transferContext.jobPool = nullptr;
+  out->transferContext.formatSupport = createInfo->formatSupport;
+
+  vku::allocateStagingBuffer (allocator, vku::alignUploadSize (createInfo->stagingSize), &out->stagingBuffer);
+  VKC_CHECK (vmaMapMemory (allocator, out->stagingBuffer.allocation, &out->stagingBuffer.mapped));
+  out->stagingHead = out->stagingTail = 0;
+
+  VkCommandPoolCreateInfo poolInfo {COMMAND_POOL_CREATE_INFO};
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  poolInfo.queueFamilyIndex = createInfo->queueFamily;
+
+  VkCommandBufferAllocateInfo bufferInfo {COMMAND_BUFFER_ALLOCATE_INFO};
+  bufferInfo.commandBufferCount = 1;
+  bufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+  VkFenceCreateInfo fenceInfo {FENCE_CREATE_INFO};
+
+  for (u32 index = 0; index < REI_UPLOAD_SUBMISSIONS_COUNT; ++index) {
+    auto submission = &out->submissions[index];
+    VKC_CHECK (vkCreateCommandPool (device, &poolInfo, nullptr, &submission->commandPool));
+
+    bufferInfo.commandPool = submission->commandPool;
+    VKC_CHECK (vkAllocateCommandBuffers (device, &bufferInfo, &submission->cmdBuffer));
+    VKC_CHECK (vkCreateFence (device, &fenceInfo, nullptr, &submission->fence));
+  }
+
+  out->firstSubmission = out->submissionsCount = 0;
+  out->completedTicket = 0;
+
+  out->requests = (Queue*) aligned_alloc (alignof (Queue), sizeof (Queue));
+  out->completions = (Queue*) aligned_alloc (alignof (Queue), sizeof (Queue));
+  initQueue (out->requests);
+  initQueue (out->completions);
+
+  out->running = REI_TRUE;
+  out->sleeping = REI_FALSE;
+  pthread_mutex_init (&out->mutex, nullptr);
+  pthread_cond_init (&out->wakeCondition, nullptr);
+
+  pthread_create (&out->thread, nullptr, uploadMain, out);
+}
+
+void destroyManager (Manager* manager) {
+  pthread_mutex_lock (&manager->mutex);
+  __atomic_store_n (&manager->running, REI_FALSE, __ATOMIC_RELEASE);
+  pthread_cond_signal (&manager->wakeCondition);
+  pthread_mutex_unlock (&manager->mutex);
+
+  pthread_join (manager->thread, nullptr);
+
+  for (u32 index = 0; index < REI_UPLOAD_SUBMISSIONS_COUNT; ++index) {
+    auto submission = &manager->submissions[index];
+    vkDestroyFence (manager->device, submission->fence, nullptr);
+    vkDestroyCommandPool (manager->device, submission->commandPool, nullptr);
+  }
+
+  vmaUnmapMemory (manager->allocator, manager->stagingBuffer.allocation);
+  vmaDestroyBuffer (manager->allocator, manager->stagingBuffer.handle, manager->stagingBuffer.allocation);
+
+  pthread_cond_destroy (&manager->wakeCondition);
+  pthread_mutex_destroy (&manager->mutex);
+
+  free (manager->completions);
+  free (manager->requests);
+}
+
+u64 uploadBuffer (Manager* manager, const void* data, VkDeviceSize size, VkBuffer destination) {
+  Transfer transfer;
+  transfer.texture = nullptr;
+  transfer.image = nullptr;
+  transfer.data = data;
+  transfer.buffer = destination;
+  transfer.size = size;
+  transfer.ticket = 0;
+
+  return request (manager, &transfer);
+}
+
+u64 uploadTexture (Manager* manager, const vku::TextureAllocationInfo* allocationInfo, vku::Image* out) {
+  Transfer transfer;
+  transfer.texture = allocationInfo;
+  transfer.image = out;
+  transfer.data = nullptr;
+  transfer.buffer = VK_NULL_HANDLE;
+  transfer.size = vku::getTextureUploadSize (manager->transferContext.formatSupport, allocationInfo);
+  transfer.ticket = 0;
+
+  return request (manager, &transfer);
+}
+
+static void recordAcquires (
+  VkCommandBuffer cmdBuffer,
+  u32 buffersCount,
+  const VkBufferMemoryBarrier* bufferBarriers,
+  u32 imagesCount,
+  const VkImageMemoryBarrier* imageBarriers) {
+
+  vkCmdPipelineBarrier (
+    cmdBuffer,
+    VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+    VKC_NO_FLAGS,
+    0, nullptr,
+    buffersCount, bufferBarriers,
+    imagesCount, imageBarriers
+  );
+}
+
+void acquireUploads (Manager* manager, VkCommandBuffer cmdBuffer) {
+  VkBufferMemoryBarrier bufferBarriers[REI_UPLOAD_BATCH_CAPACITY];
+  VkImageMemoryBarrier imageBarriers[REI_UPLOAD_BATCH_CAPACITY];
+  u32 buffersCount = 0, imagesCount = 0;
+  b8 acquired = REI_FALSE;
+
+  const b8 ownershipTransfer = manager->queueFamily != manager->ownerFamily;
+
+  Transfer transfer;
+  u64 position;
+
+  while (pop (manager->completions, &transfer, &position)) {
+    manager->completedTicket = transfer.ticket;
+    acquired = REI_TRUE;
+
+    // Without ownership transfers a single barrier at the end covers every upload
+    if (!ownershipTransfer) continue;
+
+    if (transfer.texture) {
+      auto barrier = &imageBarriers[imagesCount++];
+      *barrier = {IMAGE_MEMORY_BARRIER};
+      barrier->image = transfer.image->handle;
+      barrier->srcAccessMask = VKC_NO_FLAGS;
+      barrier->dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      barrier->oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier->newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier->srcQueueFamilyIndex = manager->queueFamily;
+      barrier->dstQueueFamilyIndex = manager->ownerFamily;
+
+      barrier->subresourceRange.layerCount = 1;
+      barrier->subresourceRange.baseMipLevel = 0;
+      barrier->subresourceRange.baseArrayLayer = 0;
+      barrier->subresourceRange.levelCount = transfer.texture->mipCount;
+      barrier->subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    } else {
+      auto barrier = &bufferBarriers[buffersCount++];
+      *barrier = {BUFFER_MEMORY_BARRIER};
+      barrier->offset = 0;
+      barrier->size = transfer.size;
+      barrier->buffer = transfer.buffer;
+      barrier->srcAccessMask = VKC_NO_FLAGS;
+      barrier->dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+      barrier->dstAccessMask |= VK_ACCESS_SHADER_READ_BIT;
+      barrier->srcQueueFamilyIndex = manager->queueFamily;
+      barrier->dstQueueFamilyIndex = manager->ownerFamily;
+    }
+
+    if (buffersCount == REI_UPLOAD_BATCH_CAPACITY || imagesCount == REI_UPLOAD_BATCH_CAPACITY) {
+      recordAcquires (cmdBuffer, buffersCount, bufferBarriers, imagesCount, imageBarriers);
+      buffersCount = imagesCount = 0;
+    }
+  }
+
+  if (buffersCount || imagesCount) {
+    recordAcquires (cmdBuffer, buffersCount, bufferBarriers, imagesCount, imageBarriers);
+  } else if (acquired && !ownershipTransfer) {
+    // Fence made the writes of the transfer queue available, they only have to be made visible
+    VkMemoryBarrier barrier {MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+    barrier.dstAccessMask |= VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier (
+      cmdBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VKC_NO_FLAGS,
+      1, &barrier,
+      0, nullptr,
+      0, nullptr
+    );
+  }
+}
+
+b8 isComplete (const Manager* manager, u64 ticket) noexcept {
+  return ticket && ticket <= manager->completedTicket;
+}
+
+}
@@ -0,0 +1,139 @@
+#ifndef UPLOAD_MANAGER_HPP
+#define UPLOAD_MANAGER_HPP
+
+#include <pthread.h>
+
+#include "vkutils.hpp"
+
+// Maximum count of uploads that can wait for the upload thread (or for the owner thread to acquire them)
+#ifndef REI_UPLOAD_QUEUE_CAPACITY
+#  define REI_UPLOAD_QUEUE_CAPACITY 1024u
+#endif
+
+// Maximum count of uploads recorded into a single submission on the transfer queue
+#ifndef REI_UPLOAD_BATCH_CAPACITY
+#  define REI_UPLOAD_BATCH_CAPACITY 64u
+#endif
+
+// Submissions that can be in flight on the transfer queue at once
+#ifndef REI_UPLOAD_SUBMISSIONS_COUNT
+#  define REI_UPLOAD_SUBMISSIONS_COUNT 4u
+#endif
+
+namespace rei::uploads {
+
+// Source of a single upload and its destination, the source has to stay alive until the upload completes
+struct Transfer {
+  // Textures are uploaded when this isn't null, buffers otherwise
+  const vku::TextureAllocationInfo* texture;
+  // Image is created by the upload thread, so it can't be used before the upload completes
+  vku::Image* image;
+
+  const void* data;
+  VkBuffer buffer;
+  // Size of the data for buffers, of the staging memory that the texture takes otherwise
+  VkDeviceSize size;
+
+  // Position in the request queue plus one, uploads complete in the order of their tickets
+  u64 ticket;
+};
+
+struct Slot {
+  Transfer transfer;
+  // Tells whether the slot holds a transfer for the current lap around the queue
+  u64 sequence;
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+// Bounded lock-free queue, any thread can push and pop. Every slot carries a sequence number,
+// so producers and consumers only race for the head and tail indices.
+// Reference: Vyukov "Bounded MPMC queue".
+struct Queue {
+  Slot slots[REI_UPLOAD_QUEUE_CAPACITY];
+
+  // Keep indices on separate cache lines since they are written by different threads
+  alignas (64) u64 head;
+  alignas (64) u64 tail;
+};
+
+#pragma GCC diagnostic pop
+
+// Uploads recorded into a single command buffer, its resources are reused once the fence is signaled
+struct Submission {
+  VkCommandPool commandPool;
+  VkCommandBuffer cmdBuffer;
+  VkFence fence;
+
+  // Ring position right after the last staging memory of the submission
+  u64 stagingEnd;
+
+  u32 transfersCount;
+  // Transfers that were already handed over to the owner thread
+  u32 completedCount;
+  Transfer transfers[REI_UPLOAD_BATCH_CAPACITY];
+};
+
+struct ManagerCreateInfo {
+  // Queue that isn't used by any other thread
+  VkQueue queue;
+  u32 queueFamily;
+  // Family of the queue that uses uploaded resources, ownership is transferred to it
+  u32 ownerFamily;
+  VkDeviceSize stagingSize;
+  // Has to outlive the manager
+  const vku::FormatSupport* formatSupport;
+};
+
+// Streams uploads on a dedicated transfer queue. Requests are recorded and submitted by the upload thread,
+// while the thread that owns the resources (the render loop) acquires finished uploads without ever waiting.
+struct Manager {
+  VkDevice device;
+  VmaAllocator allocator;
+  // Hands the queue to the uploads, the jobPool is null since only its creator can submit jobs
+  vku::TransferContext transferContext;
+  u32 queueFamily, ownerFamily;
+
+  // Persistently mapped ring, head and tail only grow and are wrapped by the buffer size
+  vku::Buffer stagingBuffer;
+  u64 stagingHead, stagingTail;
+
+  Submission submissions[REI_UPLOAD_SUBMISSIONS_COUNT];
+  // Oldest submission that is in flight
+  u32 firstSubmission;
+  u32 submissionsCount;
+
+  // Filled by any thread and drained by the upload thread
+  Queue* requests;
+  // Filled by the upload thread and drained by the owner thread
+  Queue* completions;
+  // Latest upload whose resources were acquired by the owner thread
+  u64 completedTicket;
+
+  pthread_t thread;
+  b32 running;
+  b32 sleeping;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeCondition;
+};
+
+void createManager (VkDevice device, VmaAllocator allocator, const ManagerCreateInfo* createInfo, Manager* out);
+// Finishes every request that was submitted so far, uploads that weren't acquired by then are dropped
+void destroyManager (Manager* manager);
+
+// Can be called from any thread. Returns a ticket that tells when the upload completes,
+// or 0 if the upload can't ever fit into the staging ring.
+[[nodiscard]] u64 uploadBuffer (Manager* manager, const void* data, VkDeviceSize size, VkBuffer destination);
+[[nodiscard]] u64 uploadTexture (Manager* manager, const vku::TextureAllocationInfo* allocationInfo, vku::Image* out);
+
+// Owner thread only. Records the acquire half of ownership transfers of finished uploads, their resources
+// can be used by any command recorded into cmdBuffer afterwards. Has to be called outside of a render pass.
+void acquireUploads (Manager* manager, VkCommandBuffer cmdBuffer);
+// Owner thread only
+[[nodiscard]] b8 isComplete (const Manager* manager, u64 ticket) noexcept;
+
+}
+
+#endif /* UPLOAD_MANAGER_HPP */
@@ -164,6 +164,11 @@ extern PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr;
 #  define VKC_TEXTURE_FORMAT VK_FORMAT_R8G8B8A8_SRGB
 #endif
 
+// Upper bound for the mip chain of a single texture (enough for 32768x32768)
+#ifndef VKC_MAX_MIP_LEVELS
+#  define VKC_MAX_MIP_LEVELS 16u
+#endif
+
 #ifndef VKC_DEPTH_FORMAT
 #  define VKC_DEPTH_FORMAT VK_FORMAT_X8_D24_UNORM_PACK32
 #endif
@@ -3,12 +3,40 @@
 
 #include "window.hpp"
 #include "vkutils.hpp"
+#include "job_pool.hpp"
+#include "block_compression.hpp"
 
 #include <lz4/lib/lz4.h>
 #include <VulkanMemoryAllocator/include/vk_mem_alloc.h>
 
 namespace rei::vku {
 
+static b8 canSampleFormat (VkPhysicalDevice physicalDevice, VkFormat format) {
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties (physicalDevice, format, &properties);
+
+  VkFormatFeatureFlags requiredFlags = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+  requiredFlags |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (properties.optimalTilingFeatures & requiredFlags) == requiredFlags;
+}
+
+void queryFormatSupport (VkPhysicalDevice physicalDevice, const VkPhysicalDeviceFeatures* enabledFeatures, FormatSupport* out) {
+  // BC formats can only be used if the feature was enabled on the device
+  b8 enabled = enabledFeatures->textureCompressionBC == VK_TRUE;
+  out->bc1 = enabled && canSampleFormat (physicalDevice, VK_FORMAT_BC1_RGB_SRGB_BLOCK);
+  out->bc3 = enabled && canSampleFormat (physicalDevice, VK_FORMAT_BC3_SRGB_BLOCK);
+  out->bc7 = enabled && canSampleFormat (physicalDevice, VK_FORMAT_BC7_SRGB_BLOCK);
+}
+
+b8 isFormatSupported (const FormatSupport* formatSupport, VkFormat format) noexcept {
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return formatSupport->bc1;
+    case VK_FORMAT_BC3_SRGB_BLOCK: return formatSupport->bc3;
+    case VK_FORMAT_BC7_SRGB_BLOCK: return formatSupport->bc7;
+    default: return REI_TRUE;
+  }
+}
+
 b8 findQueueIndices (VkPhysicalDevice physicalDevice, VkSurfaceKHR targetSurface, QueueIndices* out) {
   out->graphics = out->compute = out->present = out->transfer = UINT32_MAX;
 
@@ -32,15 +60,32 @@ b8 findQueueIndices (VkPhysicalDevice physicalDevice, VkSurfaceKHR targetSurface
       if (current->queueFlags & VK_QUEUE_GRAPHICS_BIT) out->graphics = index;
       if (current->queueFlags & VK_QUEUE_TRANSFER_BIT) out->transfer = index;
 
-      if (IS_VALID (graphics) && IS_VALID (present) && IS_VALID (transfer) && IS_VALID (compute)) {
-        #undef IS_VALID
-        return REI_TRUE;
-      }
+      if (IS_VALID (graphics) && IS_VALID (present) && IS_VALID (transfer) && IS_VALID (compute)) break;
     }
   }
 
+  if (!IS_VALID (graphics) || !IS_VALID (present) || !IS_VALID (transfer) || !IS_VALID (compute)) {
+    #undef IS_VALID
+    return REI_FALSE;
+  }
+
   #undef IS_VALID
-  return REI_FALSE;
+
+  // Families that only do transfers are usually backed by DMA engines, streaming uploads prefer them
+  for (u32 index = 0; index < count; ++index) {
+    const VkQueueFlags flags = available[index].queueFlags;
+
+    if (
+      available[index].queueCount &&
+      (flags & VK_QUEUE_TRANSFER_BIT) &&
+      !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+    ) {
+      out->transfer = index;
+      break;
+    }
+  }
+
+  return REI_TRUE;
 }
 
 void choosePhysicalDevice (
@@ -477,29 +522,170 @@ void transitionImageLayout (VkCommandBuffer cmdBuffer, const ImageLayoutTransiti
   );
 }
 
-void allocateTexture (
+struct ChunkDecompressJob {
+  const char* source;
+  char* destination;
+  u32 compressedSize;
+  u32 size;
+};
+
+static void decompressChunkJob (void* data) {
+  auto job = (const ChunkDecompressJob*) data;
+  i32 decompressedSize = LZ4_decompress_safe (job->source, job->destination, (i32) job->compressedSize, (i32) job->size);
+
+  REI_ASSERT (decompressedSize == (i32) job->size);
+  (void) decompressedSize;
+}
+
+// Chunks are independent of each other, so they are decompressed in parallel when there's a pool
+static void decompressTexture (const TextureAllocationInfo* allocationInfo, jobs::Pool* pool, char* out) {
+  const size_t chunksCount = allocationInfo->chunksCount;
+  auto decompressJobs = REI_MALLOC (ChunkDecompressJob, chunksCount);
+
+  for (size_t index = 0; index < chunksCount; ++index) {
+    const auto chunk = &allocationInfo->chunks[index];
+    auto job = &decompressJobs[index];
+
+    job->size = chunk->size;
+    job->destination = out + chunk->offset;
+    job->compressedSize = chunk->compressedSize;
+    job->source = allocationInfo->pixels + chunk->compressedOffset;
+
+    if (pool) {
+      jobs::submit (pool, decompressChunkJob, job);
+      // Queue of this thread can't hold more jobs than that
+      if (!((index + 1) % REI_JOBS_QUEUE_CAPACITY)) jobs::wait (pool);
+    } else {
+      decompressChunkJob (job);
+    }
+  }
+
+  if (pool) jobs::wait (pool);
+  free (decompressJobs);
+}
+
+VkDeviceSize alignUploadSize (VkDeviceSize size) noexcept {
+  return (size + 15) & ~(VkDeviceSize) 15;
+}
+
+VkDeviceSize getTextureUploadSize (
+  const FormatSupport* formatSupport,
+  const TextureAllocationInfo* allocationInfo) noexcept {
+
+  if (isFormatSupported (formatSupport, allocationInfo->format)) return (VkDeviceSize) allocationInfo->size;
+
+  VkDeviceSize size = 0;
+  for (u32 mipLevel = 0; mipLevel < allocationInfo->mipCount; ++mipLevel) {
+    const u32 width = REI_MAX (allocationInfo->width >> mipLevel, 1u);
+    const u32 height = REI_MAX (allocationInfo->height >> mipLevel, 1u);
+    size += (VkDeviceSize) width * height * 4;
+  }
+
+  return size;
+}
+
+void beginUploadBatch (
   VkDevice device,
   VmaAllocator allocator,
-  const TextureAllocationInfo* allocationInfo,
   const TransferContext* transferContext,
-  Image* out) {
+  VkDeviceSize size,
+  UploadBatch* out) {
+
+  out->device = device;
+  out->allocator = allocator;
+  out->transferContext = transferContext;
+  out->offset = 0;
+  out->srcQueueFamily = out->dstQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+
+  // Buffers can't be empty
+  allocateStagingBuffer (allocator, REI_MAX (size, alignUploadSize (1)), &out->stagingBuffer);
+  VKC_CHECK (vmaMapMemory (allocator, out->stagingBuffer.allocation, &out->stagingBuffer.mapped));
+
+  startImmediateCmd (device, transferContext, &out->cmdBuffer);
+}
+
+void* reserveUpload (UploadBatch* batch, VkDeviceSize size, VkDeviceSize* offset) {
+  REI_ASSERT (batch->offset + size <= batch->stagingBuffer.size);
+
+  *offset = batch->offset;
+  batch->offset = alignUploadSize (batch->offset + size);
+  return (u8*) batch->stagingBuffer.mapped + *offset;
+}
+
+void uploadBuffer (UploadBatch* batch, VkDeviceSize offset, VkDeviceSize size, VkBuffer destination) {
+  VkBufferCopy copyRegion;
+  copyRegion.size = size;
+  copyRegion.dstOffset = 0;
+  copyRegion.srcOffset = offset;
+
+  vkCmdCopyBuffer (batch->cmdBuffer, batch->stagingBuffer.handle, destination, 1, &copyRegion);
+
+  if (batch->srcQueueFamily != batch->dstQueueFamily) {
+    // Release half of the ownership transfer, the owner queue acquires the buffer with the same barrier
+    VkBufferMemoryBarrier barrier {BUFFER_MEMORY_BARRIER};
+    barrier.size = size;
+    barrier.offset = 0;
+    barrier.buffer = destination;
+    barrier.dstAccessMask = VKC_NO_FLAGS;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = batch->srcQueueFamily;
+    barrier.dstQueueFamilyIndex = batch->dstQueueFamily;
+
+    vkCmdPipelineBarrier (
+      batch->cmdBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      VKC_NO_FLAGS,
+      0, nullptr,
+      1, &barrier,
+      0, nullptr
+    );
+  }
+}
 
+void uploadTexture (UploadBatch* batch, const TextureAllocationInfo* allocationInfo, Image* out) {
   VkExtent3D extent {allocationInfo->width, allocationInfo->height, 1};
-  VkDeviceSize size = (VkDeviceSize) (extent.width * extent.height * 4);
-  const u32 mipLevels = (u32) floorf (log2f ((float) REI_MAX (extent.width, extent.height))) + 1;
-
-  Buffer stagingBuffer;
-  allocateStagingBuffer (allocator, size, &stagingBuffer);
-  VKC_CHECK (vmaMapMemory (allocator, stagingBuffer.allocation, &stagingBuffer.mapped));
-
-  LZ4_decompress_safe (
-    allocationInfo->pixels,
-    (char*) (stagingBuffer.mapped),
-    (int) (allocationInfo->compressedSize),
-    (int) (size)
-  );
+  const u32 mipLevels = allocationInfo->mipCount;
+  jobs::Pool* pool = batch->transferContext->jobPool;
+
+  VkFormat format = allocationInfo->format;
+  size_t mipOffsets[VKC_MAX_MIP_LEVELS];
+  memcpy (mipOffsets, allocationInfo->mipOffsets, sizeof (size_t) * mipLevels);
+
+  VkDeviceSize stagingOffset;
+  const FormatSupport* formatSupport = batch->transferContext->formatSupport;
+  auto staging = (char*) reserveUpload (batch, getTextureUploadSize (formatSupport, allocationInfo), &stagingOffset);
+
+  if (isFormatSupported (formatSupport, format)) {
+    decompressTexture (allocationInfo, pool, staging);
+  } else {
+    // Device can't sample the block compressed format, so decode it to VKC_TEXTURE_FORMAT
+    bc::BlockFormat blockFormat = bc::BlockFormat::BC1;
+    if (format == VK_FORMAT_BC3_SRGB_BLOCK) blockFormat = bc::BlockFormat::BC3;
+    if (format == VK_FORMAT_BC7_SRGB_BLOCK) blockFormat = bc::BlockFormat::BC7;
+
+    auto blocks = REI_MALLOC (char, allocationInfo->size);
+    decompressTexture (allocationInfo, pool, blocks);
+
+    size_t size = 0;
+    for (u32 mipLevel = 0; mipLevel < mipLevels; ++mipLevel) {
+      mipOffsets[mipLevel] = size;
+      size += (size_t) REI_MAX (extent.width >> mipLevel, 1u) * REI_MAX (extent.height >> mipLevel, 1u) * 4;
+    }
 
-  vmaUnmapMemory (allocator, stagingBuffer.allocation);
+    for (u32 mipLevel = 0; mipLevel < mipLevels; ++mipLevel) {
+      bc::decompressImage (
+        blockFormat,
+        (const u8*) blocks + allocationInfo->mipOffsets[mipLevel],
+        REI_MAX (extent.width >> mipLevel, 1u),
+        REI_MAX (extent.height >> mipLevel, 1u),
+        (u8*) staging + mipOffsets[mipLevel]
+      );
+    }
+
+    free (blocks);
+    format = VKC_TEXTURE_FORMAT;
+  }
 
   {
     VkImageCreateInfo createInfo;
@@ -513,20 +699,18 @@ void allocateTexture (
     createInfo.arrayLayers = 1;
     createInfo.mipLevels = mipLevels;
     createInfo.imageType = VK_IMAGE_TYPE_2D;
-    createInfo.format = VKC_TEXTURE_FORMAT;
+    createInfo.format = format;
     createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    createInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
     createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    createInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-    createInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    createInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
     VmaAllocationCreateInfo vmaAllocationInfo {};
     vmaAllocationInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
     vmaAllocationInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
     VKC_CHECK (vmaCreateImage (
-      allocator,
+      batch->allocator,
       &createInfo,
       &vmaAllocationInfo,
       &out->handle,
@@ -542,9 +726,6 @@ void allocateTexture (
   subresourceRange.levelCount = mipLevels;
   subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 
-  VkCommandBuffer cmdBuffer;
-  startImmediateCmd (device, transferContext, &cmdBuffer);
-
   {
     ImageLayoutTransitionInfo transitionInfo;
     transitionInfo.subresourceRange = &subresourceRange;
@@ -553,125 +734,80 @@ void allocateTexture (
     transitionInfo.destination = VK_PIPELINE_STAGE_TRANSFER_BIT;
     transitionInfo.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 
-    transitionImageLayout (cmdBuffer, &transitionInfo, out->handle);
+    transitionImageLayout (batch->cmdBuffer, &transitionInfo, out->handle);
   }
 
   {
-    VkBufferImageCopy copyRegion;
-    copyRegion.imageOffset.x = 0;
-    copyRegion.imageOffset.y = 0;
-    copyRegion.imageOffset.z = 0;
-
-    copyRegion.bufferOffset = 0;
-    copyRegion.bufferRowLength = 0;
-    copyRegion.imageExtent = extent;
-    copyRegion.bufferImageHeight = 0;
-
-    copyRegion.imageSubresource.mipLevel = 0;
-    copyRegion.imageSubresource.layerCount = 1;
-    copyRegion.imageSubresource.baseArrayLayer = 0;
-    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    // Mip chain is baked offline, so every level is uploaded with a single copy
+    VkBufferImageCopy copyRegions[VKC_MAX_MIP_LEVELS];
+
+    for (u32 mipLevel = 0; mipLevel < mipLevels; ++mipLevel) {
+      auto copyRegion = &copyRegions[mipLevel];
+      copyRegion->imageOffset.x = 0;
+      copyRegion->imageOffset.y = 0;
+      copyRegion->imageOffset.z = 0;
+
+      copyRegion->bufferRowLength = 0;
+      copyRegion->bufferImageHeight = 0;
+      copyRegion->bufferOffset = stagingOffset + (VkDeviceSize) mipOffsets[mipLevel];
+
+      copyRegion->imageExtent.depth = 1;
+      copyRegion->imageExtent.width = REI_MAX (extent.width >> mipLevel, 1u);
+      copyRegion->imageExtent.height = REI_MAX (extent.height >> mipLevel, 1u);
+
+      copyRegion->imageSubresource.mipLevel = mipLevel;
+      copyRegion->imageSubresource.layerCount = 1;
+      copyRegion->imageSubresource.baseArrayLayer = 0;
+      copyRegion->imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    }
 
     vkCmdCopyBufferToImage (
-      cmdBuffer,
-      stagingBuffer.handle,
+      batch->cmdBuffer,
+      batch->stagingBuffer.handle,
       out->handle,
       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-      1, &copyRegion
+      mipLevels, copyRegions
     );
-
-    ImageLayoutTransitionInfo transitionInfo;
-    transitionInfo.subresourceRange = &subresourceRange;
-    transitionInfo.source = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    transitionInfo.destination = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    transitionInfo.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    transitionInfo.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-
-    transitionImageLayout (cmdBuffer, &transitionInfo, out->handle);
   }
 
-  subresourceRange.levelCount = 1;
-
-  for (u32 mipLevel = 1; mipLevel < mipLevels; ++mipLevel) {
-    subresourceRange.baseMipLevel = mipLevel;
-
-    {
-      ImageLayoutTransitionInfo transitionInfo;
-      transitionInfo.subresourceRange = &subresourceRange;
-      transitionInfo.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-      transitionInfo.source = VK_PIPELINE_STAGE_TRANSFER_BIT;
-      transitionInfo.destination = VK_PIPELINE_STAGE_TRANSFER_BIT;
-      transitionInfo.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-
-      transitionImageLayout (cmdBuffer, &transitionInfo, out->handle);
-    }
-
-    VkImageBlit imageBlit;
-    imageBlit.srcSubresource.layerCount = 1;
-    imageBlit.srcSubresource.baseArrayLayer = 0;
-    imageBlit.srcSubresource.mipLevel = mipLevel - 1;
-    imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-
-    imageBlit.srcOffsets[0].x = 0;
-    imageBlit.srcOffsets[0].y = 0;
-    imageBlit.srcOffsets[0].z = 0;
-    imageBlit.srcOffsets[1].z = 1;
-    imageBlit.srcOffsets[1].x = (int32_t) (extent.width >> (mipLevel - 1));
-    imageBlit.srcOffsets[1].y = (int32_t) (extent.height >> (mipLevel - 1));
-
-    imageBlit.dstSubresource.layerCount = 1;
-    imageBlit.dstSubresource.baseArrayLayer = 0;
-    imageBlit.dstSubresource.mipLevel = mipLevel;
-    imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-
-    imageBlit.dstOffsets[0].x = 0;
-    imageBlit.dstOffsets[0].y = 0;
-    imageBlit.dstOffsets[0].z = 0;
-    imageBlit.dstOffsets[1].z = 1;
-    imageBlit.dstOffsets[1].x = (int32_t) (extent.width >> mipLevel);
-    imageBlit.dstOffsets[1].y = (int32_t) (extent.height >> mipLevel);
-
-    vkCmdBlitImage (
-      cmdBuffer,
-      out->handle,
-      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-      out->handle,
-      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-      1, &imageBlit,
-      VK_FILTER_LINEAR
+  if (batch->srcQueueFamily != batch->dstQueueFamily) {
+    // Release half of the ownership transfer, the owner queue acquires the image with matching layouts
+    VkImageMemoryBarrier barrier {IMAGE_MEMORY_BARRIER};
+    barrier.image = out->handle;
+    barrier.subresourceRange = subresourceRange;
+    barrier.dstAccessMask = VKC_NO_FLAGS;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = batch->srcQueueFamily;
+    barrier.dstQueueFamilyIndex = batch->dstQueueFamily;
+
+    vkCmdPipelineBarrier (
+      batch->cmdBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      VKC_NO_FLAGS,
+      0, nullptr,
+      0, nullptr,
+      1, &barrier
     );
-
-   ImageLayoutTransitionInfo transitionInfo;
-   transitionInfo.subresourceRange = &subresourceRange;
-   transitionInfo.source = VK_PIPELINE_STAGE_TRANSFER_BIT;
-   transitionInfo.destination = VK_PIPELINE_STAGE_TRANSFER_BIT;
-   transitionInfo.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-   transitionInfo.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-
-   transitionImageLayout (cmdBuffer, &transitionInfo, out->handle);
-  }
-
-  subresourceRange.baseMipLevel = 0;
-  subresourceRange.levelCount = mipLevels;
-
-  {
+  } else {
     ImageLayoutTransitionInfo transitionInfo;
+    transitionInfo.subresourceRange = &subresourceRange;
     transitionInfo.source = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    transitionInfo.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    transitionInfo.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
     transitionInfo.destination = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     transitionInfo.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    transitionImageLayout (cmdBuffer, &transitionInfo, out->handle);
+    transitionImageLayout (batch->cmdBuffer, &transitionInfo, out->handle);
   }
 
-  submitImmediateCmd (device, transferContext, cmdBuffer);
-  vmaDestroyBuffer (allocator, stagingBuffer.handle, stagingBuffer.allocation);
-
+  // View doesn't depend on the contents, so it's created before the upload is submitted
   VkImageViewCreateInfo createInfo;
   createInfo.pNext = nullptr;
   createInfo.image = out->handle;
   createInfo.flags = VKC_NO_FLAGS;
-  createInfo.format = VKC_TEXTURE_FORMAT;
+  createInfo.format = format;
   createInfo.sType = IMAGE_VIEW_CREATE_INFO;
   createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
   createInfo.subresourceRange = subresourceRange;
@@ -680,7 +816,27 @@ void allocateTexture (
   createInfo.components.b = VK_COMPONENT_SWIZZLE_B;
   createInfo.components.a = VK_COMPONENT_SWIZZLE_A;
 
-  VKC_CHECK (vkCreateImageView (device, &createInfo, nullptr, &out->view));
+  VKC_CHECK (vkCreateImageView (batch->device, &createInfo, nullptr, &out->view));
+}
+
+void submitUploadBatch (UploadBatch* batch) {
+  vmaUnmapMemory (batch->allocator, batch->stagingBuffer.allocation);
+  submitImmediateCmd (batch->device, batch->transferContext, batch->cmdBuffer);
+  vmaDestroyBuffer (batch->allocator, batch->stagingBuffer.handle, batch->stagingBuffer.allocation);
+}
+
+void allocateTexture (
+  VkDevice device,
+  VmaAllocator allocator,
+  const TextureAllocationInfo* allocationInfo,
+  const TransferContext* transferContext,
+  Image* out) {
+
+  UploadBatch batch;
+  const VkDeviceSize size = getTextureUploadSize (transferContext->formatSupport, allocationInfo);
+  beginUploadBatch (device, allocator, transferContext, alignUploadSize (size), &batch);
+  uploadTexture (&batch, allocationInfo, out);
+  submitUploadBatch (&batch);
 }
 
 }
@@ -13,6 +13,10 @@ namespace rei::xcb {
 struct Window;
 }
 
+namespace rei::jobs {
+struct Pool;
+}
+
 namespace rei::vku {
 
 struct QueueIndices {
@@ -80,10 +84,20 @@ struct BufferAllocationInfo {
   VkDeviceSize size;
 };
 
+// Compressed texture formats that can be sampled on the chosen device.
+// Textures in unsupported formats are decompressed on the CPU when they are loaded.
+struct FormatSupport {
+  b8 bc1, bc3, bc7;
+};
+
 struct TransferContext {
   VkFence fence;
   VkQueue queue;
   VkCommandPool commandPool;
+  // Used to prepare data for transfers on multiple threads, can be null
+  jobs::Pool* jobPool;
+  // Formats of the device that uploaded textures are sampled on
+  const FormatSupport* formatSupport;
 };
 
 struct Buffer {
@@ -94,20 +108,64 @@ struct Buffer {
   VkDeviceSize size;
 };
 
+// Uploads that share one staging buffer and one command buffer, they are submitted together with a single
+// fence wait. The staging buffer can't grow, so the sizes of all of the uploads are needed up front.
+struct UploadBatch {
+  VkDevice device;
+  VmaAllocator allocator;
+  const TransferContext* transferContext;
+  VkCommandBuffer cmdBuffer;
+
+  Buffer stagingBuffer;
+  // Bytes of the staging buffer that were handed out so far
+  VkDeviceSize offset;
+
+  // Family of the queue that records the uploads and the one that uses the resources afterwards,
+  // ownership is released at the end of every upload when they differ
+  u32 srcQueueFamily, dstQueueFamily;
+};
+
 struct ImageLayoutTransitionInfo {
   VkImageLayout oldLayout, newLayout;
   VkPipelineStageFlags source, destination;
   VkImageSubresourceRange* subresourceRange;
 };
 
+// Part of the texture data that was compressed independently of others
+struct TextureChunk {
+  // Offset of compressed data relative to TextureAllocationInfo::pixels
+  u64 compressedOffset;
+  // Offset inside of the decompressed data
+  u64 offset;
+
+  u32 compressedSize;
+  u32 size;
+};
+
 struct TextureAllocationInfo {
-  char* pixels;
-  u32 width, height;
+  // Table of chunks followed by the compressed data, usually points into a mapping of the asset
+  const char* pixels;
   size_t compressedSize;
+  const TextureChunk* chunks;
+  size_t chunksCount;
+  // File that pixels were read from
+  File file;
+
+  // Size of the whole mip chain after decompression
+  size_t size;
+  // Offset of each level inside of the decompressed data, levels are tightly packed
+  size_t mipOffsets[VKC_MAX_MIP_LEVELS];
+
+  u32 width, height;
+  u32 mipCount;
+  VkFormat format;
 };
 
 b8 findQueueIndices (VkPhysicalDevice physicalDevice, VkSurfaceKHR targetSurface, QueueIndices* out);
 
+void queryFormatSupport (VkPhysicalDevice physicalDevice, const VkPhysicalDeviceFeatures* enabledFeatures, FormatSupport* out);
+[[nodiscard]] b8 isFormatSupported (const FormatSupport* formatSupport, VkFormat format) noexcept;
+
 void choosePhysicalDevice (
   VkInstance instance,
   VkSurfaceKHR targetSurface,
@@ -132,6 +190,32 @@ void allocateStagingBuffer (VmaAllocator allocator, VkDeviceSize size, Buffer* o
 
 void transitionImageLayout (VkCommandBuffer commandBuffer, const ImageLayoutTransitionInfo* transitionInfo, VkImage image);
 
+// Uploads are aligned to 16 bytes inside of the staging buffer, so the size of a batch is the sum of aligned sizes
+[[nodiscard]] VkDeviceSize alignUploadSize (VkDeviceSize size) noexcept;
+// Textures in formats that can't be sampled take the size of their mip chain decompressed to VKC_TEXTURE_FORMAT
+[[nodiscard]] VkDeviceSize getTextureUploadSize (
+  const FormatSupport* formatSupport,
+  const TextureAllocationInfo* allocationInfo
+) noexcept;
+
+void beginUploadBatch (
+  VkDevice device,
+  VmaAllocator allocator,
+  const TransferContext* transferContext,
+  VkDeviceSize size,
+  UploadBatch* out
+);
+
+// Returns mapped staging memory for size bytes, offset is where it starts in the staging buffer
+[[nodiscard]] void* reserveUpload (UploadBatch* batch, VkDeviceSize size, VkDeviceSize* offset);
+// Records a copy of reserved staging memory to the start of the destination
+void uploadBuffer (UploadBatch* batch, VkDeviceSize offset, VkDeviceSize size, VkBuffer destination);
+// Creates the image and its view, and records the upload of its whole mip chain
+void uploadTexture (UploadBatch* batch, const TextureAllocationInfo* allocationInfo, Image* out);
+// Submits every recorded upload, waits for them to finish and releases the staging buffer
+void submitUploadBatch (UploadBatch* batch);
+
+// Uploads a single texture with a batch of its own
 void allocateTexture (
   VkDevice device,
   VmaAllocator allocator,